@@ -4,12 +4,14 @@
 .globl __start
 __start:
     move $fp $sp     # Set frame pointer
+    la $gp _gp       # Set global pointer, which small data is addressed from
 
     # main(argc, argv)
     lw $a0 0($sp)    # argc = sp[0]
     addiu $a1 $sp 4  # argv starts at sp[4]
     addiu $sp $sp -8 # Move stack to fit arguments
     jal main
+    nop              # Delay slot, for targets that model them
 
     move $a0 $v0
 
@@ -0,0 +1,252 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* Benchmark program generator
+
+Writes synthetic MIPS sources for `make bench`, deterministic for a given seed.
+Each file has a data segment (words, halves, bytes, strings, space and words holding
+addresses), a few macros, and a text segment split into global functions. The text
+mixes arithmetic, shifts, loads and stores, multiplication, branches to nearby labels,
+pseudoinstructions, macro invocations, and calls to functions in the same and other
+files. The first file also defines main, which calls a function in every file.
+
+ $ bench/gen [options] dir
+   -f files          number of source files (default 4), written to dir/srcA.asm, dir/srcB.asm, ...
+   -n instructions   instructions per file (default 20000)
+   -F functions      functions per file (default 16)
+   -l labels         branch labels per file (default 128)
+   -b distance       branches go at most this many labels forward or back (default 4)
+   -m percent        share of instructions that are macro invocations (default 5)
+   -d items          data items per file (default 32)
+   -s seed           (default 1)
+
+The assembler keeps at most 256 symbols per file, so functions, labels, data items and
+the functions called in other files must add up to less than that.
+*/
+
+#define MAX_FILES 26
+#define MAX_SYMBOLS 240
+
+typedef struct {
+    int files;
+    long instructions;
+    int functions;
+    int labels;
+    int distance;
+    int macro_percent;
+    int data_items;
+    uint64_t seed;
+} GenOptions;
+
+uint64_t STATE;
+
+// xorshift64*; the sequence only depends on the seed
+uint32_t next_random(void) {
+    STATE ^= STATE >> 12;
+    STATE ^= STATE << 25;
+    STATE ^= STATE >> 27;
+    return (uint32_t) ((STATE * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+int random_below(const int n) {
+    return (int) (next_random() % (uint32_t) n);
+}
+
+const char *REGISTERS[] = {"$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7", "$s0", "$s1", "$s2", "$s3"};
+
+const char * reg(void) {
+    return REGISTERS[random_below(sizeof(REGISTERS) / sizeof(REGISTERS[0]))];
+}
+
+char file_letter(const int file) {
+    return (char) ('A' + file);
+}
+
+/* === DATA === */
+
+void write_data(FILE *out, const GenOptions *options, const int file) {
+    fprintf(out, ".data\n");
+    for (int i = 0; i < options->data_items; i++) {
+        fprintf(out, "d%c_%d: ", file_letter(file), i);
+        switch (random_below(6)) {
+            case 0:
+                fprintf(out, ".word %d %d %d %d\n", random_below(1000), random_below(1000), -random_below(1000), random_below(1 << 20));
+                break;
+            case 1:
+                fprintf(out, ".half %d %d\n", random_below(30000), -random_below(30000));
+                break;
+            case 2:
+                fprintf(out, ".byte %d %d %d\n", random_below(128), random_below(128), random_below(128));
+                break;
+            case 3:
+                fprintf(out, ".asciiz \"item %d of file %c\"\n", i, file_letter(file));
+                break;
+            case 4:
+                fprintf(out, ".space %d\n", 4 * (1 + random_below(8)));
+                break;
+            default:
+                // Address of a function, relocated by the linker
+                fprintf(out, ".word f%c_%d\n", file_letter(file), random_below(options->functions));
+        }
+    }
+    fprintf(out, "\n");
+}
+
+/* === TEXT === */
+
+void write_macros(FILE *out) {
+    fprintf(out, ".macro bump %%r\n    addi %%r %%r 1\n    sll %%r %%r 1\n.end_macro\n\n");
+    fprintf(out, ".macro swap %%a %%b\n    xor %%a %%a %%b\n    xor %%b %%a %%b\n    xor %%a %%a %%b\n.end_macro\n\n");
+}
+
+// Writes a branch to a label at most options->distance labels away from the current one
+void write_branch(FILE *out, const GenOptions *options, const int file, const int label) {
+    int target = label + random_below(2 * options->distance) - options->distance + 1;
+    if (target < 0) target = 0;
+    if (target >= options->labels) target = options->labels - 1;
+
+    static const char *BRANCHES[] = {"beq", "bne", "blt", "bge", "bgt", "ble"};
+    fprintf(out, "    %s %s %s L%c_%d\n", BRANCHES[random_below(6)], reg(), reg(), file_letter(file), target);
+}
+
+// Writes one instruction, or one macro invocation
+void write_instruction(FILE *out, const GenOptions *options, const int file, const int label) {
+    static const char *R_TYPE[] = {"add", "addu", "sub", "subu", "and", "or", "xor", "nor", "slt", "sltu"};
+    static const char *I_TYPE[] = {"addi", "addiu", "andi", "ori", "slti"};
+    static const char *SHIFTS[] = {"sll", "srl", "sra"};
+
+    if (random_below(100) < options->macro_percent) {
+        if (random_below(2)) fprintf(out, "    bump %s\n", reg());
+        else fprintf(out, "    swap %s %s\n", reg(), reg());
+        return;
+    }
+
+    const int kind = random_below(100);
+    if (kind < 40) {
+        fprintf(out, "    %s %s, %s, %s\n", R_TYPE[random_below(10)], reg(), reg(), reg());
+    } else if (kind < 55) {
+        fprintf(out, "    %s %s, %s, %d\n", I_TYPE[random_below(5)], reg(), reg(), random_below(2000));
+    } else if (kind < 60) {
+        fprintf(out, "    %s %s, %s, %d\n", SHIFTS[random_below(3)], reg(), reg(), random_below(32));
+    } else if (kind < 75) {
+        fprintf(out, "    %s %s, %d($sp)\n", random_below(2) ? "lw" : "sw", reg(), 4 * random_below(64));
+    } else if (kind < 83) {
+        write_branch(out, options, file, label);
+    } else if (kind < 86) {
+        // Mostly calls within the file; some go to the next file
+        const int callee = random_below(5) == 0 ? (file + 1) % options->files : file;
+        fprintf(out, "    jal f%c_%d\n", file_letter(callee), random_below(options->functions));
+    } else if (kind < 88) {
+        fprintf(out, "    li %s, %d\n", reg(), random_below(1 << 30));
+    } else if (kind < 89) {
+        fprintf(out, "    la %s, d%c_%d\n", reg(), file_letter(file), random_below(options->data_items));
+    } else if (kind < 91) {
+        fprintf(out, "    move %s, %s\n", reg(), reg());
+    } else if (kind < 96) {
+        fprintf(out, "    mult %s, %s\n    mflo %s\n", reg(), reg(), reg());
+    } else {
+        fprintf(out, "    nop\n");
+    }
+}
+
+void write_text(FILE *out, const GenOptions *options, const int file) {
+    fprintf(out, ".text\n");
+    if (file == 0) {
+        fprintf(out, ".globl main\nmain:\n");
+        for (int f = 0; f < options->files; f++) {
+            fprintf(out, "    jal f%c_0\n", file_letter(f));
+        }
+        fprintf(out, "    li $v0, 10\n    syscall\n\n");
+    }
+
+    const long per_function = options->instructions / options->functions;
+    const long per_label = options->instructions / options->labels;
+    int label = 0;
+    for (int function = 0; function < options->functions; function++) {
+        fprintf(out, ".globl f%c_%d\nf%c_%d:\n", file_letter(file), function, file_letter(file), function);
+        const long end = function + 1 == options->functions ? options->instructions : (function + 1) * per_function;
+        for (long i = function * per_function; i < end; i++) {
+            if (i % per_label == 0 && label < options->labels) {
+                fprintf(out, "L%c_%d:\n", file_letter(file), label++);
+            }
+            write_instruction(out, options, file, label - 1 < 0 ? 0 : label - 1);
+        }
+        fprintf(out, "    jr $ra\n\n");
+    }
+    // Labels that did not fit between instructions still need to be defined for the branches
+    for (; label < options->labels; label++) {
+        fprintf(out, "L%c_%d:\n    nop\n", file_letter(file), label);
+    }
+}
+
+/* === MAIN === */
+
+int parse_number(const char *arg, const long min, const long max, long *value) {
+    char *endptr;
+    *value = strtol(arg, &endptr, 10);
+    return *endptr == '\0' && *value >= min && *value <= max;
+}
+
+int main(int argc, char *argv[]) {
+    GenOptions options = {4, 20000, 16, 128, 4, 5, 32, 1};
+
+    int arg = 1;
+    while (arg < argc - 1 && argv[arg][0] == '-') {
+        long value;
+        const char option = argv[arg][1];
+        if (argv[arg][2] != '\0' || arg + 2 >= argc || !parse_number(argv[arg+1], 0, 100000000, &value)) {
+            fprintf(stderr, "gen: invalid option %s\n", argv[arg]);
+            return 1;
+        }
+        switch (option) {
+            case 'f': options.files = (int) value; break;
+            case 'n': options.instructions = value; break;
+            case 'F': options.functions = (int) value; break;
+            case 'l': options.labels = (int) value; break;
+            case 'b': options.distance = (int) value; break;
+            case 'm': options.macro_percent = (int) value; break;
+            case 'd': options.data_items = (int) value; break;
+            case 's': options.seed = (uint64_t) value; break;
+            default:
+                fprintf(stderr, "gen: unrecognized option %s\n", argv[arg]);
+                return 1;
+        }
+        arg += 2;
+    }
+    if (arg != argc - 1 || options.files < 1 || options.files > MAX_FILES || options.functions < 1 || options.labels < 1
+        || options.distance < 1 || options.data_items < 1 || options.instructions < options.functions) {
+        fprintf(stderr, "usage: gen [-f files] [-n instructions] [-F functions] [-l labels] [-b distance] [-m percent] [-d items] [-s seed] dir\n");
+        return 1;
+    }
+    if (options.functions * 2 + options.labels + options.data_items + 1 > MAX_SYMBOLS) {
+        fprintf(stderr, "gen: too many symbols per file; the assembler keeps at most 256\n");
+        return 1;
+    }
+    if (options.instructions / options.labels == 0) options.labels = (int) options.instructions;
+
+    const char *dir = argv[arg];
+    mkdir(dir, 0777);
+    STATE = options.seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    for (int file = 0; file < options.files; file++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/src%c.asm", dir, file_letter(file));
+        FILE *out = fopen(path, "w");
+        if (out == NULL) {
+            fprintf(stderr, "gen: could not write \"%s\"\n", path);
+            return 1;
+        }
+        fprintf(out, "# Generated by bench/gen; file %d of %d\n\n", file + 1, options.files);
+        write_macros(out);
+        write_data(out, &options, file);
+        write_text(out, &options, file);
+        if (fclose(out) != 0) {
+            fprintf(stderr, "gen: could not write \"%s\"\n", path);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,377 @@
+#include "utils.h"
+#include "symbol_table.h"
+#include "instructions.h"
+#include "pseudoinstructions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Microbenchmarks
+
+Times the assembler's hot primitives in isolation, on inputs shaped like those the assembler
+sees in bench/gen's programs: symbol names of generated labels and functions, mnemonics and
+registers weighted by how often they appear, and so on. Lookups are skewed towards a few hot keys.
+
+ $ bench/micro [-t ms] [filter]
+
+Runs each benchmark whose name contains filter for at least ms milliseconds (default 200) and prints
+
+ name impl=I ops=N ns_per_op=X allocs_per_op=Y
+
+Where a primitive has an alternative implementation, it is defined here next to its benchmark
+and printed on the line after the one in the tree, so a change can be measured before it is made.
+Allocations are counted by wrapping malloc, calloc and realloc at link time (see the Makefile).
+*/
+
+#define INPUT_COUNT 4096 // Inputs cycled through by each benchmark; a power of 2
+#define DEFAULT_MIN_MS 200
+
+typedef struct {
+    const char *name;
+    const char *impl;
+    void (*setup)(void);            // Builds the inputs; may be NULL
+    uint64_t (*op)(size_t input);   // Runs one operation on the input at that index
+} Benchmark;
+
+/* === ALLOCATION COUNTING === */
+
+uint64_t ALLOCATIONS = 0;
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t count, size_t size);
+void * __real_realloc(void *ptr, size_t size);
+
+void * __wrap_malloc(const size_t size) {
+    ALLOCATIONS++;
+    return __real_malloc(size);
+}
+
+void * __wrap_calloc(const size_t count, const size_t size) {
+    ALLOCATIONS++;
+    return __real_calloc(count, size);
+}
+
+void * __wrap_realloc(void *ptr, const size_t size) {
+    ALLOCATIONS++;
+    return __real_realloc(ptr, size);
+}
+
+/* === INPUTS === */
+
+uint64_t STATE = 0x9E3779B97F4A7C15ULL;
+
+uint32_t next_random(void) {
+    STATE ^= STATE >> 12;
+    STATE ^= STATE << 25;
+    STATE ^= STATE >> 27;
+    return (uint32_t) ((STATE * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// Index below n, skewed so that low indices are chosen far more often than high ones
+size_t skewed_below(const size_t n) {
+    const double r = (double) next_random() / 4294967296.0;
+    return (size_t) (r * r * r * (double) n);
+}
+
+// Picks from a list of strings, each preceded by its weight
+const char * weighted(const char *const *choices, const size_t count) {
+    int total = 0;
+    for (size_t i = 0; i < count; i += 2) total += atoi(choices[i]);
+    int r = (int) (next_random() % (uint32_t) total);
+    for (size_t i = 0; i < count; i += 2) {
+        r -= atoi(choices[i]);
+        if (r < 0) return choices[i+1];
+    }
+    return choices[count-1];
+}
+
+#define WEIGHTED(choices) weighted(choices, sizeof(choices) / sizeof(choices[0]))
+
+char SYMBOL_NAMES[240][SYMBOL_SIZE];
+const char *KEYS[INPUT_COUNT];   // Lookup keys, pointing into the arrays above and below
+char MISSES[INPUT_COUNT][SYMBOL_SIZE];
+
+// Mnemonics in roughly the proportions bench/gen writes them
+const char *const MNEMONICS[] = {
+    "8", "add", "4", "addu", "4", "sub", "4", "and", "4", "or", "4", "xor", "3", "slt", "2", "sltu", "2", "nor", "2", "subu",
+    "6", "addi", "3", "addiu", "2", "andi", "2", "ori", "2", "slti", "2", "sll", "2", "srl", "1", "sra",
+    "8", "lw", "7", "sw", "2", "beq", "2", "bne", "1", "jal", "1", "jr", "2", "lui", "3", "mult", "3", "mflo", "1", "nop",
+};
+
+const char *const REGISTER_TOKENS[] = {
+    "6", "$t0", "6", "$t1", "5", "$t2", "4", "$t3", "3", "$t4", "2", "$t5", "2", "$t6", "2", "$t7",
+    "3", "$s0", "2", "$s1", "1", "$s2", "1", "$s3", "8", "$sp", "3", "$ra", "3", "$zero", "2", "$a0", "2", "$v0", "1", "$29",
+};
+
+const char *const IMMEDIATES[] = {
+    "10", "1", "6", "4", "4", "-1", "6", "2000", "3", "0x7fff", "4", "16($sp)", "3", "0($t0)",
+    "4", "LA_12", "2", "fA_3", "1", "\"a\"", "1", "\"\\n\"",
+};
+
+const char *const ESCAPES[] = {"8", "\\n", "3", "\\t", "2", "\\0", "2", "\\\\", "1", "\\\"", "1", "\\x41", "1", "\\101"};
+
+const char *const LINES[] = {
+    "3", "add $t0, $t1, $t2", "2", "addi $sp, $sp, -16", "3", "lw $t3, 16($sp)", "3", "sw $ra, 0($sp)",
+    "1", "beq $t0, $zero, LA_12", "1", "jal fA_3", "1", "jr $ra", "1", "mult $t0, $t1",
+};
+
+void symbol_names(void) {
+    for (int i = 0; i < 240; i++) {
+        if (i < 32) snprintf(SYMBOL_NAMES[i], SYMBOL_SIZE, "fA_%d", i);
+        else if (i < 64) snprintf(SYMBOL_NAMES[i], SYMBOL_SIZE, "dA_%d", i - 32);
+        else snprintf(SYMBOL_NAMES[i], SYMBOL_SIZE, "LA_%d", i - 64);
+    }
+}
+
+/* === HASHING === */
+
+// FNV-1a, as an alternative to the djb2 hash_key() uses
+unsigned long fnv1a_key(const char *key, const size_t table_size) {
+    uint64_t hash = HASH_BYTES_INIT;
+    for (; *key != '\0'; key++) {
+        hash ^= (unsigned char) *key;
+        hash *= 0x100000001b3ULL;
+    }
+    return (unsigned long) (hash % table_size);
+}
+
+void setup_keys(void) {
+    symbol_names();
+    for (size_t i = 0; i < INPUT_COUNT; i++) {
+        KEYS[i] = i % 4 == 0 ? WEIGHTED(MNEMONICS) : SYMBOL_NAMES[skewed_below(240)];
+    }
+}
+
+uint64_t bench_hash_key(const size_t i) {
+    return hash_key(KEYS[i], SYMBOL_TABLE_SIZE);
+}
+
+uint64_t bench_fnv1a_key(const size_t i) {
+    return fnv1a_key(KEYS[i], SYMBOL_TABLE_SIZE);
+}
+
+/* === TABLES === */
+
+SymbolTable SYMBOLS;
+InstructionTable *INSTRUCTIONS;
+MacroTable MACROS;
+
+// Symbols of one generated file, looked up mostly by the few hot labels
+void setup_symbols(void) {
+    symbol_names();
+    st_init(&SYMBOLS);
+    for (int i = 0; i < 240; i++) {
+        st_add_symbol(&SYMBOLS, SYMBOL_NAMES[i], (uint32_t) i * 4, i >= 32 && i < 64 ? DATA : TEXT, i < 32 ? GLOBAL : LOCAL);
+    }
+    for (size_t i = 0; i < INPUT_COUNT; i++) {
+        KEYS[i] = SYMBOL_NAMES[skewed_below(240)];
+        snprintf(MISSES[i], SYMBOL_SIZE, "fB_%u", next_random() % 64);
+    }
+}
+
+uint64_t bench_st_get_symbol(const size_t i) {
+    return st_get_symbol(&SYMBOLS, KEYS[i]) != NULL;
+}
+
+uint64_t bench_st_get_symbol_miss(const size_t i) {
+    return st_get_symbol(&SYMBOLS, MISSES[i]) != NULL;
+}
+
+void setup_instructions(void) {
+    INSTRUCTIONS = it_shared();
+    for (size_t i = 0; i < INPUT_COUNT; i++) KEYS[i] = WEIGHTED(MNEMONICS);
+}
+
+uint64_t bench_it_lookup(const size_t i) {
+    return it_lookup(INSTRUCTIONS, KEYS[i]) != NULL;
+}
+
+// The macros of pseudo.asm and a generated file, looked up by every mnemonic, most of which are not macros
+void setup_macros(void) {
+    static const char *names[] = {"blt", "bge", "bgt", "ble", "move", "b", "bump", "swap"};
+    mt_init(&MACROS);
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        Macro macro;
+        memset(&macro, 0, sizeof(macro));
+        strcpy(macro.name, names[i]);
+        mt_add(&MACROS, macro);
+    }
+    for (size_t i = 0; i < INPUT_COUNT; i++) {
+        KEYS[i] = next_random() % 10 == 0 ? names[next_random() % 8] : WEIGHTED(MNEMONICS);
+    }
+}
+
+uint64_t bench_mt_exists(const size_t i) {
+    return mt_exists(&MACROS, KEYS[i]);
+}
+
+/* === PARSING === */
+
+// Decodes the register name directly, as an alternative to get_register()'s search of REGISTERS
+unsigned char get_register_direct(const char *token) {
+    if (token[0] != '$') return 255;
+    const char *name = token + 1;
+    const char c = name[0];
+    if (c >= '0' && c <= '9') {
+        char *endptr;
+        const long n = strtol(name, &endptr, 10);
+        return *endptr != '\0' || n > 31 ? 255 : (unsigned char) n;
+    }
+    if (strcmp(name, "zero") == 0) return 0;
+    if (strcmp(name, "at") == 0) return 1;
+    if (strcmp(name, "gp") == 0) return 28;
+    if (strcmp(name, "sp") == 0) return 29;
+    if (strcmp(name, "fp") == 0) return 30;
+    if (strcmp(name, "ra") == 0) return 31;
+    if (name[1] < '0' || name[1] > '9' || name[2] != '\0') return 255;
+    const int n = name[1] - '0';
+    switch (c) {
+        case 'v': return n <= 1 ? (unsigned char) (2 + n) : 255;
+        case 'a': return n <= 3 ? (unsigned char) (4 + n) : 255;
+        case 't': return n <= 7 ? (unsigned char) (8 + n) : (unsigned char) (24 + n - 8);
+        case 's': return n <= 7 ? (unsigned char) (16 + n) : 255;
+        case 'k': return n <= 1 ? (unsigned char) (26 + n) : 255;
+        default: return 255;
+    }
+}
+
+void setup_registers(void) {
+    for (size_t i = 0; i < INPUT_COUNT; i++) KEYS[i] = WEIGHTED(REGISTER_TOKENS);
+    for (size_t i = 0; i < REGISTER_COUNT; i++) {
+        if (get_register_direct(REGISTERS[i]) != get_register(REGISTERS[i])) {
+            fprintf(stderr, "micro: get_register_direct(\"%s\") differs from get_register()\n", REGISTERS[i]);
+            exit(1);
+        }
+    }
+}
+
+uint64_t bench_get_register(const size_t i) {
+    return get_register(KEYS[i]);
+}
+
+uint64_t bench_get_register_direct(const size_t i) {
+    return get_register_direct(KEYS[i]);
+}
+
+void setup_immediates(void) {
+    for (size_t i = 0; i < INPUT_COUNT; i++) KEYS[i] = WEIGHTED(IMMEDIATES);
+}
+
+uint64_t bench_parse_imm(const size_t i) {
+    return (uint64_t) parse_imm(KEYS[i]).intValue;
+}
+
+void setup_lines(void) {
+    for (size_t i = 0; i < INPUT_COUNT; i++) KEYS[i] = WEIGHTED(LINES);
+}
+
+// Splits a whole line, including copying it first, since tokenize() overwrites the delimiters
+uint64_t bench_tokenize(const size_t i) {
+    char line[64];
+    strcpy(line, KEYS[i]);
+    uint64_t tokens = 0;
+    for (const char *token = tokenize(line, ' '); token != NULL; token = tokenize(NULL, ' ')) tokens++;
+    return tokens;
+}
+
+uint64_t bench_strtok_r(const size_t i) {
+    char line[64];
+    strcpy(line, KEYS[i]);
+    uint64_t tokens = 0;
+    char *save;
+    for (const char *token = strtok_r(line, " ", &save); token != NULL; token = strtok_r(NULL, " ", &save)) tokens++;
+    return tokens;
+}
+
+void setup_escapes(void) {
+    for (size_t i = 0; i < INPUT_COUNT; i++) KEYS[i] = WEIGHTED(ESCAPES);
+}
+
+uint64_t bench_read_escape_sequence(const size_t i) {
+    char c;
+    return read_escape_sequence(KEYS[i], &c) + (unsigned char) c;
+}
+
+/* === MAIN === */
+
+const Benchmark BENCHMARKS[] = {
+    {"hash_key", "djb2", setup_keys, bench_hash_key},
+    {"hash_key", "fnv1a", setup_keys, bench_fnv1a_key},
+    {"st_get_symbol", "chained", setup_symbols, bench_st_get_symbol},
+    {"st_get_symbol_miss", "chained", NULL, bench_st_get_symbol_miss},
+    {"it_lookup", "linear_probe", setup_instructions, bench_it_lookup},
+    {"mt_exists", "linear_probe", setup_macros, bench_mt_exists},
+    {"get_register", "search", setup_registers, bench_get_register},
+    {"get_register", "direct", setup_registers, bench_get_register_direct},
+    {"parse_imm", "strtol", setup_immediates, bench_parse_imm},
+    {"tokenize", "tokenize", setup_lines, bench_tokenize},
+    {"tokenize", "strtok_r", setup_lines, bench_strtok_r},
+    {"read_escape_sequence", "strtol", setup_escapes, bench_read_escape_sequence},
+};
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+volatile uint64_t SINK; // Keeps the results of the operations from being optimized away
+
+// Runs the benchmark in rounds of doubling size until one takes at least min_seconds, and reports that round
+void run_benchmark(const Benchmark *b, const double min_seconds) {
+    uint64_t ops = INPUT_COUNT;
+    while (1) {
+        uint64_t result = 0;
+        const uint64_t allocations = ALLOCATIONS;
+        const double start = now();
+        for (uint64_t i = 0; i < ops; i++) {
+            result += b->op(i & (INPUT_COUNT - 1));
+        }
+        const double seconds = now() - start;
+        SINK = result;
+
+        if (seconds >= min_seconds || ops >= (1ULL << 40)) {
+            printf("%s impl=%s ops=%llu ns_per_op=%.2f allocs_per_op=%.3f\n", b->name, b->impl, (unsigned long long) ops,
+                   seconds * 1e9 / (double) ops, (double) (ALLOCATIONS - allocations) / (double) ops);
+            return;
+        }
+        ops *= 2;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    double min_seconds = DEFAULT_MIN_MS / 1000.0;
+    const char *filter = NULL;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "-t") == 0) {
+        const int ms = atoi(argv[arg+1]);
+        if (ms <= 0) {
+            fprintf(stderr, "usage: micro [-t ms] [filter]\n");
+            return 1;
+        }
+        min_seconds = ms / 1000.0;
+        arg += 2;
+    }
+    if (arg < argc) filter = argv[arg++];
+    if (arg != argc) {
+        fprintf(stderr, "usage: micro [-t ms] [filter]\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); i++) {
+        const Benchmark *b = &BENCHMARKS[i];
+        // Setup is shared by benchmarks with the same function, so it runs even for ones the filter skips
+        if (b->setup != NULL && (i == 0 || b->setup != BENCHMARKS[i-1].setup)) {
+            STATE = 0x9E3779B97F4A7C15ULL;
+            b->setup();
+        }
+        if (filter != NULL && strstr(b->name, filter) == NULL) continue;
+        run_benchmark(b, min_seconds);
+    }
+
+    st_destroy(&SYMBOLS);
+    mt_destroy(&MACROS);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Benchmark runner
+
+Runs a command several times and prints one line describing its fastest run:
+
+ $ bench/run name command [args...]
+ name lines=N bytes=N seconds=S lines_per_second=N mb_per_second=M peak_rss_kb=N
+
+Lines and bytes are those of the .asm files among the arguments. The fields and their order
+are kept stable so results can be compared across versions; new fields are only ever appended.
+The number of runs is taken from BENCH_RUNS (default 3). The exit status is that of the
+command if any run failed.
+*/
+
+#define DEFAULT_RUNS 3
+
+// Adds the lines and bytes of the file at path to the totals; returns success
+int count_input(const char *path, long long *lines, long long *bytes) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "run: could not open \"%s\"\n", path);
+        return 0;
+    }
+    char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        *bytes += (long long) n;
+        for (size_t i = 0; i < n; i++) {
+            if (buffer[i] == '\n') (*lines)++;
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+int is_source(const char *arg) {
+    const size_t length = strlen(arg);
+    return length > 4 && strcmp(arg + length - 4, ".asm") == 0;
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// Runs the command once, setting its wall time and peak resident set; returns its exit status
+int run_once(char *argv[], double *seconds, long *peak_rss_kb) {
+    const double start = now();
+    const pid_t pid = fork();
+    if (pid < 0) {
+        perror("run: fork");
+        return 1;
+    }
+    if (pid == 0) {
+        execv(argv[0], argv);
+        perror("run: exec");
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("run: wait4");
+        return 1;
+    }
+    *seconds = now() - start;
+    *peak_rss_kb = usage.ru_maxrss;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: run name command [args...]\n");
+        return 1;
+    }
+    const char *name = argv[1];
+    char **command = &argv[2];
+
+    int runs = DEFAULT_RUNS;
+    const char *env = getenv("BENCH_RUNS");
+    if (env != NULL && atoi(env) > 0) runs = atoi(env);
+
+    long long lines = 0, bytes = 0;
+    for (int i = 3; i < argc; i++) {
+        if (is_source(argv[i]) && count_input(argv[i], &lines, &bytes) == 0) return 1;
+    }
+
+    double best = 0;
+    long peak_rss_kb = 0;
+    for (int i = 0; i < runs; i++) {
+        double seconds;
+        long rss;
+        const int status = run_once(command, &seconds, &rss);
+        if (status != 0) {
+            fprintf(stderr, "run: %s exited with status %d\n", name, status);
+            return status;
+        }
+        if (i == 0 || seconds < best) best = seconds;
+        if (rss > peak_rss_kb) peak_rss_kb = rss;
+    }
+
+    if (best <= 0) best = 1e-9;
+    printf("%s lines=%lld bytes=%lld seconds=%.4f lines_per_second=%.0f mb_per_second=%.2f peak_rss_kb=%ld\n",
+           name, lines, bytes, best, (double) lines / best, (double) bytes / best / 1e6, peak_rss_kb);
+    return 0;
+}
@@ -7,17 +7,69 @@
 #include "instructions.h"
 #include "reloc_table.h"
 #include "data_parser.h"
+#include "object_cache.h"
+#include "preprocess.h"
+#include "peephole.h"
+
+// Identifies the output of this version of the assembler; change it whenever the generated objects change
+#define ASSEMBLER_VERSION "1.6"
+
+#define STREAM_CHUNK_LINES 4096 // Lines preprocessed at a time when streaming
 
 /* === TYPES === */
 
+// How assemble() processes its input
+enum AssemblyMode {
+    TWO_PASS,    // Parse the whole file, then encode it
+    SINGLE_PASS, // Encode each line as soon as it is parsed
+    STREAMING    // Single pass, also preprocessing the input and writing relocations a chunk at a time
+};
+
+// Options of assemble() and assemble_file()
+typedef struct {
+    enum AssemblyMode mode;
+    int optimize;    // Apply the peephole rules (see peephole.h) to the instructions (-O)
+    int delay_slots; // Follow each branch and jump with the instruction in its delay slot (--delay-slots)
+    uint32_t align_functions; // Align functions (labels declared global) to this many bytes with nops (-falign-functions=N); 0 if not
+} AssemblyOptions;
+
+// Reference from the data segment to a symbol, turned into a relocation at the end of a single-pass assembly
+typedef struct {
+    char symbol[SYMBOL_SIZE];
+    uint32_t offset;  // Offset of the word in its segment
+    enum Segment segment; // DATA or SDATA
+    SourceLoc loc;
+} DataFixup;
+
 typedef struct {
     Text *preprocessed;
     MacroTable *macro_table;
     DataList *data_list;
+    DataList *sdata_list; // Small data (.sdata and .sbss), addressed relative to $gp once linked
     InstructionList *instruction_list;
     SymbolTable *symbol_table;
     InstructionTable *instruction_table;
     RelocationTable *relocation_table;
+    TextSection *sections; // Where each named text section starts, in order
+    size_t section_count;
+    size_t section_cap;
+    int rodata;            // Whether data goes in .rodata
+    DataString *strings;   // Strings of the data segment in .rodata, in order
+    size_t string_count;
+    size_t string_cap;
+
+    // Single-pass mode: each line is encoded as soon as it is parsed. NULL in the default two-pass mode
+    FILE *text_output;   // Output file; instructions are written after a placeholder header
+    FILE *data_output;   // Temporary file holding the data segment until the text segment is complete
+    FILE *sdata_output;  // Same for the small data segment, which follows the data segment
+    DataFixup *fixups;   // Symbols referenced by data, in order
+    size_t fixup_count;
+    size_t fixup_cap;
+
+    // Streaming mode: lines are read from `stream` as needed and freed once assembled. NULL otherwise
+    Preprocessor *stream;
+    FILE *reloc_output;  // Temporary file holding the relocations of the text segment
+    uint32_t reloc_count;
 } Assembler;
 
 /* === ASSEMBLER STRUCTURE METHODS === */
@@ -34,6 +86,10 @@ int assembler_first_pass(Assembler *assembler);
 
 int assembler_second_pass(Assembler *assembler, const char *output);
 
-int assemble(Text *preprocessed, const char *output);
+int assembler_single_pass(Assembler *assembler, const char *output);
+
+int assemble(Text *preprocessed, Preprocessor *stream, const char *output, const AssemblyOptions *options);
+
+int assemble_file(const char *inp_path, const char *object_path, const ObjectCache *cache, const AssemblyOptions *options);
 
 #endif //MIPS_ASSEMBLER_ASSEMBLER_H
\ No newline at end of file
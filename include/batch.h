@@ -0,0 +1,28 @@
+#ifndef MIPS_ASSEMBLER_BATCH_H
+#define MIPS_ASSEMBLER_BATCH_H
+
+/* === MANIFEST ===
+One target per line: the output path, then any of the link options below, then the input files.
+Fields are separated by whitespace; blank lines and lines starting with '#' are ignored.
+
+  out/a.out src1.asm src2.asm         # links the built-in __start.o and begins execution there
+  out/b.out -e. src1.asm              # begins execution at the first instruction
+  out/c.out -e main src1.asm          # begins execution at main
+  out/d.out -s start.o src1.asm       # links start.o instead of the built-in __start.o
+  out/e.out -i64 src1.asm             # links incrementally, as with -i on the command line
+  out/f.out --relax src1.asm          # shortens `la` sequences, as with --relax on the command line
+  out/g.out --gc-sections src1.asm    # removes unreachable code and data, as with --gc-sections on the command line
+  out/h.out --icf src1.asm            # folds identical functions and strings, as with --icf on the command line
+  out/i.out --profile prof src1.asm   # orders functions, as with --profile (or --symbol-order) on the command line
+
+Each target's objects are written next to its output, so targets may share input files.
+*/
+
+#define BATCH_MAX_JOBS 256
+
+// Builds every target in the manifest and prints a summary
+// Arguments: [-j n] [--single-pass | --stream] [-O] [--delay-slots] [-falign-functions=N] [--cache dir] [--cache-size n] manifest; targets are built by n threads (default: one per CPU)
+// Returns 0 if every target was built, otherwise the exit status of the first target that failed
+int batch_run(int argc, char *argv[]);
+
+#endif //MIPS_ASSEMBLER_BATCH_H
@@ -27,7 +27,7 @@ typedef struct {
     } value;
     uint32_t size;
     unsigned char isSymbol;
-    const Line *line; // corresponding line in the Text list
+    SourceLoc loc; // corresponding line in the input, for errors
 } Data;
 
 typedef struct {
@@ -47,7 +47,7 @@ int byte(Data *, const char *);
 int string(Data *, const char *);
 int string_nt(Data *, const char *);
 
-int (*PROCESS_DATA[5])(Data *, const char *);
+extern int (*PROCESS_DATA[5])(Data *, const char *);
 
 int process_data(Data *data, enum DataType data_type, const char *str);
 
@@ -57,7 +57,9 @@ int dl_init(DataList * data_list, uint32_t entry);
 
 int add_data(DataList * data_list, Data data);
 
-void dl_destroy(const DataList * data_list);
+void dl_clear(DataList * data_list);
+
+void dl_destroy(DataList * data_list);
 
 void dl_debug(const DataList * data_list);
 
@@ -71,10 +73,10 @@ uint32_t data_align(int type, const DataList *);
 
 int data_pad(Data data,  DataList * data_list);
 
-int add_padding(const Line *line, uint32_t bytes, DataList *data_list);
+int add_padding(SourceLoc loc, uint32_t bytes, DataList *data_list);
 
-int add_aligned(const Line *line, const char *token, DataList *data_list);
+int add_aligned(SourceLoc loc, const char *token, DataList *data_list);
 
-int add_space(const Line *line, const char *token, DataList *data_list);
+int add_space(SourceLoc loc, const char *token, DataList *data_list);
 
 #endif //MIPS_ASSEMBLER_DATA_PARSER_H
\ No newline at end of file
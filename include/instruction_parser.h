@@ -7,7 +7,7 @@ typedef struct {
     char mnemonic[MNEMONIC_LENGTH]; // longest mnemonic is 5 or 6 characters, including some extra bytes just in case
     unsigned char registers[3];
     Immediate imm;
-    const Line *line; // corresponding line in the Text list
+    SourceLoc loc; // corresponding line in the input, for errors
 } Instruction;
 
 typedef struct {
@@ -15,6 +15,13 @@ typedef struct {
     size_t cap;
     uint32_t text_offset;
     Instruction *list;
+    int optimize;       // Apply the peephole rules as instructions are added (see peephole.h)
+    int delay_slots;    // Follow each branch and jump with the instruction in its delay slot (see peephole.h)
+    uint32_t align_functions; // Align each label declared global to this many bytes with il_align(); 0 if not
+    size_t block_start; // Index of the first instruction after the last label; the rules do not look before it
+    TextAlign *aligns;  // Offsets aligned by il_align(), in order
+    size_t align_count;
+    size_t align_cap;
 } InstructionList;
 
 /* === INSTRUCTIONLIST METHODS === */
@@ -23,6 +30,8 @@ int il_init(InstructionList * instruction_list, uint32_t entry);
 
 int add_instruction(InstructionList * instruction_list, Instruction instr);
 
+int il_align(InstructionList *instruction_list, uint32_t align, SourceLoc loc);
+
 void il_destroy(const InstructionList * instruction_list);
 
 void il_debug(const InstructionList *);
@@ -42,6 +42,8 @@ int it_init(InstructionTable *table);
 
 int it_create(InstructionTable *table);
 
+InstructionTable * it_shared(void);
+
 int it_insert(InstructionTable *table, InstrDesc desc);
 
 InstrDesc *it_lookup(const InstructionTable *table, const char *mnemonic);
@@ -0,0 +1,60 @@
+#ifndef MIPS_ASSEMBLER_LINK_STATE_H
+#define MIPS_ASSEMBLER_LINK_STATE_H
+#include <stdint.h>
+#include <stdio.h>
+#include "symbol_table.h"
+#include "reloc_table.h"
+
+#define LINK_STATE_MAGIC 0x4B4E4C49 // "ILNK"
+#define LINK_STATE_VERSION 3
+#define LINK_STATE_SUFFIX ".ilk"
+
+/* === TYPES === */
+
+// Layout of one object in the executable
+typedef struct {
+    char *name;                  // Path of the object file, or "__start" for the built-in startup object
+    uint64_t hash;               // Hash of the object file's contents
+    uint32_t text_offset;        // Offset of the object's slot in the text segment
+    uint32_t data_offset;        // Offset of the object's slot in the data segment
+    uint32_t sdata_offset;       // Offset of the object's slot in the small data at the start of the data segment
+    uint32_t text_slot;          // Size of the slot in the text segment (text size plus reserved padding)
+    uint32_t data_slot;          // Size of the slot in the data segment (data size plus reserved padding)
+    uint32_t sdata_slot;         // Size of the slot in the small data (small data size, without padding)
+    Symbol *globals;             // Global symbols defined by the object; offset is the final address
+    uint32_t global_count;
+    RelocationTable externals;   // Relocations that depend on symbols defined by other objects
+} LinkStateObject;
+
+// Layout of an executable, saved next to it by incremental links
+typedef struct {
+    struct FileHeader header;    // Header of the executable
+    uint32_t padding;            // Bytes reserved after each object's segments
+    char entry[SYMBOL_SIZE];     // Entry symbol, or empty if execution begins at TEXT_START
+    uint32_t object_count;
+    LinkStateObject *objects;
+} LinkState;
+
+/* === LINKSTATE METHODS === */
+
+int ls_init(LinkState *state, uint32_t object_count);
+
+void ls_destroy(const LinkState *state);
+
+char * ls_path(const char *out_path);
+
+int ls_read(LinkState *state, const char *path);
+
+int ls_write(const LinkState *state, const char *path);
+
+int lso_set_name(LinkStateObject *object, const char *name);
+
+int lso_add_global(LinkStateObject *object, Symbol symbol);
+
+void lso_clear(LinkStateObject *object);
+
+int ls_write_name(FILE *file, const char *name);
+
+char * ls_read_name(FILE *file);
+
+#endif //MIPS_ASSEMBLER_LINK_STATE_H
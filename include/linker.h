@@ -4,18 +4,56 @@
 #include "symbol_table.h"
 #include "reloc_table.h"
 
+// Part of an object's text that the linker places as a whole when ordering functions
+typedef struct {
+    int file;
+    uint32_t start;   // Offset in the object's text
+    uint32_t end;
+    uint32_t address; // Offset in the executable's text
+    uint32_t rank;    // Position of its first symbol in the order, or UINT32_MAX if it has none
+    uint32_t group;   // Placement of its named section (see section_group()); 0 for the block pinned first
+} TextBlock;
+
 typedef struct {
     uint32_t text_offset;
-    uint32_t data_offset;
+    uint32_t data_offset;  // Offset in the data segment, which starts with the small data of every object
+    uint32_t sdata_offset;
     uint32_t text_size;
     uint32_t data_size;
+    uint32_t sdata_size;
+    uint32_t flags;        // FILE_* flags of the object
+    const TextBlock *blocks; // If the linker ordered the text, its blocks, by offset; the text is then not at text_offset
+    uint32_t block_count;
+    TextSection *sections;   // Named sections of its text (FILE_SECTIONS), by offset
+    uint32_t section_count;
+    TextAlign *aligns;       // Offsets of its text that must stay aligned (FILE_ALIGNED), in order
+    uint32_t align_count;
+    DataString *strings;     // Read-only strings of its data (FILE_STRINGS), by offset
+    uint32_t string_count;
     uint32_t *text;
     uint8_t *data;
+    uint8_t *sdata;
     SymbolTable *symbol_table;
     RelocationTable *relocation_table;
-    char *name;
+    const char *name;
 } SourceFile;
 
-int link(const char *out_path, char *object_files[], int file_count, const char *entry_symbol);
+typedef struct {
+    const char *entry_symbol; // Symbol execution begins at; if NULL, begins at TEXT_START
+    const char *start_path;   // Startup object linked when the entry is __start; if NULL, the built-in one is used
+    int incremental;          // Save the layout next to the executable, and patch only changed objects when relinking
+    uint32_t padding;         // Bytes reserved after each object's segments by incremental links, so objects can grow
+    int relax;                // Shorten `la` of data addresses to one instruction where possible (not in incremental links)
+    int gc_sections;          // Remove the code and data that the entry cannot reach (not in incremental links)
+    int icf;                  // Keep one copy of identical functions and read-only strings (not in incremental links)
+    const char *symbol_order; // File listing the functions to place first, in order; NULL if none
+    const char *profile;      // File listing functions and their execution counts, placed hottest first; NULL if none
+} LinkOptions;
+
+// Startup object assembled from __start.asm at build time (see src/start_object.c); size 0 if not built in
+extern const uint8_t *START_OBJECT;
+extern const uint32_t START_OBJECT_SIZE;
+
+int link(const char *out_path, char *object_files[], int file_count, const LinkOptions *options);
 
 #endif //MIPS_ASSEMBLER_LINKER_H
\ No newline at end of file
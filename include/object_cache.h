@@ -0,0 +1,23 @@
+#ifndef MIPS_ASSEMBLER_OBJECT_CACHE_H
+#define MIPS_ASSEMBLER_OBJECT_CACHE_H
+#include <stdint.h>
+#include "text.h"
+
+#define OBJECT_CACHE_DEFAULT_SIZE (64 * 1024 * 1024)
+
+/* === TYPES === */
+
+typedef struct {
+    const char *dir;     // Directory holding cached objects, created if missing
+    uint64_t size_limit; // Total size of cached objects, in bytes, above which the least recently used are evicted
+} ObjectCache;
+
+/* === OBJECTCACHE METHODS === */
+
+uint64_t oc_key(const Text *preprocessed, uint64_t variant);
+
+int oc_fetch(const ObjectCache *cache, uint64_t key, const char *object_path);
+
+int oc_store(const ObjectCache *cache, uint64_t key, const char *object_path);
+
+#endif //MIPS_ASSEMBLER_OBJECT_CACHE_H
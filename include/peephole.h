@@ -0,0 +1,37 @@
+#ifndef MIPS_ASSEMBLER_PEEPHOLE_H
+#define MIPS_ASSEMBLER_PEEPHOLE_H
+#include "instruction_parser.h"
+
+// Instructions at the end of the list that a new instruction can still remove or merge with
+// In single-pass mode, these are kept back when encoding, so the object is the same in every mode
+#define PEEPHOLE_WINDOW 3
+
+/* === PEEPHOLE RULES ===
+Applied by add_instruction() when the list's `optimize` flag is set (-O), to each instruction against
+those before it, down to the list's block_start (the last label, which other code may jump to).
+Only arithmetic and logic instructions that write a register other than $0 are rewritten:
+  - instructions that leave their register unchanged (`move $t0 $t0`, `addiu $t0 $t0 0`) are removed
+  - an instruction repeating the one before it is removed, if it does not read the register it writes
+  - a pair repeating the pair before it (`li` or `la` of the same value twice) is removed, under the same condition
+  - `addiu $r $s a` followed by `addiu $r $r b` becomes `addiu $r $s a+b`, or nothing if $s is $r and a+b is 0
+Rules are tried once per added instruction, so the result only depends on the last PEEPHOLE_WINDOW instructions
+*/
+
+// Adds the instruction to the list, applying the rules; the list must have room for it
+void peephole_push(InstructionList *instruction_list, Instruction instruction);
+
+/* === DELAY SLOTS ===
+When the list's `delay_slots` flag is set, each branch and jump is followed by the instruction in its delay slot,
+which executes before the branch is taken. With -O, this is the closest of the PEEPHOLE_WINDOW instructions before
+the branch that can be moved after it: an arithmetic or logic instruction after the last label, independent of the
+branch and of the instructions it moves past. Otherwise, it is a nop.
+The instructions after a delay slot start a new block.
+*/
+
+// Whether the instruction has a delay slot: beq, bne, j, jal and jr
+int has_delay_slot(const Instruction *instruction);
+
+// Fills the delay slot of the branch or jump that was just added; the list must have room for one more instruction
+void fill_delay_slot(InstructionList *instruction_list);
+
+#endif //MIPS_ASSEMBLER_PEEPHOLE_H
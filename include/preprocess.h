@@ -5,8 +5,43 @@
 
 #include "text.h"
 
+#define PSEUDO_PATH "src/pseudo.asm"
+
+// Contents of pseudo.asm, embedded at build time (see src/pseudo_source.c)
+extern const char *PSEUDO_SOURCE;
+extern const size_t PSEUDO_SOURCE_SIZE;
+
+// Source file given in memory
+typedef struct {
+    const char *path;
+    const char *text;
+    size_t len;
+} InlineSource;
+
+// State of the preprocessor between calls to pp_read()
+typedef struct {
+    FILE *inp;                // NULL once the input has been read
+    uint32_t file;            // Index of the input in the Text's file table
+    Line line;                // Line being read
+    unsigned int line_number;
+    int prev;                 // Previous character added to the line, or '\0' at the start of a line
+    int reading_string;
+} Preprocessor;
+
+void set_inline_sources(const InlineSource *sources, size_t count);
+
+FILE * open_source(const char *path);
+
 FILE * open_file(const char *path);
 
+int pp_init(Preprocessor *pp, FILE *inp, const char *path, Text *text);
+
+int pp_read(Preprocessor *pp, Text *text, size_t max_lines);
+
+void pp_destroy(Preprocessor *pp);
+
 int preprocess(FILE *inp, const char *path, Text *text);
 
+int preprocess_stream(FILE *inp, const char *path, Text *text, Preprocessor *pp);
+
 #endif //MIPS_ASSEMBLER_PREPROCESS_H
\ No newline at end of file
@@ -2,23 +2,45 @@
 #define MIPS_ASSEMBLER_PSEUDOINSTRUCTIONS_H
 #include "instruction_parser.h"
 
-#define MACRO_TABLE_LENGTH 256
+#define MACRO_TABLE_INITIAL_SIZE 16 // Buckets in a new macro table; always a power of 2
+#define MACRO_NOT_FOUND ((unsigned long) -1)
+#define MACRO_MAX_ARGS 32
+#define MACRO_MAX_DEPTH 16 // Macros may invoke other macros up to this depth
+
+// Operand of an instruction, parsed from a single token
+typedef struct {
+    unsigned char reg; // Register number, or 255 if the operand is an immediate
+    Immediate imm;     // In a template, an immediate with modifier 254 stands for the macro argument at index intValue
+} MacroOperand;
+
+// Instruction in the body of a macro, parsed once when the macro is defined
+typedef struct {
+    char mnemonic[MNEMONIC_LENGTH];
+    unsigned char operand_count;
+    MacroOperand operands[3];
+} TemplateInstruction;
 
 typedef struct {
     char name[SYMBOL_SIZE];
     Line *definition_start;
     size_t definition_length;
-    char args[32][32];
+    const char **args;             // Argument names (including '%'), interned in the macro table
+    size_t argc;
+    TemplateInstruction *template; // Compiled body, or NULL if the body must be expanded as text (e.g. it defines labels)
+    size_t template_length;
 } Macro;
 
+// Open-addressing hash table of macros
+// Buckets hold indices into the dense `macros` array, so growing the table only moves 4-byte buckets
 typedef struct {
-    Macro macro;
-    unsigned char inUse;
-} MacroBucket;
-
-typedef struct {
-    MacroBucket *buckets;
+    uint32_t *buckets;    // Index of a macro plus one, or 0 if the bucket is empty
+    size_t bucket_count;  // Doubled whenever the table would become more than 3/4 full
+    Macro *macros;        // In order of definition
     size_t size;
+    size_t cap;
+    char **arg_names;     // Every argument name used by a macro, stored once
+    size_t arg_name_count;
+    size_t arg_name_cap;
 } MacroTable;
 
 int mt_init(MacroTable *table);
@@ -29,16 +51,24 @@ unsigned long mt_exists(const MacroTable *table, const char *name);
 
 Macro *mt_get(const MacroTable *table, const char *name);
 
+const char *mt_intern(MacroTable *table, const char *name);
+
 void mt_destroy(const MacroTable *t);
 
 void mt_debug(const MacroTable *t);
 
+void macro_destroy(const Macro *m);
+
 void macro_debug(const Macro *m);
 
-Line *define_macro(Macro *macro, const Line *line);
+Line *define_macro(MacroTable *table, Macro *macro, const Line *line);
 
 int insert_macro(Text *text_list, const MacroTable *table, const char *name, Line *line);
 
+int parse_operand(char *token, MacroOperand *operand);
+
+int template_complete(const MacroTable *table, const Macro *macro, int depth);
+
 int li(Instruction, InstructionList*);
 int la(Instruction, InstructionList*);
 
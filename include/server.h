@@ -0,0 +1,31 @@
+#ifndef MIPS_ASSEMBLER_SERVER_H
+#define MIPS_ASSEMBLER_SERVER_H
+#include <stdint.h>
+
+#define SERVER_MAGIC 0x5253414D // "MASR"
+
+/* === PROTOCOL ===
+The server accepts one request per connection over a Unix domain socket.
+Numbers are 32-bit words and strings are a word (length) followed by that many bytes, in host byte order.
+
+Request:
+  - word: SERVER_MAGIC
+  - word: argument count, followed by the arguments (as given to mips_assembler, without the program name)
+  - string: working directory of the request; paths in the arguments are relative to it
+  - word: number of inline sources, followed by pairs of strings (path, contents)
+    Inline sources are read from the request instead of from disk when their path is given as an input
+Response:
+  - word: exit status, as returned by mips_assembler
+  - string: everything the request wrote to stdout and stderr
+
+A request with no arguments stops the server.
+*/
+
+// Runs the server until it is stopped; `handler` is called with the arguments of each request
+int server_run(const char *socket_path, int (*handler)(int argc, char *argv[]));
+
+// Sends the arguments to the server and prints its output; returns the request's exit status
+// If send_inline is set, input files ending in .asm are sent with the request
+int client_run(const char *socket_path, int argc, char *argv[], int send_inline);
+
+#endif //MIPS_ASSEMBLER_SERVER_H
@@ -0,0 +1,101 @@
+#ifndef MIPS_ASSEMBLER_STATS_H
+#define MIPS_ASSEMBLER_STATS_H
+#include <stdint.h>
+#include <stdio.h>
+
+/* === TYPES === */
+
+// Timed phases; some are nested in others (macro expansion and, in single-pass mode, encoding happen during the first pass)
+enum StatsPhase {
+    PHASE_PREPROCESS,
+    PHASE_MACRO_EXPANSION,
+    PHASE_FIRST_PASS,
+    PHASE_ENCODING,             // Second pass: instructions and data
+    PHASE_RELOCATION_WRITING,   // Relocation and symbol tables of objects
+    PHASE_OBJECT_LOADING,
+    PHASE_RELOCATION_RESOLUTION,
+    PHASE_OUTPUT_WRITING,       // Linked executable
+    PHASE_TOTAL,
+    PHASE_COUNT
+};
+
+enum StatsCounter {
+    COUNT_LINES,                // Preprocessed lines, including pseudo.asm
+    COUNT_INSTRUCTIONS,
+    COUNT_DATA_BYTES,
+    COUNT_SYMBOLS,
+    COUNT_RELOCATIONS,
+    COUNT_MACRO_EXPANSIONS,
+    COUNT_OBJECTS_LINKED,
+    COUNT_PEEPHOLE_REMOVED,     // Instructions removed by -O
+    COUNT_DELAY_SLOTS_FILLED,   // Delay slots filled with an instruction other than nop
+    COUNT_BRANCHES_RELAXED,     // Branches the linker rewrote to reach a distant target
+    COUNT_GC_REMOVED,           // Bytes of code and data removed by --gc-sections
+    COUNT_ICF_FOLDED,           // Bytes of code removed by --icf
+    COUNT_STRINGS_MERGED,       // Bytes of strings removed by --icf
+    COUNT_FUNCTIONS_ORDERED,    // Blocks of text placed first by --symbol-order and --profile
+    COUNTER_COUNT
+};
+
+// Data structures whose memory is accounted for by --mem-report
+enum MemoryKind {
+    MEM_TEXT,                   // Lines, including those being preprocessed
+    MEM_INSTRUCTIONS,
+    MEM_DATA,                   // Including string contents
+    MEM_SYMBOLS,
+    MEM_RELOCATIONS,
+    MEM_MACROS,                 // Including templates and argument names
+    MEM_KIND_COUNT
+};
+
+/* === RECORDING === */
+
+// Set by stats_options(); when 0, the macros below do nothing but test it
+extern int STATS_ENABLED;
+extern int TRACE_ENABLED; // implies STATS_ENABLED
+extern int MEMORY_ENABLED;
+
+uint64_t stats_now(void);
+
+void stats_stop(enum StatsPhase phase, uint64_t start);
+
+void stats_add(enum StatsCounter counter, uint64_t n);
+
+void trace_span(const char *name, const char *category, const char *file, uint64_t start);
+
+void mem_alloc(enum MemoryKind kind, size_t bytes);
+
+void mem_grow(enum MemoryKind kind, size_t old_bytes, size_t new_bytes);
+
+void mem_free(enum MemoryKind kind, size_t bytes);
+
+void mem_reset(void);
+
+void mem_print(FILE *file, const char *step, const char *path);
+
+#define STATS_START() (STATS_ENABLED ? stats_now() : 0)
+#define STATS_STOP(phase, start) do { if (STATS_ENABLED) stats_stop(phase, start); } while (0)
+#define STATS_ADD(counter, n) do { if (STATS_ENABLED) stats_add(counter, n); } while (0)
+#define TRACE_SPAN(name, category, file, start) do { if (TRACE_ENABLED) trace_span(name, category, file, start); } while (0)
+
+// Record an allocation, a reallocation to a larger size, or a free, once it has succeeded
+#define MEM_ALLOC(kind, bytes) do { if (MEMORY_ENABLED) mem_alloc(kind, bytes); } while (0)
+#define MEM_GROW(kind, old_bytes, new_bytes) do { if (MEMORY_ENABLED) mem_grow(kind, old_bytes, new_bytes); } while (0)
+#define MEM_FREE(kind, bytes) do { if (MEMORY_ENABLED) mem_free(kind, bytes); } while (0)
+
+/* === REPORTING === */
+
+// Removes the leading --time-report, --stats-json file, --trace file and --mem-report options from the arguments
+// Returns 0 if they are invalid
+int stats_options(int *argc, char *argv[]);
+
+// Prints the table and writes the JSON documents requested by stats_options(); returns success
+int stats_report(void);
+
+void stats_print(FILE *file);
+
+void stats_json(FILE *file);
+
+void trace_json(FILE *file);
+
+#endif //MIPS_ASSEMBLER_STATS_H
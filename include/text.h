@@ -1,5 +1,6 @@
 #ifndef MIPS_ASSEMBLER_TEXT_H
 #define MIPS_ASSEMBLER_TEXT_H
+#include <stdint.h>
 
 /* === TYPES === */
 
@@ -9,33 +10,50 @@ typedef struct {
 
     char *text;
     unsigned int number;
-    char *filename;
+    uint32_t file;       // Index in the Text's file table
 
     void *next;
     void *prev;
 } Line;
 
+// Where a line came from; kept by parsed instructions and data, which outlive the lines themselves
+typedef struct {
+    uint32_t file;
+    uint32_t number;     // 0 if unknown
+} SourceLoc;
+
 typedef struct {
     Line *head;
     Line *tail;
     unsigned int len;
+
+    const char **files;  // Paths of the source files, not copied
+    uint32_t file_count;
 } Text;
 
 /* === METHODS === */
 
-int line_init(Line *line, const char *fileName);
+int line_init(Line *line, uint32_t file);
 
 int line_add_char(Line *line, char c);
 
 void line_destroy(Line *line);
 
+SourceLoc line_loc(const Line *line);
+
 int text_init(Text *text);
 
 int text_add(Text *text, Line line);
 
 Line * text_insert(Text *text, Line line, Line *before);
 
-Line text_remove(Text *text, Line *line);
+void text_remove(Text *text, Line *line);
+
+int text_add_file(Text *text, const char *path, uint32_t *file);
+
+const char * text_filename(const Text *text, uint32_t file);
+
+void text_clear(Text *text);
 
 void text_destroy(const Text *text);
 
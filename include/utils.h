@@ -13,7 +13,12 @@
 #define TEXT_START 0x00400000
 #define DATA_START 0x10010000
 
-enum Segment { TEXT, DATA, UNDEF };
+// Small data (.sdata and .sbss) is placed at the start of the data segment, and addressed relative to $gp
+#define GP_ADDRESS (DATA_START + 0x8000)
+#define SMALL_DATA_LIMIT 0x10000
+#define GP_REGISTER 28
+
+enum Segment { TEXT, DATA, UNDEF, SDATA };
 
 enum Binding { LOCAL, GLOBAL };
 
@@ -22,7 +27,8 @@ enum RelocType {
     R_26,
     R_PC16,
     R_HI16,
-    R_LO16
+    R_LO16,
+    R_GP16   // Offset of the symbol from $gp
 };
 
 #define REGISTER_COUNT 32
@@ -34,8 +40,39 @@ struct FileHeader {
     uint32_t data_size; // Data segment, in bytes
     // Note that the size of the relocation table and symbol tables are not in the main header but the start of their respective sections
     uint32_t entry;     // Used by executable
+    uint32_t sdata_size; // Small data segment, in bytes; in executables, it is the start of the data segment
+    uint32_t gp;         // Value of $gp, used by executable
+    uint32_t flags;      // FILE_* below; in executables, those of every object
 };
 
+#define FILE_DELAY_SLOTS 0x1 // Branches and jumps are followed by a delay slot (--delay-slots)
+#define FILE_SECTIONS 0x2    // A table of named text sections follows the symbol table
+#define FILE_ALIGNED 0x4     // A table of aligned text offsets follows the symbol table (and named sections)
+#define FILE_STRINGS 0x8     // A table of read-only strings in the data segment follows the symbol table (and the tables above)
+
+// Named section of an object's text (.section .text.NAME), which runs from offset to the next one
+// Text before the first is in .text
+typedef struct {
+    char name[SYMBOL_SIZE];
+    uint32_t offset;
+} TextSection;
+
+// Offset in an object's text that must stay aligned (.align, .balign, -falign-functions)
+typedef struct {
+    uint32_t offset;
+    uint32_t align; // In bytes, a power of two greater than 4
+    uint32_t pad;   // Bytes of nops right before offset that align it
+} TextAlign;
+
+// Bytes of an object's data segment holding one string (.ascii, .asciiz) in .rodata, with the padding after it
+// The program does not write to them, so the linker may merge identical ones (--icf)
+typedef struct {
+    uint32_t offset;
+    uint32_t size;
+} DataString;
+
+#define TEXT_ALIGN_MAX 4096 // Largest alignment of text, in bytes
+
 /* === FILE I/O === */
 
 // Writes 8 bits to a file; returns success
@@ -92,9 +129,11 @@ typedef struct {
     errcode err_code; // Error code
     const char * err_obj;   // Error object
     const Line *line; // For assembler errors, line in the input file
+    SourceLoc loc;    // For assembler errors once the line has been freed, if line is NULL
+    const Text *source; // Names the files of line and loc
 } ErrorHandler;
 
-extern ErrorHandler ERROR_HANDLER;
+extern _Thread_local ErrorHandler ERROR_HANDLER;
 
 void raise_error(errcode, const char *, const char *);
 
@@ -102,14 +141,25 @@ void error_context(const char *);
 
 void error(void);
 
+void set_error_loc(SourceLoc loc);
+
 void general_error(errcode, const char * file, const char * object);
 
-void assembler_error(errcode, const Line *line, const char * object);
+void assembler_error(errcode, const char *filename, unsigned int number, const char *text, const char * object);
 
 /* === OTHER === */
 
 unsigned long hash_key(const char *key, size_t table_size);
 
+uint64_t hash_bytes(const void *bytes, size_t len, uint64_t hash);
+
+#define HASH_BYTES_INIT 0xcbf29ce484222325ULL
+
+int cpu_count(void);
+
+// Whether name is the section or one of its subsections (section.NAME), like .text.hot of .text
+int in_section(const char *name, const char *section);
+
 enum ImmType {
     SYMBOL,
     NUM,
@@ -129,7 +179,7 @@ typedef struct {
         int32_t intValue;
         char symbol[SYMBOL_SIZE];
     };
-    unsigned char modifier; // 0 = none, 1 = hi, 2 = lo, 254 = macro argument, 255 = failure to parse
+    unsigned char modifier; // 0 = none, 1 = hi, 2 = lo, 3 = offset from $gp, 254 = macro argument, 255 = failure to parse
 } Immediate;
 
 // Parses the string into an Immediate structure
@@ -137,7 +187,7 @@ Immediate parse_imm(const char *str);
 
 size_t read_escape_sequence(const char *inp, char *res);
 
-extern char * TOKENIZE_START;
+extern _Thread_local char * TOKENIZE_START;
 
 char * tokenize(char *str, char delim);
 
@@ -6,6 +6,8 @@
 #include "utils.h"
 #include "pseudoinstructions.h"
 #include "instructions.h"
+#include "preprocess.h"
+#include "stats.h"
 
 /*
  Assembler
@@ -24,11 +26,138 @@
   assemble() function.
 */
 
-enum DataType CURRENT_DIRECTIVE = WORD; // Keeps track of the type of data item being stored; assumes WORD by default
+_Thread_local enum DataType CURRENT_DIRECTIVE = WORD; // Keeps track of the type of data item being stored; assumes WORD by default
 
 /* === FIRST PASS TEXT SEGMENT === */
 
+int process_instruction(Instruction instruction, InstructionList *instruction_list);
+
+// Marks a reference to a symbol already defined in the small data segment, so it is addressed relative to $gp
+void mark_small_data(const SymbolTable *symbol_table, Immediate *imm) {
+    if (imm->type != SYMBOL || imm->modifier != 0) return;
+    const Symbol *s = st_get_symbol(symbol_table, imm->symbol);
+    if (s != NULL && s->segment == SDATA) imm->modifier = 3;
+}
+
+// Adds the instructions of a macro's template to the instruction list, substituting the arguments of the invocation
+int expand_template(const Assembler *assembler, const Macro *macro, const MacroOperand *args, const size_t argc, const Line *line, const int depth) {
+    if (depth >= MACRO_MAX_DEPTH) {
+        raise_error(SIZE_ERR, macro->name, __FILE__);
+        return 0;
+    }
+
+    for (size_t i = 0; i < macro->template_length; i++) {
+        const TemplateInstruction *template = &macro->template[i];
+
+        // Substitute arguments
+        MacroOperand operands[3];
+        for (int j = 0; j < template->operand_count; j++) {
+            operands[j] = template->operands[j];
+            if (operands[j].reg == 255 && operands[j].imm.modifier == 254) {
+                if ((size_t) operands[j].imm.intValue >= argc) {
+                    raise_error(ARGS_INV, NULL, __FILE__);
+                    return 0;
+                }
+                operands[j] = args[operands[j].imm.intValue];
+            }
+        }
+
+        // Another macro; its arguments are this instruction's operands
+        const unsigned long index = mt_exists(assembler->macro_table, template->mnemonic);
+        if (index != MACRO_NOT_FOUND) {
+            const Macro *inner = &assembler->macro_table->macros[index];
+            if (expand_template(assembler, inner, operands, template->operand_count, line, depth + 1) == 0) return 0;
+            continue;
+        }
+
+        Instruction instruction;
+        memset(instruction.mnemonic, '\0', sizeof(instruction.mnemonic));
+        strcpy(instruction.mnemonic, template->mnemonic);
+        instruction.imm.type = NONE;
+        instruction.imm.intValue = 0;
+        instruction.imm.modifier = 0;
+        instruction.loc = line_loc(line);
+
+        int r = 0;
+        for (int j = 0; j < template->operand_count; j++) {
+            if (operands[j].reg != 255) {
+                instruction.registers[r++] = operands[j].reg;
+                continue;
+            }
+            // Immediates must be the last argument
+            if (j != template->operand_count - 1) {
+                raise_error(ARGS_INV, NULL, __FILE__);
+                return 0;
+            }
+            instruction.imm = operands[j].imm;
+            if (instruction.imm.type == SYMBOL && st_exists(assembler->symbol_table, instruction.imm.symbol) == SYMBOL_TABLE_SIZE) {
+                // Doesn't exist yet, add as local undefined. may be made global later
+                st_add_symbol(assembler->symbol_table, instruction.imm.symbol, 0, UNDEF, LOCAL);
+            }
+            mark_small_data(assembler->symbol_table, &instruction.imm);
+        }
+        while (r < 3) instruction.registers[r++] = 255;
+
+        if (process_instruction(instruction, assembler->instruction_list) == 0) return 0;
+    }
+    return 1;
+}
+
+// Reads the arguments of a macro invocation (the tokens remaining after the macro name) and expands its template
+int read_macro(const Assembler *assembler, const Macro *macro, const Line *line) {
+    MacroOperand args[MACRO_MAX_ARGS];
+    size_t argc = 0;
+    char *token;
+    while ((token = tokenize(NULL, ' ')) != NULL) {
+        if (argc >= MACRO_MAX_ARGS) {
+            raise_error(ARGS_INV, NULL, __FILE__);
+            return 0;
+        }
+        if (parse_operand(token, &args[argc++]) == 0) return 0;
+    }
+    return expand_template(assembler, macro, args, argc, line, 0);
+}
+
+// Pads the text with nops for `.align n` (to 2^n bytes) or `.balign n` (to n bytes, a power of two)
+// `directive` is the text of the directive, from its name
+int align_text(const Assembler *assembler, const char *directive, const SourceLoc loc) {
+    const int balign = directive[1] == 'b';
+    const char *arg = directive + strlen(balign ? ".balign" : ".align");
+    while (isspace(*arg)) arg++;
+    char *end;
+    const long n = strtol(arg, &end, 10);
+    const long bytes = balign ? n : n >= 0 && n < 31 ? 1L << n : -1;
+    if (end == arg || *end != '\0' || bytes < 1 || bytes > TEXT_ALIGN_MAX || (bytes & (bytes - 1)) != 0) {
+        raise_error(ARG_INV, arg, __FILE__);
+        return 0;
+    }
+    if (il_align(assembler->instruction_list, (uint32_t) bytes, loc) == 0) {
+        raise_error(MEM, NULL, __FILE__);
+        return 0;
+    }
+    return 1;
+}
+
+// Adds labels to the symbol table at the current text offset
+int define_text_labels(const Assembler *assembler, char labels[][SYMBOL_SIZE], const size_t count, const Line *line) {
+    for (size_t i = 0; i < count; i++) {
+        // Functions (labels declared global before them) start aligned with -falign-functions
+        const Symbol *declared = st_get_symbol(assembler->symbol_table, labels[i]);
+        if (declared != NULL && declared->binding == GLOBAL
+            && il_align(assembler->instruction_list, assembler->instruction_list->align_functions, line_loc(line)) == 0) {
+            raise_error(MEM, NULL, __FILE__);
+            return 0;
+        }
+
+        // Add to symbol table (assumes local, but if it exists as global, will preserve that binding)
+        st_add_symbol(assembler->symbol_table, labels[i], assembler->instruction_list->text_offset, TEXT, LOCAL);
+        assembler->instruction_list->block_start = assembler->instruction_list->len; // may be jumped to
+    }
+    return 1;
+}
+
 // Parses a string into an Instruction. Does most of the heavy-lifting for this part of the assembler.
+// Returns 2 if the line added nothing to the instruction list (a macro, which adds its own, or `.align`)
 int parse_instruction(const Assembler *assembler, Line *line, Instruction *instruction) {
     const char *line_text = line->text;
     memset(instruction->mnemonic, '\0', sizeof(instruction->mnemonic));
@@ -44,7 +173,9 @@ int parse_instruction(const Assembler *assembler, Line *line, Instruction *instr
     unsigned char args[3];
     int readMnemonic = 0; // Whether the mnemonic has been read. Set to true when the assembler finds the first token not ending in ':'
 
-    char label[SYMBOL_SIZE];
+    // Labels are defined once the mnemonic is read, since `.align` pads the text before them
+    char labels[16][SYMBOL_SIZE];
+    size_t label_count = 0;
 
     // Loop through each token
     while (token != NULL) {
@@ -57,7 +188,7 @@ int parse_instruction(const Assembler *assembler, Line *line, Instruction *instr
                 raise_error(SYMBOL_INV, token, __FILE__);
                 return 0;
             }
-            if (isnumber(token[0])) {
+            if (isdigit(token[0]) || len > SYMBOL_SIZE || label_count >= 16) {
                 raise_error(SYMBOL_INV, token, __FILE__);
                 return 0;
             }
@@ -68,25 +199,38 @@ int parse_instruction(const Assembler *assembler, Line *line, Instruction *instr
                     raise_error(SYMBOL_INV, token, __FILE__);
                     return 0;
                 }
-                label[i] = token[i];
+                labels[label_count][i] = token[i];
             }
-            label[len-1] = '\0';
-
-            // Add to symbol table (assumes local, but if it exists as global, will preserve that binding)
-            st_add_symbol(assembler->symbol_table, label, assembler->instruction_list->text_offset, TEXT, LOCAL);
+            labels[label_count][len-1] = '\0';
+            label_count++;
         }
 
         // Read mnemonic. This will catch the first token not ending in ':' and set readMnemonic to true.
         else if (!readMnemonic) {
 
+            // A label followed by `.align` (joined by the preprocessor) is defined after the padding
+            if (strcmp(token, ".align") == 0 || strcmp(token, ".balign") == 0) {
+                if (align_text(assembler, line_text + (token - line_buf), line_loc(line)) == 0) return 0;
+                return define_text_labels(assembler, labels, label_count, line) == 0 ? 0 : 2;
+            }
+            if (define_text_labels(assembler, labels, label_count, line) == 0) return 0;
+            label_count = 0;
+
             if (len >= MNEMONIC_LENGTH) {
                 raise_error(SIZE_ERR, token, __FILE__);
                 return 0;
             }
 
             // === CHECK IF MACRO ===
-            if (mt_exists(assembler->macro_table, token) != MACRO_TABLE_LENGTH) {
-                if (insert_macro(assembler->preprocessed, assembler->macro_table, token, line) == 0) return 0;
+            if (mt_exists(assembler->macro_table, token) != MACRO_NOT_FOUND) {
+                const Macro *macro = mt_get(assembler->macro_table, token);
+                const uint64_t start = STATS_START();
+                if (template_complete(assembler->macro_table, macro, 0)) {
+                    if (read_macro(assembler, macro, line) == 0) return 0;
+                }
+                else if (insert_macro(assembler->preprocessed, assembler->macro_table, token, line) == 0) return 0;
+                STATS_STOP(PHASE_MACRO_EXPANSION, start);
+                STATS_ADD(COUNT_MACRO_EXPANSIONS, 1);
                 return 2;
             }
 
@@ -138,6 +282,7 @@ int parse_instruction(const Assembler *assembler, Line *line, Instruction *instr
                         // Doesn't exist yet, add as local undefined. may be made global later
                         st_add_symbol(assembler->symbol_table, instruction->imm.symbol, 0, UNDEF, LOCAL);
                     }
+                    mark_small_data(assembler->symbol_table, &instruction->imm);
                 }
 
                 break;
@@ -146,6 +291,7 @@ int parse_instruction(const Assembler *assembler, Line *line, Instruction *instr
 
         token = tokenize(NULL, ' ');
     }
+    if (define_text_labels(assembler, labels, label_count, line) == 0) return 0; // a line of only labels
 
     // Add registers
     int i;
@@ -166,13 +312,13 @@ int process_instruction(const Instruction instruction, InstructionList *instruct
     // Check special cases: `la` (load address) and `li` (load immediate)
     // necessary because assembler currently doesn't support %hi and %lo
     if (strcmp(instruction.mnemonic, "la") == 0) {
-        if (la(instruction, instruction_list) == -1) {
+        if (la(instruction, instruction_list) == 0) {
             return 0;
         }
         return 1;
     }
     if (strcmp(instruction.mnemonic, "li") == 0) {
-        if (li(instruction, instruction_list) == -1) {
+        if (li(instruction, instruction_list) == 0) {
             return 0;
         }
         return 1;
@@ -191,7 +337,7 @@ int read_text(const Assembler *assembler, Line *line) {
         return 0;
     }
     if (success == 2) return 1;
-    instruction.line = line;
+    instruction.loc = line_loc(line);
 
     // Add to instruction list
     if (process_instruction(instruction, assembler->instruction_list) == 0) return 0;
@@ -201,8 +347,39 @@ int read_text(const Assembler *assembler, Line *line) {
 
 /* === FIRST PASS DATA SEGMENT === */
 
-// Processes a Line containing data. Parses and adds to the DataList simultaneously.
-int read_data(const Assembler *assembler, const Line *line) {
+// Returns the list holding the data of a segment (DATA or SDATA)
+DataList * segment_data(const Assembler *assembler, const enum Segment segment) {
+    return segment == SDATA ? assembler->sdata_list : assembler->data_list;
+}
+
+// Records a string of `size` bytes at offset in the data segment, assembled in .rodata
+int add_string(Assembler *assembler, const uint32_t offset, const uint32_t size) {
+    if (assembler->string_count >= assembler->string_cap) {
+        const size_t cap = assembler->string_cap == 0 ? 16 : assembler->string_cap * 2;
+        DataString *new = realloc(assembler->strings, cap * sizeof(DataString));
+        if (new == NULL) {
+            raise_error(MEM, NULL, __FILE__);
+            return 0;
+        }
+        assembler->strings = new;
+        assembler->string_cap = cap;
+    }
+    assembler->strings[assembler->string_count].offset = offset;
+    assembler->strings[assembler->string_count].size = size;
+    assembler->string_count++;
+    return 1;
+}
+
+// Padding from `from` to `to` in the data segment belongs to the string right before it, if any
+void pad_string(const Assembler *assembler, const uint32_t from, const uint32_t to) {
+    if (assembler->string_count == 0) return;
+    DataString *last = &assembler->strings[assembler->string_count-1];
+    if (last->offset + last->size == from) last->size += to - from;
+}
+
+// Processes a Line containing data. Parses and adds to the DataList of the segment simultaneously.
+int read_data(Assembler *assembler, const Line *line, const enum Segment segment) {
+    DataList *data_list = segment_data(assembler, segment);
 
     char line_buffer[strlen(line->text) + 1]; // Use a separate buffer to avoid overwriting the input string
     strcpy(line_buffer, line->text);
@@ -236,7 +413,7 @@ int read_data(const Assembler *assembler, const Line *line) {
                 free(argument);
                 return 0;
             }
-            if (isnumber(token[0])) {
+            if (isdigit(token[0])) {
                 raise_error(SYMBOL_INV, token, __FILE__);
                 free(argument);
                 return 0;
@@ -278,15 +455,17 @@ int read_data(const Assembler *assembler, const Line *line) {
                 }
 
                 // Parse to integer
-                if (add_aligned(line, token, assembler->data_list) == 0) {
+                const uint32_t padded_from = data_list->data_offset;
+                if (add_aligned(line_loc(line), token, data_list) == 0) {
                     free(argument);
                     return 0;
                 }
+                if (segment == DATA) pad_string(assembler, padded_from, data_list->data_offset);
 
                 // Save label(s) (after alignment)
                 if (labels[0][0] != '\0') {
                     for (size_t i = 0; i < label_count; i++) {
-                        if (st_add_symbol(assembler->symbol_table, labels[i], assembler->data_list->data_offset, DATA, LOCAL) == 0) {
+                        if (st_add_symbol(assembler->symbol_table, labels[i], data_list->data_offset, segment, LOCAL) == 0) {
                             free(argument);
                             return 0;
                         }
@@ -304,7 +483,7 @@ int read_data(const Assembler *assembler, const Line *line) {
                 // Save label(s) (before adding space)
                 if (labels[0][0] != '\0') {
                     for (size_t i = 0; i < label_count; i++) {
-                        if (st_add_symbol(assembler->symbol_table, labels[i], assembler->data_list->data_offset, DATA, LOCAL) == 0) {
+                        if (st_add_symbol(assembler->symbol_table, labels[i], data_list->data_offset, segment, LOCAL) == 0) {
                             free(argument);
                             return 0;
                         }
@@ -312,7 +491,7 @@ int read_data(const Assembler *assembler, const Line *line) {
                 }
 
                 // Parse to integer
-                if (add_space(line, token, assembler->data_list) == 0) {
+                if (add_space(line_loc(line), token, data_list) == 0) {
                     free(argument);
                     return 0;
                 }
@@ -345,22 +524,24 @@ int read_data(const Assembler *assembler, const Line *line) {
 
                 // Create data object
                 Data data;
-                data.line = line;
+                data.loc = line_loc(line);
                 if (process_data(&data, CURRENT_DIRECTIVE, argument) == 0) {
                     free(argument);
                     return 0;
                 }
 
                 // Add any necessary padding
-                if (data_pad(data, assembler->data_list) == 0) {
+                const uint32_t padded_from = data_list->data_offset;
+                if (data_pad(data, data_list) == 0) {
                     free(argument);
                     return 0;
                 }
+                if (segment == DATA) pad_string(assembler, padded_from, data_list->data_offset);
 
                 // Write the label(s)
                 if (labels[0][0] != '\0') {
                     for (size_t i = 0; i < label_count; i++) {
-                        if (st_add_symbol(assembler->symbol_table, labels[i], assembler->data_list->data_offset, DATA, LOCAL) == 0) {
+                        if (st_add_symbol(assembler->symbol_table, labels[i], data_list->data_offset, segment, LOCAL) == 0) {
                             free(argument);
                             return 0;
                         }
@@ -368,7 +549,13 @@ int read_data(const Assembler *assembler, const Line *line) {
                 }
 
                 // Add to data list and increment data_addr
-                if (add_data(assembler->data_list, data) == 0) {
+                const uint32_t data_offset = data_list->data_offset;
+                if (add_data(data_list, data) == 0) {
+                    free(argument);
+                    return 0;
+                }
+                if (segment == DATA && assembler->rodata && (data.type == STRING || data.type == STRING_NT) && data.size > 0
+                    && add_string(assembler, data_offset, data.size) == 0) {
                     free(argument);
                     return 0;
                 }
@@ -408,13 +595,13 @@ uint32_t convert_instruction(const Instruction instruction, const Assembler* ass
     }
 }
 
-// Goes through every instruction and writes its 32-bit machine code to the file. Returns 0 on failure
-int write_instruction_list(FILE *file, const Assembler *assembler) {
-    uint32_t current_addr = 0;
+// Goes through every instruction and writes its 32-bit machine code to the file, the first being at current_addr
+// Returns 0 on failure
+int write_instruction_list(FILE *file, const Assembler *assembler, uint32_t current_addr) {
 
     for (size_t i = 0; i < assembler->instruction_list->len; i++) {
         const Instruction instruction = assembler->instruction_list->list[i];
-        ERROR_HANDLER.line = instruction.line;
+        set_error_loc(instruction.loc);
 
         // Convert to machine code
         const uint32_t machine_code = convert_instruction(instruction, assembler, current_addr);
@@ -435,8 +622,8 @@ int write_instruction_list(FILE *file, const Assembler *assembler) {
 
 /* === SECOND PASS DATA SEGMENT === */
 
-// Writes a Data structure to the file
-int write_data(FILE *file, Data data, const SymbolTable *symbol_table, RelocationTable *relocation_table, const uint32_t current_offset) {
+// Writes a Data structure of the segment (DATA or SDATA) to the file
+int write_data(FILE *file, Data data, const enum Segment segment, const SymbolTable *symbol_table, RelocationTable *relocation_table, const uint32_t current_offset) {
     if (data.isSymbol) {
 
         // Requires R_32 relocation
@@ -447,7 +634,7 @@ int write_data(FILE *file, Data data, const SymbolTable *symbol_table, Relocatio
         switch (data.type) {
             case WORD: // What happens with .byte and .half?
                 data.value.word = 0;
-                re_init(&reloc, current_offset, DATA, R_32, s->name);
+                re_init(&reloc, current_offset, segment, R_32, s->name);
                 break;
             default:
                 raise_error(ARGS_INV, NULL, __FILE__);
@@ -486,31 +673,292 @@ int write_data(FILE *file, Data data, const SymbolTable *symbol_table, Relocatio
 
 }
 
-// Goes through every Data structure in the list and writes it to file. Returns 0 on failure or -1 on file IO failure.
-int write_data_list(FILE *file, Assembler *assembler) {
-    uint32_t current_offset = 0;
-    for (size_t i = 0; i < assembler->data_list->len; i++) {
-        const Data data = assembler->data_list->list[i];
-        ERROR_HANDLER.line = data.line;
+// Goes through every Data structure in the segment's list and writes it to file, the first being at current_offset
+// Returns 0 on failure or -1 on file IO failure.
+int write_data_list(FILE *file, Assembler *assembler, const enum Segment segment, uint32_t current_offset) {
+    const DataList *data_list = segment_data(assembler, segment);
+    for (size_t i = 0; i < data_list->len; i++) {
+        const Data data = data_list->list[i];
+        set_error_loc(data.loc);
 
-        const int success = write_data(file, data, assembler->symbol_table, assembler->relocation_table, current_offset);
+        const int success = write_data(file, data, segment, assembler->symbol_table, assembler->relocation_table, current_offset);
         if (success <= 0) return success;
         current_offset += data.size;
     }
     return 1;
 }
 
+/* === SINGLE PASS === */
+
+// Moves the relocations added so far to the temporary relocation file
+int spill_relocations(Assembler *assembler) {
+    RelocationTable *relocation_table = assembler->relocation_table;
+    if (fwrite(relocation_table->list, sizeof(RelocationEntry), relocation_table->len, assembler->reloc_output) != relocation_table->len) {
+        ERROR_HANDLER.err_code = FILE_IO;
+        return 0;
+    }
+    assembler->reloc_count += relocation_table->len;
+    relocation_table->len = 0;
+    return 1;
+}
+
+// Encodes the instructions parsed since the last call and removes them from the instruction list
+// With -O, unless `all` is set, the last few instructions after the last label are kept, since the peephole rules may still remove them
+int flush_instructions(Assembler *assembler, const int all) {
+    InstructionList *instruction_list = assembler->instruction_list;
+    const size_t pending = instruction_list->len;
+    size_t count = pending;
+    if (instruction_list->optimize && !all) {
+        const size_t block = pending - instruction_list->block_start;
+        count -= block < PEEPHOLE_WINDOW ? block : PEEPHOLE_WINDOW;
+    }
+    const uint32_t current_addr = instruction_list->text_offset - 4 * pending;
+
+    const uint64_t start = STATS_START();
+    instruction_list->len = count;
+    if (write_instruction_list(assembler->text_output, assembler, current_addr) == 0) return 0;
+    STATS_STOP(PHASE_ENCODING, start);
+    memmove(instruction_list->list, instruction_list->list + count, (pending - count) * sizeof(Instruction));
+    instruction_list->len = pending - count;
+    instruction_list->block_start = 0; // every instruction before it has been encoded
+    if (assembler->reloc_output != NULL) return spill_relocations(assembler);
+    return 1;
+}
+
+// Writes the data of the segment (DATA or SDATA) parsed since the last call and removes it from its list
+// Symbols may be defined later in the file, so their relocations are added by resolve_fixups()
+int flush_data(Assembler *assembler, const enum Segment segment) {
+    DataList *data_list = segment_data(assembler, segment);
+    FILE *output = segment == SDATA ? assembler->sdata_output : assembler->data_output;
+    const uint64_t start = STATS_START();
+    uint32_t current_offset = data_list->data_offset;
+    for (size_t i = 0; i < data_list->len; i++) {
+        current_offset -= data_list->list[i].size;
+    }
+
+    for (size_t i = 0; i < data_list->len; i++) {
+        Data *data = &data_list->list[i];
+        set_error_loc(data->loc);
+
+        if (data->isSymbol) {
+            if (data->type != WORD) {
+                raise_error(ARGS_INV, NULL, __FILE__);
+                return 0;
+            }
+            if (assembler->fixup_count >= assembler->fixup_cap) {
+                const size_t cap = assembler->fixup_cap == 0 ? 16 : assembler->fixup_cap * 2;
+                DataFixup *new = realloc(assembler->fixups, cap * sizeof(DataFixup));
+                if (new == NULL) {
+                    raise_error(MEM, NULL, __FILE__);
+                    return 0;
+                }
+                assembler->fixups = new;
+                assembler->fixup_cap = cap;
+            }
+            DataFixup *fixup = &assembler->fixups[assembler->fixup_count++];
+            strcpy(fixup->symbol, data->value.symbol);
+            fixup->offset = current_offset;
+            fixup->segment = segment;
+            fixup->loc = data->loc;
+
+            data->isSymbol = 0;
+            data->value.word = 0;
+        }
+
+        if (write_data(output, *data, segment, assembler->symbol_table, assembler->relocation_table, current_offset) <= 0) return 0;
+        current_offset += data->size;
+    }
+
+    dl_clear(data_list);
+    STATS_STOP(PHASE_ENCODING, start);
+    return 1;
+}
+
+// Adds the relocations for symbols referenced by data, now that every symbol in the file is known
+int resolve_fixups(const Assembler *assembler) {
+    for (size_t i = 0; i < assembler->fixup_count; i++) {
+        const DataFixup fixup = assembler->fixups[i];
+        set_error_loc(fixup.loc);
+
+        const Symbol *s = st_get_symbol_safe(assembler->symbol_table, fixup.symbol);
+        if (s == NULL) return 0;
+        RelocationEntry reloc;
+        if (re_init(&reloc, fixup.offset, fixup.segment, R_32, s->name) == 0) return 0;
+        if (rt_add(assembler->relocation_table, reloc) == 0) return 0;
+    }
+    return 1;
+}
+
+// Appends the contents of src, from its beginning, to dst; returns success
+int append_file(FILE *dst, FILE *src) {
+    if (fseek(src, 0, SEEK_SET) != 0) return 0;
+    uint8_t buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), src)) > 0) {
+        if (fwrite(buf, 1, n, dst) != n) return 0;
+    }
+    return !ferror(src);
+}
+
+// Writes the relocation table, preceded by any relocations moved to the temporary relocation file
+int write_relocations(FILE *file, const Assembler *assembler) {
+    const RelocationTable *relocation_table = assembler->relocation_table;
+    if (assembler->reloc_output == NULL) return write_reloc_table(file, relocation_table);
+
+    if (write_word(file, assembler->reloc_count + relocation_table->len) == 0 || append_file(file, assembler->reloc_output) == 0) {
+        ERROR_HANDLER.err_code = FILE_IO;
+        return 0;
+    }
+    if (fwrite(relocation_table->list, sizeof(RelocationEntry), relocation_table->len, file) != relocation_table->len) {
+        ERROR_HANDLER.err_code = FILE_IO;
+        return 0;
+    }
+    return 1;
+}
+
+// Writes the named text sections: their number, then each in order
+int write_sections(FILE *file, const Assembler *assembler) {
+    if (write_word(file, (uint32_t) assembler->section_count) == 0
+        || fwrite(assembler->sections, sizeof(TextSection), assembler->section_count, file) != assembler->section_count) {
+        ERROR_HANDLER.err_code = FILE_IO;
+        return 0;
+    }
+    return 1;
+}
+
+// Writes the aligned offsets of the text: their number, then each in order
+int write_aligns(FILE *file, const Assembler *assembler) {
+    const InstructionList *instruction_list = assembler->instruction_list;
+    if (write_word(file, (uint32_t) instruction_list->align_count) == 0
+        || fwrite(instruction_list->aligns, sizeof(TextAlign), instruction_list->align_count, file) != instruction_list->align_count) {
+        ERROR_HANDLER.err_code = FILE_IO;
+        return 0;
+    }
+    return 1;
+}
+
+// Writes the read-only strings of the data segment: their number, then each in order
+int write_strings(FILE *file, const Assembler *assembler) {
+    if (write_word(file, (uint32_t) assembler->string_count) == 0
+        || fwrite(assembler->strings, sizeof(DataString), assembler->string_count, file) != assembler->string_count) {
+        ERROR_HANDLER.err_code = FILE_IO;
+        return 0;
+    }
+    return 1;
+}
+
+// Flags of the object: how it was assembled, and which tables follow its symbol table
+uint32_t object_flags(const Assembler *assembler) {
+    uint32_t flags = assembler->instruction_list->delay_slots ? FILE_DELAY_SLOTS : 0;
+    if (assembler->section_count > 0) flags |= FILE_SECTIONS;
+    if (assembler->instruction_list->align_count > 0) flags |= FILE_ALIGNED;
+    if (assembler->string_count > 0) flags |= FILE_STRINGS;
+    return flags;
+}
+
+/* === SECTIONS === */
+
+/*
+Switches to the section name (.section NAME, or .text.NAME)
+Text sections other than .text are recorded in the object, so that the linker can place each together
+Data sections go in the segment they are named after: .data, .rodata and .bss in data, .sdata and .sbss in small data
+The strings of .rodata are recorded in the object, so that the linker can merge identical ones
+*/
+int start_section(Assembler *assembler, const char *name, enum Segment *segment) {
+    assembler->rodata = in_section(name, ".rodata");
+    if (in_section(name, ".data") || assembler->rodata || in_section(name, ".bss")) {
+        *segment = DATA;
+        return 1;
+    }
+    if (in_section(name, ".sdata") || in_section(name, ".sbss")) {
+        *segment = SDATA;
+        return 1;
+    }
+    if (!in_section(name, ".text")) {
+        raise_error(TOKEN_ERR, name, __FILE__);
+        return 0;
+    }
+    if (strlen(name) >= SYMBOL_SIZE) {
+        raise_error(SIZE_ERR, name, __FILE__);
+        return 0;
+    }
+    *segment = TEXT;
+
+    InstructionList *instruction_list = assembler->instruction_list;
+    size_t count = assembler->section_count;
+    if (strcmp(name, count == 0 ? ".text" : assembler->sections[count-1].name) == 0) return 1;
+    instruction_list->block_start = instruction_list->len; // the peephole rules must not move code across sections
+
+    // A section left before any code was added is replaced
+    if (count > 0 && assembler->sections[count-1].offset == instruction_list->text_offset) {
+        count--;
+        if (strcmp(name, count == 0 ? ".text" : assembler->sections[count-1].name) == 0) {
+            assembler->section_count = count;
+            return 1;
+        }
+    }
+    if (count >= assembler->section_cap) {
+        const size_t cap = assembler->section_cap == 0 ? 4 : assembler->section_cap * 2;
+        TextSection *new = realloc(assembler->sections, cap * sizeof(TextSection));
+        if (new == NULL) {
+            raise_error(MEM, NULL, __FILE__);
+            return 0;
+        }
+        assembler->sections = new;
+        assembler->section_cap = cap;
+    }
+    memset(&assembler->sections[count], 0, sizeof(TextSection)); // the whole entry is written to the object
+    strcpy(assembler->sections[count].name, name);
+    assembler->sections[count].offset = instruction_list->text_offset;
+    assembler->section_count = count + 1;
+    return 1;
+}
+
+/* === STREAMING === */
+
+// Preprocesses the next lines of the input; `line` is set to the first of them, or NULL if there are none
+int read_stream(const Assembler *assembler, Line **line) {
+    Text *text = assembler->preprocessed;
+    Line *tail = text->tail;
+    const uint64_t start = STATS_START();
+    if (pp_read(assembler->stream, text, STREAM_CHUNK_LINES) == 0) return 0;
+    STATS_STOP(PHASE_PREPROCESS, start);
+    *line = tail == NULL ? text->head : tail->next;
+    return 1;
+}
+
+// Reads lines until the macro definition starting at `line` is complete, or the input ends
+int stream_macro_body(const Assembler *assembler, const Line *line) {
+    const Line *cur = line;
+    while (1) {
+        while (cur->next != NULL) {
+            cur = cur->next;
+            if (strcmp(cur->text, ".end_macro") == 0) return 1;
+        }
+        if (assembler->stream->inp == NULL) return 1; // define_macro() reports the missing .end_macro
+        if (pp_read(assembler->stream, assembler->preprocessed, STREAM_CHUNK_LINES) == 0) return 0;
+    }
+}
+
 /* === MAIN === */
 
 // Parses the output of the preprocessor into the symbol table, instruction list, and data list.
 int assembler_first_pass(Assembler *assembler) {
 
     enum Segment current_segment = TEXT;
+    CURRENT_DIRECTIVE = WORD; // may be left over from a previous file
 
     // Loop through each individual line in the file
     Line *line = assembler->preprocessed->head;
-    while (line != NULL) {
+    while (1) {
+        if (line == NULL) {
+            // When streaming, preprocess the next lines of the input
+            if (assembler->stream == NULL || assembler->stream->inp == NULL) break;
+            if (read_stream(assembler, &line) == 0) return 0;
+            continue;
+        }
         ERROR_HANDLER.line = line;
+        STATS_ADD(COUNT_LINES, 1);
 
         // preprocessor sometimes leaves trailing spaces; i should fix this there
         if (line->text[strlen(line->text)-1] == ' ') line->text[strlen(line->text)-1] = '\0';
@@ -520,7 +968,7 @@ int assembler_first_pass(Assembler *assembler) {
             char directive[16];
             char c = line->text[1];
             int j = 0;
-            while (!isspace(c) && c != '\0') {
+            while (!isspace(c) && c != '\0' && j < (int) sizeof(directive) - 1) {
                 directive[j] = c;
                 j++;
                 c = line->text[j+1];
@@ -528,11 +976,36 @@ int assembler_first_pass(Assembler *assembler) {
             directive[j] = '\0';
 
             if (strcmp(directive, "text") == 0) {
-                current_segment = TEXT;
+                if (start_section(assembler, ".text", &current_segment) == 0) return 0;
+                goto continue_line;
+            }
+            if (strcmp(directive, "section") == 0 || strncmp(directive, "text.", 5) == 0) {
+                // The name is the argument of .section (flags after it are ignored), or the directive itself
+                const char *arg = line->text;
+                if (directive[0] == 's') {
+                    arg += strlen(".section");
+                    while (isspace(*arg)) arg++;
+                }
+                const size_t len = strcspn(arg, " \t,");
+                if (len == 0) {
+                    raise_error(ARGS_INV, NULL, __FILE__);
+                    return 0;
+                }
+                char name[len+1];
+                memcpy(name, arg, len);
+                name[len] = '\0';
+                if (start_section(assembler, name, &current_segment) == 0) return 0;
                 goto continue_line;
             }
             if (strcmp(directive, "data") == 0) {
                 current_segment = DATA;
+                assembler->rodata = 0;
+                goto continue_line;
+            }
+            if (strcmp(directive, "sdata") == 0 || strcmp(directive, "sbss") == 0) {
+                // .sbss is stored like .sdata; it is expected to hold only .space
+                current_segment = SDATA;
+                assembler->rodata = 0;
                 goto continue_line;
             }
             if (strcmp(directive, "globl") == 0) {
@@ -560,11 +1033,20 @@ int assembler_first_pass(Assembler *assembler) {
             if (strcmp(directive, "macro") == 0) {
                 // Define macro here. Macro is invoked by parse_instruction()
                 Macro macro;
-                line = define_macro(&macro, line);
-                mt_add(assembler->macro_table, macro);
+                if (assembler->stream != NULL && stream_macro_body(assembler, line) == 0) return 0;
+                line = define_macro(assembler->macro_table, &macro, line);
+                if (line == NULL) return 0;
+                if (mt_add(assembler->macro_table, macro) == 0) {
+                    macro_destroy(&macro);
+                    return 0;
+                }
                 goto continue_line;
             }
-            if (current_segment != DATA) { // Any other directive must be in the data segment
+            if (current_segment == TEXT && (strcmp(directive, "align") == 0 || strcmp(directive, "balign") == 0)) {
+                if (align_text(assembler, line->text, line_loc(line)) == 0) return 0;
+                goto continue_line;
+            }
+            if (current_segment == TEXT) { // Any other directive must be in a data segment
                 raise_error(TOKEN_ERR, directive, __FILE__);
                 return 0;
             }
@@ -575,16 +1057,25 @@ int assembler_first_pass(Assembler *assembler) {
             if (read_text(assembler, line) == 0) {
                 return 0;
             }
+            if (assembler->text_output != NULL && flush_instructions(assembler, 0) == 0) return 0;
         }
 
         // DATA
-        else if (current_segment == DATA){
-            if (read_data(assembler, line) == 0) {
+        else {
+            if (read_data(assembler, line, current_segment) == 0) {
                 return 0;
             }
+            if (assembler->data_output != NULL && flush_data(assembler, current_segment) == 0) return 0;
         }
 
         continue_line:
+        if (assembler->stream != NULL) {
+            // Free the line once assembled; the lines of a macro definition are skipped over, and kept
+            Line *next = line->next;
+            text_remove(assembler->preprocessed, line);
+            line = next;
+            continue;
+        }
         line = line->next;
     }
 
@@ -608,10 +1099,14 @@ int assembler_second_pass(Assembler *assembler, const char *output) {
     header.text_size = assembler->instruction_list->text_offset;
     header.data_size = assembler->data_list->data_offset;
     header.entry = TEXT_START;
+    header.sdata_size = assembler->sdata_list->data_offset;
+    header.gp = 0;
+    header.flags = object_flags(assembler);
     fwrite(&header, sizeof(header), 1, file);
 
     // === Write Instructions ===
-    int success = write_instruction_list(file, assembler);
+    uint64_t start = STATS_START();
+    int success = write_instruction_list(file, assembler, 0);
     if (success == 0) {
         if (ERROR_HANDLER.err_code == FILE_IO) {
             raise_error(FILE_IO, output, __FILE__);
@@ -620,8 +1115,8 @@ int assembler_second_pass(Assembler *assembler, const char *output) {
         return 0;
     }
 
-    // == Write Data ===
-    success = write_data_list(file, assembler);
+    // == Write Data, then Small Data ===
+    success = write_data_list(file, assembler, DATA, 0) && write_data_list(file, assembler, SDATA, 0);
     if (success == 0) {
         if (ERROR_HANDLER.err_code == FILE_IO) {
             raise_error(FILE_IO, output, __FILE__);
@@ -630,7 +1125,10 @@ int assembler_second_pass(Assembler *assembler, const char *output) {
         return 0;
     }
 
+    STATS_STOP(PHASE_ENCODING, start);
+
     // === Write Relocation Table ===
+    start = STATS_START();
     success = write_reloc_table(file, assembler->relocation_table);
     if (success == 0) {
         if (ERROR_HANDLER.err_code == FILE_IO) {
@@ -640,8 +1138,11 @@ int assembler_second_pass(Assembler *assembler, const char *output) {
         return 0;
     }
 
-    // === Write Symbol Table
-    success = write_symbol_table(file, assembler->symbol_table);
+    // === Write Symbol Table, then Named Sections, Aligned Offsets and Read-Only Strings ===
+    success = write_symbol_table(file, assembler->symbol_table)
+        && (assembler->section_count == 0 || write_sections(file, assembler))
+        && (assembler->instruction_list->align_count == 0 || write_aligns(file, assembler))
+        && (assembler->string_count == 0 || write_strings(file, assembler));
     if (success == 0) {
         if (ERROR_HANDLER.err_code == FILE_IO) {
             raise_error(FILE_IO, output, __FILE__);
@@ -651,26 +1152,15 @@ int assembler_second_pass(Assembler *assembler, const char *output) {
     }
 
     fclose(file);
+    STATS_STOP(PHASE_RELOCATION_WRITING, start);
     return 1;
 }
 
-// Converts the output of the preprocessor into machine code and writes it to file
-int assemble(Text *preprocessed, const char *output) {
-    Assembler assembler;
-    if (assembler_init(&assembler, preprocessed) == 0) {
-        assembler_destroy(&assembler);
-        return 0;
-    }
-
-    if (assembler_first_pass(&assembler) == 0) {
-        assembler_destroy(&assembler);
-        return 0;
-    }
-
-    // Check for undefined local symbols and make global
-    // This behavior essentially automatically imports any undefined symbol
+// Makes every undefined symbol global
+// This behavior essentially automatically imports any undefined symbol
+void import_undefined(const SymbolTable *symbol_table) {
     for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
-        SymbolBucket *cur = assembler.symbol_table->buckets[i];
+        SymbolBucket *cur = symbol_table->buckets[i];
         while (cur != NULL) {
             if (cur->item.segment == UNDEF) {
                 cur->item.binding = GLOBAL;
@@ -678,17 +1168,216 @@ int assemble(Text *preprocessed, const char *output) {
             cur = cur->next;
         }
     }
+}
 
-    // st_debug(assembler.symbol_table);
-    // il_debug(assembler.instruction_list);
+// Parses and encodes each line in turn, writing the object file without a separate second pass
+// Only encoded words, symbols and relocations are kept in memory
+int assembler_single_pass(Assembler *assembler, const char *output) {
 
-    if (assembler_second_pass(&assembler, output) == 0) {
-        assembler_destroy(&assembler);
+    ERROR_HANDLER.line = NULL;
+
+    // === Open output file ===
+    FILE *file = fopen(output, "wb");
+    if (file == NULL) {
+        raise_error(FILE_IO, output, __FILE__);
+        return 0;
+    }
+    FILE *data = tmpfile();
+    FILE *sdata = tmpfile();
+    if (data == NULL || sdata == NULL) {
+        raise_error(FILE_IO, output, __FILE__);
+        if (data != NULL) fclose(data);
+        if (sdata != NULL) fclose(sdata);
+        fclose(file);
         return 0;
     }
+    if (assembler->stream != NULL) {
+        assembler->reloc_output = tmpfile();
+        if (assembler->reloc_output == NULL) {
+            raise_error(FILE_IO, output, __FILE__);
+            fclose(data);
+            fclose(sdata);
+            fclose(file);
+            return 0;
+        }
+    }
+
+    // === Write placeholder header, then encode text (and buffer data) line by line ===
+    struct FileHeader header = {0, 0, TEXT_START, 0, 0, assembler->instruction_list->delay_slots ? FILE_DELAY_SLOTS : 0};
+    int success = fwrite(&header, sizeof(header), 1, file) == 1;
+    assembler->text_output = file;
+    assembler->data_output = data;
+    assembler->sdata_output = sdata;
+    const uint64_t start = STATS_START();
+    success = success && assembler_first_pass(assembler) && flush_instructions(assembler, 1);
+    STATS_STOP(PHASE_FIRST_PASS, start);
+    assembler->text_output = NULL;
+    assembler->data_output = NULL;
+    assembler->sdata_output = NULL;
+    if (success) ERROR_HANDLER.line = NULL; // may have been freed while streaming
+
+    // === Relocations for data, then everything following the text segment ===
+    success = success && resolve_fixups(assembler);
+    if (success) {
+        import_undefined(assembler->symbol_table);
+        ERROR_HANDLER.line = NULL;
+        ERROR_HANDLER.err_code = NOERR;
+        success = append_file(file, data) && append_file(file, sdata);
+        const uint64_t tables_start = STATS_START();
+        success = success
+            && write_relocations(file, assembler)
+            && write_symbol_table(file, assembler->symbol_table)
+            && (assembler->section_count == 0 || write_sections(file, assembler))
+            && (assembler->instruction_list->align_count == 0 || write_aligns(file, assembler))
+            && (assembler->string_count == 0 || write_strings(file, assembler));
+        STATS_STOP(PHASE_RELOCATION_WRITING, tables_start);
+
+        // === Write Header ===
+        header.flags = object_flags(assembler);
+        header.text_size = assembler->instruction_list->text_offset;
+        header.data_size = assembler->data_list->data_offset;
+        header.sdata_size = assembler->sdata_list->data_offset;
+        success = success && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+        if (!success) ERROR_HANDLER.err_code = FILE_IO;
+    }
+
+    fclose(data);
+    fclose(sdata);
+    if (assembler->reloc_output != NULL) {
+        fclose(assembler->reloc_output);
+        assembler->reloc_output = NULL;
+    }
+    if (fclose(file) != 0 && success) {
+        success = 0;
+        ERROR_HANDLER.err_code = FILE_IO;
+    }
+    if (!success && ERROR_HANDLER.err_code == FILE_IO) {
+        raise_error(FILE_IO, output, __FILE__);
+    }
+    return success;
+}
+
+// Converts the output of the preprocessor into machine code and writes it to file
+// In single-pass mode, each line is encoded as soon as it is parsed
+// When streaming, `stream` provides the rest of the input after `preprocessed`, whose lines are freed once assembled
+// The lines of `preprocessed` are freed once parsed; its file table is kept for error messages
+int assemble(Text *preprocessed, Preprocessor *stream, const char *output, const AssemblyOptions *options) {
+    const enum AssemblyMode mode = options->mode;
+    Assembler assembler;
+    ERROR_HANDLER.source = preprocessed;
+    int success = assembler_init(&assembler, preprocessed);
+    if (mode == STREAMING) assembler.stream = stream;
+    if (success) {
+        assembler.instruction_list->optimize = options->optimize;
+        assembler.instruction_list->delay_slots = options->delay_slots;
+        assembler.instruction_list->align_functions = options->align_functions;
+    }
+    const char *source = text_filename(preprocessed, preprocessed->file_count - 1); // the input follows pseudo.asm
+
+    uint64_t start = STATS_START();
+    if (success && mode != TWO_PASS) {
+        success = assembler_single_pass(&assembler, output);
+        TRACE_SPAN("single_pass", "assembler", source, start);
+    } else if (success) {
+        success = assembler_first_pass(&assembler);
+        STATS_STOP(PHASE_FIRST_PASS, start);
+        TRACE_SPAN("first_pass", "assembler", source, start);
+
+        // Instructions and data only keep the location of their line
+        text_clear(preprocessed);
+        ERROR_HANDLER.line = NULL;
+
+        if (success) import_undefined(assembler.symbol_table);
+
+        // st_debug(assembler.symbol_table);
+        // il_debug(assembler.instruction_list);
+
+        start = STATS_START();
+        success = success && assembler_second_pass(&assembler, output);
+        TRACE_SPAN("second_pass", "assembler", source, start);
+    }
+
+    if (success && STATS_ENABLED) {
+        stats_add(COUNT_INSTRUCTIONS, assembler.instruction_list->text_offset / 4);
+        stats_add(COUNT_DATA_BYTES, assembler.data_list->data_offset + assembler.sdata_list->data_offset);
+        stats_add(COUNT_SYMBOLS, assembler.symbol_table->size);
+        stats_add(COUNT_RELOCATIONS, assembler.reloc_count + assembler.relocation_table->len);
+    }
 
     assembler_destroy(&assembler);
-    return 1;
+    ERROR_HANDLER.line = NULL;
+    ERROR_HANDLER.loc.number = 0;
+    ERROR_HANDLER.source = NULL;
+    return success;
+}
+
+// Preprocesses and assembles the source file at inp_path into object_path, reusing objects from cache if not NULL
+// Returns 0 on success, or the exit status of the step that failed: 1 (open), 2 (preprocess), 3 (assemble)
+// Streamed inputs are not cached, since the cache key depends on the whole preprocessed input
+int assemble_file(const char *inp_path, const char *object_path, const ObjectCache *cache, const AssemblyOptions *options) {
+    FILE *inp_file = open_file(inp_path);
+    if (inp_file == NULL) return 1;
+    if (MEMORY_ENABLED) mem_reset();
+
+    Text text;
+    text_init(&text);
+
+    uint64_t start = STATS_START();
+    if (options->mode == STREAMING) {
+        Preprocessor stream;
+        const int preprocessed = preprocess_stream(inp_file, inp_path, &text, &stream);
+        STATS_STOP(PHASE_PREPROCESS, start);
+        TRACE_SPAN("preprocess", "assembler", inp_path, start);
+        if (preprocessed == 0) {
+            fprintf(stderr, "Error in %s: could not preprocess file \"%s\"\n", __FILE__, inp_path);
+            text_destroy(&text);
+            return 2;
+        }
+        const int success = assemble(&text, &stream, object_path, options);
+        pp_destroy(&stream);
+        text_destroy(&text);
+        if (success == 0) {
+            fprintf(stderr, "Error in %s: could not assemble file \"%s\"\n", __FILE__, inp_path);
+            return 3;
+        }
+        if (MEMORY_ENABLED) mem_print(stderr, "assemble", inp_path);
+        return 0;
+    }
+
+    const int preprocessed = preprocess(inp_file, inp_path, &text);
+    STATS_STOP(PHASE_PREPROCESS, start);
+    TRACE_SPAN("preprocess", "assembler", inp_path, start);
+    if (preprocessed == 0) {
+        fprintf(stderr, "Error in %s: could not preprocess file \"%s\"\n", __FILE__, inp_path);
+        text_destroy(&text);
+        return 2;
+    }
+
+    // text_debug(&text);
+
+    // Reuse the cached object if this input was assembled before
+    uint64_t cache_key = 0;
+    if (cache != NULL && cache->dir != NULL) {
+        cache_key = oc_key(&text, (uint64_t) options->optimize | (uint64_t) options->delay_slots << 1 | (uint64_t) options->align_functions << 2);
+        if (oc_fetch(cache, cache_key, object_path)) {
+            text_destroy(&text);
+            return 0;
+        }
+    }
+
+    if (assemble(&text, NULL, object_path, options) == 0) {
+        fprintf(stderr, "Error in %s: could not assemble file \"%s\"\n", __FILE__, inp_path);
+        text_destroy(&text);
+        return 3;
+    }
+
+    // debug_binary(object_path);
+    text_destroy(&text);
+    if (MEMORY_ENABLED) mem_print(stderr, "assemble", inp_path);
+
+    // Failing to cache the object does not stop the build
+    if (cache != NULL && cache->dir != NULL) oc_store(cache, cache_key, object_path);
+    return 0;
 }
 
 // Allocates memory for and initializes the components of the assembler given the output of the preprocessor
@@ -697,8 +1386,26 @@ int assembler_init(Assembler *assembler, Text *preprocessed) {
     assembler->symbol_table = NULL;
     assembler->macro_table = NULL;
     assembler->data_list = NULL;
+    assembler->sdata_list = NULL;
     assembler->instruction_list = NULL;
     assembler->instruction_table = NULL;
+    assembler->relocation_table = NULL;
+    assembler->text_output = NULL;
+    assembler->data_output = NULL;
+    assembler->sdata_output = NULL;
+    assembler->fixups = NULL;
+    assembler->fixup_count = 0;
+    assembler->fixup_cap = 0;
+    assembler->sections = NULL;
+    assembler->section_count = 0;
+    assembler->section_cap = 0;
+    assembler->rodata = 0;
+    assembler->strings = NULL;
+    assembler->string_count = 0;
+    assembler->string_cap = 0;
+    assembler->stream = NULL;
+    assembler->reloc_output = NULL;
+    assembler->reloc_count = 0;
 
     // Initialize macro table
     MacroTable *macro_table = malloc(sizeof(MacroTable));
@@ -736,13 +1443,21 @@ int assembler_init(Assembler *assembler, Text *preprocessed) {
     if (dl_init(data_list, 0) == 0) return 0;
     assembler->data_list = data_list;
 
-    // Initialize instruction table
-    InstructionTable *instruction_table = malloc(sizeof(InstructionTable));
-    if (instruction_table == NULL) {
+    // Initialize small data list
+    DataList *sdata_list = malloc(sizeof(DataList));
+    if (sdata_list == NULL) {
         raise_error(MEM, NULL, __FILE__);
         return 0;
     }
-    if (it_create(instruction_table) == 0) return 0;
+    if (dl_init(sdata_list, 0) == 0) {
+        free(sdata_list);
+        return 0;
+    }
+    assembler->sdata_list = sdata_list;
+
+    // Use the shared instruction table (it never changes)
+    InstructionTable *instruction_table = it_shared();
+    if (instruction_table == NULL) return 0;
     assembler->instruction_table = instruction_table;
 
     // Initialize relocation table
@@ -767,6 +1482,10 @@ void assembler_destroy(Assembler *assembler) {
         dl_destroy(assembler->data_list);
         free(assembler->data_list);
     }
+    if (assembler->sdata_list != NULL) {
+        dl_destroy(assembler->sdata_list);
+        free(assembler->sdata_list);
+    }
     if (assembler->instruction_list != NULL) {
         il_destroy(assembler->instruction_list);
         free(assembler->instruction_list);
@@ -775,14 +1494,13 @@ void assembler_destroy(Assembler *assembler) {
         st_destroy(assembler->symbol_table);
         free(assembler->symbol_table);
     }
-    if (assembler->instruction_table != NULL) {
-        it_destroy(assembler->instruction_table);
-        free(assembler->instruction_table);
-    }
     if (assembler->relocation_table != NULL) {
         rt_destroy(assembler->relocation_table);
         free(assembler->relocation_table);
     }
+    free(assembler->fixups);
+    free(assembler->sections);
+    free(assembler->strings);
 }
 
 void assembler_debug(const Assembler *assembler) {
@@ -799,6 +1517,10 @@ void assembler_debug(const Assembler *assembler) {
         printf("No data list found\n");
     }
 
+    if (assembler->sdata_list != NULL) {
+        dl_debug(assembler->sdata_list);
+    }
+
     if (assembler->instruction_list != NULL) {
         il_debug(assembler->instruction_list);
     } else {
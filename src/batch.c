@@ -0,0 +1,359 @@
+#include "batch.h"
+#include "assembler.h"
+#include "instructions.h"
+#include "linker.h"
+#include "object_cache.h"
+#include "preprocess.h"
+#include "utils.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Batch
+
+Builds many independent executables in one process, as listed in a manifest (see batch.h).
+The instruction table and the object cache are set up once and shared by every target;
+targets are built in parallel by a pool of threads, each taking the next unbuilt target from the list.
+
+Each target goes through assemble_file() and link() exactly as a single mips_assembler invocation would.
+The assembler's global state (ERROR_HANDLER, tokenize(), CURRENT_DIRECTIVE) is thread-local.
+Diagnostics are written to stderr as they occur and may interleave between targets; the summary
+printed at the end lists the outcome of each target in manifest order.
+*/
+
+typedef struct {
+    char *fields;         // Copy of the manifest line; the strings below point into it
+    const char *out_path;
+    LinkOptions options;
+    char **inputs;
+    int input_count;
+    int line_number;      // Line in the manifest
+    int status;           // Exit status, as returned by run()
+    const char *failed;   // Input that failed to assemble
+} BatchTarget;
+
+typedef struct {
+    BatchTarget *targets;
+    int count;
+    int next;             // Index of the next target to build
+    pthread_mutex_t lock;
+    const ObjectCache *cache;
+    AssemblyOptions assembly;
+} Batch;
+
+// Describes the exit statuses of a target, as returned by run()
+const char *BATCH_STATUS[] = {"ok", "could not open", "could not preprocess", "could not assemble", "could not link"};
+
+/* === MANIFEST === */
+
+void target_destroy(const BatchTarget *target) {
+    free(target->fields);
+    free(target->inputs);
+}
+
+// Splits a line into whitespace-separated fields in place; returns the number of fields
+int split_fields(char *line, char **fields) {
+    int count = 0;
+    while (*line != '\0') {
+        while (isspace(*line)) *line++ = '\0';
+        if (*line == '\0') break;
+        fields[count++] = line;
+        while (*line != '\0' && !isspace(*line)) line++;
+    }
+    return count;
+}
+
+// Parses a manifest line into target; returns 0 if the line is invalid
+int parse_target(BatchTarget *target, const char *line, const int line_number) {
+    memset(target, 0, sizeof(BatchTarget));
+    target->line_number = line_number;
+    target->options.entry_symbol = "__start";
+    target->options.start_path = NULL;
+    target->options.incremental = 0;
+    target->options.padding = 0;
+    target->options.relax = 0;
+    target->options.gc_sections = 0;
+    target->options.icf = 0;
+    target->options.symbol_order = NULL;
+    target->options.profile = NULL;
+
+    target->fields = strdup(line);
+    target->inputs = malloc((strlen(line) / 2 + 1) * sizeof(char *));
+    if (target->fields == NULL || target->inputs == NULL) return 0;
+
+    char **fields = target->inputs; // the inputs are moved to the front once the options are read
+    const int count = split_fields(target->fields, fields);
+    target->out_path = fields[0];
+
+    int i = 1;
+    while (i < count && fields[i][0] == '-') {
+        if (strcmp(fields[i], "-e.") == 0) {
+            target->options.entry_symbol = NULL;
+        }
+        else if (strcmp(fields[i], "-e") == 0 && i+1 < count) {
+            target->options.entry_symbol = fields[++i];
+        }
+        else if (strcmp(fields[i], "-s") == 0 && i+1 < count) {
+            target->options.start_path = fields[++i];
+        }
+        else if (fields[i][1] == 'i') {
+            char *endptr;
+            const long padding = strtol(&fields[i][2], &endptr, 10);
+            if (*endptr != '\0' || padding < 0) {
+                fprintf(stderr, "error in %s: manifest line %d: invalid padding \"%s\"\n", __FILE__, line_number, &fields[i][2]);
+                return 0;
+            }
+            target->options.incremental = 1;
+            target->options.padding = (uint32_t) padding;
+        }
+        else if (strcmp(fields[i], "--relax") == 0) {
+            target->options.relax = 1;
+        }
+        else if (strcmp(fields[i], "--gc-sections") == 0) {
+            target->options.gc_sections = 1;
+        }
+        else if (strcmp(fields[i], "--icf") == 0) {
+            target->options.icf = 1;
+        }
+        else if (strcmp(fields[i], "--symbol-order") == 0 && i+1 < count) {
+            target->options.symbol_order = fields[++i];
+        }
+        else if (strcmp(fields[i], "--profile") == 0 && i+1 < count) {
+            target->options.profile = fields[++i];
+        }
+        else {
+            fprintf(stderr, "error in %s: manifest line %d: unrecognized option %s\n", __FILE__, line_number, fields[i]);
+            return 0;
+        }
+        i++;
+    }
+
+    target->input_count = count - i;
+    if (target->input_count <= 0) {
+        fprintf(stderr, "error in %s: manifest line %d: no input files\n", __FILE__, line_number);
+        return 0;
+    }
+    memmove(target->inputs, fields + i, target->input_count * sizeof(char *));
+    return 1;
+}
+
+// Reads the targets listed in the manifest; returns success
+int read_manifest(const char *path, Batch *batch) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        general_error(FILE_IO, __FILE__, path);
+        return 0;
+    }
+
+    int cap = 16;
+    batch->count = 0;
+    batch->targets = malloc(cap * sizeof(BatchTarget));
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_number = 0;
+    int success = batch->targets != NULL;
+    while (success && getline(&line, &line_size, f) != -1) {
+        line_number++;
+        const char *c = line;
+        while (isspace(*c)) c++;
+        if (*c == '\0' || *c == '#') continue;
+
+        if (batch->count >= cap) {
+            cap *= 2;
+            BatchTarget *new = realloc(batch->targets, cap * sizeof(BatchTarget));
+            if (new == NULL) {
+                success = 0;
+                break;
+            }
+            batch->targets = new;
+        }
+        success = parse_target(&batch->targets[batch->count], c, line_number);
+        batch->count++;
+    }
+
+    free(line);
+    fclose(f);
+    return success;
+}
+
+/* === BUILD === */
+
+// Assembles and links one target, setting its status
+void build_target(BatchTarget *target, const ObjectCache *cache, const AssemblyOptions *assembly) {
+    const int count = target->input_count;
+    char **object_files = calloc(count, sizeof(char *));
+    if (object_files == NULL) {
+        target->status = 1;
+        return;
+    }
+
+    // Objects are named after the output rather than the input, since targets may share inputs
+    int assembled = 0;
+    for (; assembled < count; assembled++) {
+        const size_t size = strlen(target->out_path) + 16;
+        object_files[assembled] = malloc(size);
+        if (object_files[assembled] == NULL) {
+            target->status = 1;
+            goto _build_failed;
+        }
+        snprintf(object_files[assembled], size, "%s.%d.o", target->out_path, assembled);
+
+        target->status = assemble_file(target->inputs[assembled], object_files[assembled], cache, assembly);
+        if (target->status != 0) {
+            target->failed = target->inputs[assembled];
+            remove(object_files[assembled]);
+            free(object_files[assembled]);
+            goto _build_failed;
+        }
+    }
+
+    if (link(target->out_path, object_files, count, &target->options) == 0) {
+        fprintf(stderr, "Error in %s: could not link \"%s\"\n", __FILE__, target->out_path);
+        target->status = 4;
+    }
+
+    _build_failed:
+    for (int i = 0; i < assembled; i++) {
+        remove(object_files[i]);
+        free(object_files[i]);
+    }
+    free(object_files);
+}
+
+void * batch_worker(void *arg) {
+    Batch *batch = arg;
+    while (1) {
+        pthread_mutex_lock(&batch->lock);
+        const int i = batch->next++;
+        pthread_mutex_unlock(&batch->lock);
+        if (i >= batch->count) break;
+
+        ERROR_HANDLER.line = NULL;
+        build_target(&batch->targets[i], batch->cache, &batch->assembly);
+    }
+    return NULL;
+}
+
+// Prints the outcome of each target; returns the exit status of the first target that failed
+int print_summary(const Batch *batch) {
+    int status = 0, built = 0;
+    for (int i = 0; i < batch->count; i++) {
+        const BatchTarget *target = &batch->targets[i];
+        if (target->status == 0) {
+            printf("ok      %s\n", target->out_path);
+            built++;
+            continue;
+        }
+        if (status == 0) status = target->status;
+        if (target->failed != NULL) {
+            printf("FAILED  %s: %s \"%s\"\n", target->out_path, BATCH_STATUS[target->status], target->failed);
+        } else {
+            printf("FAILED  %s: %s\n", target->out_path, BATCH_STATUS[target->status]);
+        }
+    }
+    printf("%d of %d targets built\n", built, batch->count);
+    return status;
+}
+
+int batch_run(const int argc, char *argv[]) {
+    int jobs = cpu_count();
+    AssemblyOptions assembly;
+    assembly.mode = TWO_PASS;
+    assembly.optimize = 0;
+    assembly.delay_slots = 0;
+    assembly.align_functions = 0;
+    ObjectCache cache;
+    cache.dir = NULL; // if null, objects are not cached
+    cache.size_limit = OBJECT_CACHE_DEFAULT_SIZE;
+
+    // Handle options
+    int arg = 0;
+    while (arg < argc - 1) {
+        if (strcmp(argv[arg], "-j") == 0) {
+            char *endptr;
+            const long n = strtol(argv[++arg], &endptr, 10);
+            if (*endptr != '\0' || n <= 0 || n > BATCH_MAX_JOBS) {
+                fprintf(stderr, "error in %s: invalid job count \"%s\"\n", __FILE__, argv[arg]);
+                return 1;
+            }
+            jobs = (int) n;
+        }
+        else if (strcmp(argv[arg], "--single-pass") == 0) {
+            assembly.mode = SINGLE_PASS;
+        }
+        else if (strcmp(argv[arg], "--stream") == 0) {
+            assembly.mode = STREAMING;
+        }
+        else if (strcmp(argv[arg], "-O") == 0) {
+            assembly.optimize = 1;
+        }
+        else if (strcmp(argv[arg], "--delay-slots") == 0) {
+            assembly.delay_slots = 1;
+        }
+        else if (strncmp(argv[arg], "-falign-functions=", strlen("-falign-functions=")) == 0) {
+            char *endptr;
+            const long align = strtol(&argv[arg][strlen("-falign-functions=")], &endptr, 10);
+            if (*endptr != '\0' || align < 0 || align > TEXT_ALIGN_MAX || (align & (align - 1)) != 0) {
+                fprintf(stderr, "error in %s: invalid alignment \"%s\"\n", __FILE__, argv[arg]);
+                return 1;
+            }
+            assembly.align_functions = (uint32_t) align;
+        }
+        else if (strcmp(argv[arg], "--cache") == 0) {
+            cache.dir = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--cache-size") == 0) {
+            char *endptr;
+            const long long size = strtoll(argv[++arg], &endptr, 10);
+            if (*endptr != '\0' || size < 0) {
+                fprintf(stderr, "error in %s: invalid cache size \"%s\"\n", __FILE__, argv[arg]);
+                return 1;
+            }
+            cache.size_limit = (uint64_t) size;
+        }
+        else break;
+        arg++;
+    }
+    if (arg != argc - 1) {
+        fprintf(stderr, "error in %s: invalid arguments\n", __FILE__);
+        return 1;
+    }
+
+    // Set up everything that is shared between targets before starting any threads
+    if (it_shared() == NULL) return 1;
+
+    Batch batch;
+    batch.next = 0;
+    batch.cache = &cache;
+    batch.assembly = assembly;
+    if (read_manifest(argv[arg], &batch) == 0) {
+        for (int i = 0; i < batch.count; i++) {
+            target_destroy(&batch.targets[i]);
+        }
+        free(batch.targets);
+        return 1;
+    }
+
+    if (jobs > batch.count) jobs = batch.count > 0 ? batch.count : 1;
+    pthread_t threads[jobs];
+    int started = 0;
+    pthread_mutex_init(&batch.lock, NULL);
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, batch_worker, &batch) != 0) break;
+    }
+    if (started == 0) batch_worker(&batch); // build on this thread instead
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&batch.lock);
+
+    const int status = print_summary(&batch);
+    for (int i = 0; i < batch.count; i++) {
+        target_destroy(&batch.targets[i]);
+    }
+    free(batch.targets);
+    return status;
+}
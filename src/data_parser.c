@@ -1,4 +1,5 @@
 #include "data_parser.h"
+#include "stats.h"
 #include "utils.h"
 #include <ctype.h>
 #include <limits.h>
@@ -97,6 +98,7 @@ int string(Data * data, const char * str) {
     data->type = STRING;
     data->isSymbol = 0;
     data->value.string = strdup(str+1);
+    if (data->value.string != NULL) MEM_ALLOC(MEM_DATA, strlen(str));
     data->size = (uint32_t) strlen(str) - 1; // Don't count null terminator or initial quote
     return 1;
 }
@@ -109,6 +111,7 @@ int string_nt(Data * data, const char *str) {
     data->type = STRING_NT;
     data->isSymbol = 0;
     data->value.string = strdup(str+1);
+    if (data->value.string != NULL) MEM_ALLOC(MEM_DATA, strlen(str));
     data->size = (uint32_t) strlen(str); // Don't count initial quote, do count null terminator
     return 1;
 }
@@ -131,6 +134,7 @@ int dl_init(DataList * data_list, uint32_t entry) {
         raise_error(MEM, NULL, __FILE__);
         return 0;
     }
+    MEM_ALLOC(MEM_DATA, data_list->cap * sizeof(Data));
     data_list->data_offset = entry;
     return 1;
 }
@@ -140,11 +144,12 @@ int add_data(DataList *data_list, const Data data) {
 
     if (data_list->len >= data_list->cap) {
         data_list->cap *= 2;
-        Data *new = realloc(data_list->list, data_list->cap);
+        Data *new = realloc(data_list->list, data_list->cap * sizeof(Data));
         if (new == NULL) {
             raise_error(MEM, NULL, __FILE__);
             return 0;
         }
+        MEM_GROW(MEM_DATA, data_list->cap / 2 * sizeof(Data), data_list->cap * sizeof(Data));
         data_list->list = new;
     }
 
@@ -155,14 +160,25 @@ int add_data(DataList *data_list, const Data data) {
     return 1;
 }
 
-// Free resources
-void dl_destroy(const DataList *data_list) {
+// Removes every item from the list, keeping the current offset
+void dl_clear(DataList *data_list) {
     for (size_t i = 0; i < data_list->len; i++) {
         if (data_list->list[i].type == STRING || data_list->list[i].type == STRING_NT) {
-            if (data_list->list[i].value.string != NULL) free(data_list->list[i].value.string);
+            char *string = data_list->list[i].value.string;
+            if (string != NULL) {
+                MEM_FREE(MEM_DATA, strlen(string) + 1);
+                free(string);
+            }
         }
     }
+    data_list->len = 0;
+}
+
+// Free resources
+void dl_destroy(DataList *data_list) {
+    dl_clear(data_list);
     free(data_list->list);
+    MEM_FREE(MEM_DATA, data_list->cap * sizeof(Data));
 }
 
 void dl_debug(const DataList *data_list) {
@@ -256,11 +272,11 @@ int data_pad(const Data data, DataList *data_list) {
         n = 1;
     }
     const uint32_t bytes = data_align(n, data_list);
-    return add_padding(data.line, bytes, data_list);
+    return add_padding(data.loc, bytes, data_list);
 }
 
 // Adds a Data structure of type SPACE
-int add_padding(const Line *line, const uint32_t bytes, DataList * data_list) {
+int add_padding(const SourceLoc loc, const uint32_t bytes, DataList * data_list) {
     if (bytes == 0) {
         return 1;
     }
@@ -269,12 +285,12 @@ int add_padding(const Line *line, const uint32_t bytes, DataList * data_list) {
     padding.size = bytes;
     padding.isSymbol = 0;
     padding.value.byte = 0;
-    padding.line = line;
+    padding.loc = loc;
     return add_data(data_list, padding);
 }
 
 // Adds padding bytes to the DataList such that it is aligned on a given boundary (.align directive)
-int add_aligned(const Line *line, const char *token, DataList * data_list) {
+int add_aligned(const SourceLoc loc, const char *token, DataList * data_list) {
     char *endptr;
     const long n = strtol(token, &endptr, 10);
     if (*endptr != '\0') {
@@ -289,7 +305,7 @@ int add_aligned(const Line *line, const char *token, DataList * data_list) {
     }
 
     // Create padding
-    const int x = add_padding(line, bytes, data_list);
+    const int x = add_padding(loc, bytes, data_list);
     if (x == 0) {
         raise_error(ARG_INV, token, __FILE__);
         return 0;
@@ -298,7 +314,7 @@ int add_aligned(const Line *line, const char *token, DataList * data_list) {
 }
 
 // Adds any number of padding bytes (.space directive)
-int add_space(const Line *line, const char *token, DataList * data_list) {
+int add_space(const SourceLoc loc, const char *token, DataList * data_list) {
     char *endptr;
     const long n = strtol(token, &endptr, 10);
     if (*endptr != '\0' || n <= 0) {
@@ -307,7 +323,7 @@ int add_space(const Line *line, const char *token, DataList * data_list) {
     }
 
     // Create padding
-    const int x = add_padding(line, n, data_list);
+    const int x = add_padding(loc, n, data_list);
     if (x == 0) {
         raise_error(ARG_INV, token, __FILE__);
         return 0;
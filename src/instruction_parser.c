@@ -1,6 +1,9 @@
 #include "instruction_parser.h"
+#include "peephole.h"
+#include "stats.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 /* Instruction parser
 
@@ -17,30 +20,96 @@ int il_init(InstructionList * instruction_list, uint32_t entry) {
         raise_error(MEM, NULL, __FILE__);
         return 0;
     }
+    MEM_ALLOC(MEM_INSTRUCTIONS, instruction_list->cap * sizeof(Instruction));
     instruction_list->text_offset = entry;
+    instruction_list->optimize = 0;
+    instruction_list->delay_slots = 0;
+    instruction_list->align_functions = 0;
+    instruction_list->block_start = 0;
+    instruction_list->aligns = NULL;
+    instruction_list->align_count = 0;
+    instruction_list->align_cap = 0;
     return 1;
 }
 
-// Adds the instruction and increments addr
+// Adds the instruction and increments addr; with optimize set, the peephole rules may instead remove it or merge it
+// With delay_slots set, a branch or jump is followed by its delay slot
 int add_instruction(InstructionList *instruction_list, Instruction instr) {
-    if (instruction_list->len >= instruction_list->cap) {
+    if (instruction_list->len + 2 > instruction_list->cap) { // room for a delay slot
         instruction_list->cap = instruction_list->cap * 2;
         Instruction *new = realloc(instruction_list->list, instruction_list->cap * sizeof(Instruction));
         if (new == NULL) {
             return 0;
         }
+        MEM_GROW(MEM_INSTRUCTIONS, instruction_list->cap / 2 * sizeof(Instruction), instruction_list->cap * sizeof(Instruction));
         instruction_list->list = new;
     }
 
-    instruction_list->list[instruction_list->len] = instr;
-    instruction_list->len++;
-    instruction_list->text_offset += 4;
+    if (instruction_list->optimize) {
+        peephole_push(instruction_list, instr);
+    } else {
+        instruction_list->list[instruction_list->len] = instr;
+        instruction_list->len++;
+        instruction_list->text_offset += 4;
+    }
+
+    if (instruction_list->delay_slots && has_delay_slot(&instr)) fill_delay_slot(instruction_list);
+    return 1;
+}
+
+/*
+Pads the text with nops up to a multiple of align bytes (a power of two), and records the offset so the linker keeps it aligned
+The nops are not subject to the peephole rules, which do not look before them either
+Aligning twice in a row records the offset once, with the larger alignment; returns success
+*/
+int il_align(InstructionList *instruction_list, const uint32_t align, const SourceLoc loc) {
+    if (align <= 4) return 1;
+    const uint32_t pad = (align - instruction_list->text_offset % align) % align;
+    TextAlign *last = instruction_list->align_count > 0 ? &instruction_list->aligns[instruction_list->align_count - 1] : NULL;
+    if (last == NULL || last->offset != instruction_list->text_offset) {
+        if (instruction_list->align_count >= instruction_list->align_cap) {
+            const size_t cap = instruction_list->align_cap == 0 ? 8 : instruction_list->align_cap * 2;
+            TextAlign *new = realloc(instruction_list->aligns, cap * sizeof(TextAlign));
+            if (new == NULL) return 0;
+            instruction_list->aligns = new;
+            instruction_list->align_cap = cap;
+        }
+        last = &instruction_list->aligns[instruction_list->align_count++];
+        last->align = 0;
+        last->pad = 0;
+    }
+    if (align > last->align) last->align = align;
+    last->pad += pad;
+    last->offset = instruction_list->text_offset + pad;
+
+    if (instruction_list->len + pad/4 > instruction_list->cap) {
+        size_t cap = instruction_list->cap;
+        while (instruction_list->len + pad/4 > cap) cap *= 2;
+        Instruction *new = realloc(instruction_list->list, cap * sizeof(Instruction));
+        if (new == NULL) return 0;
+        MEM_GROW(MEM_INSTRUCTIONS, instruction_list->cap * sizeof(Instruction), cap * sizeof(Instruction));
+        instruction_list->list = new;
+        instruction_list->cap = cap;
+    }
+    Instruction nop;
+    memset(&nop, 0, sizeof(nop));
+    strcpy(nop.mnemonic, "nop");
+    memset(nop.registers, 255, sizeof(nop.registers));
+    nop.imm.type = NONE;
+    nop.loc = loc;
+    for (uint32_t i = 0; i < pad/4; i++) {
+        instruction_list->list[instruction_list->len++] = nop;
+    }
+    instruction_list->text_offset += pad;
+    instruction_list->block_start = instruction_list->len;
     return 1;
 }
 
 // Frees resources
 void il_destroy(const InstructionList *instruction_list) {
+    free(instruction_list->aligns);
     free(instruction_list->list);
+    MEM_FREE(MEM_INSTRUCTIONS, instruction_list->cap * sizeof(Instruction));
 }
 
 void il_debug(const InstructionList *instruction_list) {
@@ -116,6 +116,17 @@ int it_create(InstructionTable *table) {
     return 1;
 }
 
+InstructionTable SHARED_INSTRUCTION_TABLE = {NULL, 0};
+
+// Returns the instruction table shared by every assembler in the process, creating it on first use
+// Never destroyed; must first be called before any threads are started
+InstructionTable * it_shared(void) {
+    if (SHARED_INSTRUCTION_TABLE.buckets == NULL && it_create(&SHARED_INSTRUCTION_TABLE) == 0) {
+        return NULL;
+    }
+    return &SHARED_INSTRUCTION_TABLE;
+}
+
 // Inserts the InstrDesc into the table using the mnemonic as the key
 int it_insert(InstructionTable * table, const InstrDesc desc) {
 
@@ -296,6 +307,13 @@ uint32_t convert_itype(const Instruction instruction, SymbolTable *symbol_table,
                 case 2: // R_LO16
                     if (re_init(&reloc, current_offset, TEXT, R_LO16, s->name) == 0) return -1;
                     break;
+                case 3: // R_GP16; only meaningful when adding to $gp
+                    if (regs[0] != GP_REGISTER) {
+                        raise_error(ARG_INV, instruction.imm.symbol, __FILE__);
+                        return -1;
+                    }
+                    if (re_init(&reloc, current_offset, TEXT, R_GP16, s->name) == 0) return -1;
+                    break;
                 default:
                     raise_error(ARG_INV, instruction.imm.symbol, __FILE__);
                     return -1;
@@ -327,24 +345,36 @@ uint32_t convert_itype(const Instruction instruction, SymbolTable *symbol_table,
     else if (opcode >= 32 && opcode <= 43) { // Memory instruction
         // Get rs and immediate from instruction.immediate
         // Address is in the form imm(rs) or (rs), i.e., 0x542($t2). If no number given, 0 is used
+        // A small data symbol is addressed relative to $gp, i.e., symbol($gp)
 
-        if (instruction.imm.type != REG_OFFSET) {
-            raise_error(ARGS_INV, NULL, __FILE__);
-            return -1;
+        if (instruction.imm.type == SYMBOL && instruction.imm.modifier == 3) {
+            const Symbol *s = st_get_symbol_safe(symbol_table, instruction.imm.symbol);
+            if (s == NULL) return -1;
+            RelocationEntry reloc;
+            if (re_init(&reloc, current_offset, TEXT, R_GP16, s->name) == 0) return -1;
+            rt_add(reloc_table, reloc);
+            regs[0] = GP_REGISTER;
+            imm = 0;
         }
+        else {
+            if (instruction.imm.type != REG_OFFSET) {
+                raise_error(ARGS_INV, NULL, __FILE__);
+                return -1;
+            }
 
-        Immediate i;
-        const int r = read_base_address(instruction.imm.symbol, &i);
-        if (r == -1) {
-            raise_error(ARG_INV, instruction.imm.symbol, __FILE__);
-            return -1;
-        }
-        regs[0] = r;
-        if (i.intValue > INT16_MAX || i.intValue < INT16_MIN) {
-            raise_error(ARGS_INV, NULL, __FILE__);
-            return -1;
+            Immediate i;
+            const int r = read_base_address(instruction.imm.symbol, &i);
+            if (r == -1) {
+                raise_error(ARG_INV, instruction.imm.symbol, __FILE__);
+                return -1;
+            }
+            regs[0] = r;
+            if (i.intValue > INT16_MAX || i.intValue < INT16_MIN) {
+                raise_error(ARGS_INV, NULL, __FILE__);
+                return -1;
+            }
+            imm = i.intValue & 0x0000FFFF;
         }
-        imm = i.intValue & 0x0000FFFF;
     }
 
 
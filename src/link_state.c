@@ -0,0 +1,214 @@
+#include "link_state.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Link state
+
+Records the layout of an executable produced by an incremental link: where each object's
+segments were placed, the global symbols it defines, and the relocations in it that depend
+on other objects. The next incremental link reads it back to patch only the objects that changed.
+
+The state is saved next to the executable, with LINK_STATE_SUFFIX appended to its path.
+*/
+
+// Initializes a state with the given number of empty objects
+int ls_init(LinkState *state, const uint32_t object_count) {
+    memset(&state->header, 0, sizeof(state->header));
+    state->padding = 0;
+    memset(state->entry, '\0', sizeof(state->entry));
+    state->object_count = 0;
+    state->objects = calloc(object_count > 0 ? object_count : 1, sizeof(LinkStateObject));
+    if (state->objects == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        return 0;
+    }
+    for (uint32_t i = 0; i < object_count; i++) {
+        if (rt_init(&state->objects[i].externals) == 0) {
+            ls_destroy(state);
+            return 0;
+        }
+        state->object_count++;
+    }
+    return 1;
+}
+
+// Frees resources
+void ls_destroy(const LinkState *state) {
+    for (uint32_t i = 0; i < state->object_count; i++) {
+        free(state->objects[i].name);
+        free(state->objects[i].globals);
+        rt_destroy(&state->objects[i].externals);
+    }
+    free(state->objects);
+}
+
+// Returns the path of the state saved for the executable at out_path. Must be freed by the caller
+char * ls_path(const char *out_path) {
+    char *path = malloc(strlen(out_path) + strlen(LINK_STATE_SUFFIX) + 1);
+    if (path == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        return NULL;
+    }
+    strcpy(path, out_path);
+    strcat(path, LINK_STATE_SUFFIX);
+    return path;
+}
+
+int lso_set_name(LinkStateObject *object, const char *name) {
+    free(object->name);
+    object->name = strdup(name);
+    if (object->name == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        return 0;
+    }
+    return 1;
+}
+
+int lso_add_global(LinkStateObject *object, const Symbol symbol) {
+    Symbol *new = realloc(object->globals, (object->global_count + 1) * sizeof(Symbol));
+    if (new == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        return 0;
+    }
+    object->globals = new;
+    object->globals[object->global_count++] = symbol;
+    return 1;
+}
+
+// Removes the object's globals and external relocations, keeping its name and layout
+void lso_clear(LinkStateObject *object) {
+    free(object->globals);
+    object->globals = NULL;
+    object->global_count = 0;
+    object->externals.len = 0;
+}
+
+/* === FILE I/O === */
+
+int ls_write_name(FILE *file, const char *name) {
+    const uint32_t len = strlen(name);
+    return write_word(file, len) && write_string(file, name, len);
+}
+
+// Reads a name written by ls_write_name(); returns NULL on failure
+char * ls_read_name(FILE *file) {
+    const uint32_t len = read_word(file);
+    if (feof(file) || len > 4096) return NULL;
+    char *name = malloc(len + 1);
+    if (name == NULL) return NULL;
+    if (len > 0 && fread(name, 1, len, file) != len) {
+        free(name);
+        return NULL;
+    }
+    name[len] = '\0';
+    return name;
+}
+
+// Reads the state saved at path. Returns 0 without raising an error if it is missing or invalid,
+// since the caller falls back to a full link
+int ls_read(LinkState *state, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return 0;
+
+    if (read_word(file) != LINK_STATE_MAGIC || read_word(file) != LINK_STATE_VERSION) {
+        fclose(file);
+        return 0;
+    }
+
+    struct FileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        return 0;
+    }
+    const uint32_t padding = read_word(file);
+    char *entry = ls_read_name(file);
+    const uint32_t object_count = read_word(file);
+    if (entry == NULL || strlen(entry) >= SYMBOL_SIZE || feof(file) || object_count > (1 << 20) || ls_init(state, object_count) == 0) {
+        free(entry);
+        fclose(file);
+        return 0;
+    }
+    state->header = header;
+    state->padding = padding;
+    strcpy(state->entry, entry);
+    free(entry);
+
+    for (uint32_t i = 0; i < object_count; i++) {
+        LinkStateObject *object = &state->objects[i];
+        object->name = ls_read_name(file);
+        if (object->name == NULL) goto _read_failed;
+        object->hash = read_word(file);
+        object->hash |= (uint64_t) read_word(file) << 32;
+        object->text_offset = read_word(file);
+        object->data_offset = read_word(file);
+        object->sdata_offset = read_word(file);
+        object->text_slot = read_word(file);
+        object->data_slot = read_word(file);
+        object->sdata_slot = read_word(file);
+
+        const uint32_t global_count = read_word(file);
+        if (feof(file)) goto _read_failed;
+        for (uint32_t j = 0; j < global_count; j++) {
+            Symbol symbol;
+            if (fread(&symbol, sizeof(Symbol), 1, file) != 1 || lso_add_global(object, symbol) == 0) goto _read_failed;
+        }
+
+        const uint32_t external_count = read_word(file);
+        if (feof(file)) goto _read_failed;
+        for (uint32_t j = 0; j < external_count; j++) {
+            RelocationEntry entry;
+            if (fread(&entry, sizeof(RelocationEntry), 1, file) != 1 || rt_add(&object->externals, entry) == 0) goto _read_failed;
+        }
+    }
+
+    fclose(file);
+    return 1;
+
+    _read_failed:
+    ls_destroy(state);
+    fclose(file);
+    return 0;
+}
+
+// Writes the state to path
+int ls_write(const LinkState *state, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        raise_error(FILE_IO, path, __FILE__);
+        return 0;
+    }
+
+    int success = write_word(file, LINK_STATE_MAGIC) && write_word(file, LINK_STATE_VERSION);
+    success = success && fwrite(&state->header, sizeof(state->header), 1, file) == 1;
+    success = success && write_word(file, state->padding) && ls_write_name(file, state->entry);
+    success = success && write_word(file, state->object_count);
+
+    for (uint32_t i = 0; success && i < state->object_count; i++) {
+        const LinkStateObject *object = &state->objects[i];
+        success = ls_write_name(file, object->name)
+            && write_word(file, (uint32_t) object->hash)
+            && write_word(file, (uint32_t) (object->hash >> 32))
+            && write_word(file, object->text_offset)
+            && write_word(file, object->data_offset)
+            && write_word(file, object->sdata_offset)
+            && write_word(file, object->text_slot)
+            && write_word(file, object->data_slot)
+            && write_word(file, object->sdata_slot)
+            && write_word(file, object->global_count);
+        for (uint32_t j = 0; success && j < object->global_count; j++) {
+            success = fwrite(&object->globals[j], sizeof(Symbol), 1, file) == 1;
+        }
+        success = success && write_word(file, object->externals.len);
+        for (size_t j = 0; success && j < object->externals.len; j++) {
+            success = fwrite(&object->externals.list[j], sizeof(RelocationEntry), 1, file) == 1;
+        }
+    }
+
+    if (fclose(file) != 0 || !success) {
+        raise_error(FILE_IO, path, __FILE__);
+        remove(path);
+        return 0;
+    }
+    return 1;
+}
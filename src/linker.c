@@ -1,34 +1,65 @@
 #include "linker.h"
+#include "link_state.h"
+#include "stats.h"
 #include "utils.h"
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
 void file_destroy(const SourceFile *file) {
+    free(file->text);
+    free(file->data);
+    free(file->sdata);
+    rt_destroy(file->relocation_table);
     free(file->relocation_table);
+    st_destroy(file->symbol_table);
     free(file->symbol_table);
+    free(file->sections);
+    free(file->aligns);
+    free(file->strings);
 }
 
-int file_init(SourceFile *file, uint32_t text_offset, uint32_t data_offset, uint32_t text_size, uint32_t data_size) {
+int file_init(SourceFile *file, const struct FileHeader *header, uint32_t text_offset, uint32_t data_offset, uint32_t sdata_offset) {
     file->text_offset = text_offset;
     file->data_offset = data_offset;
-    file->text_size = text_size;
-    file->data_size = data_size;
-    uint32_t *text = malloc(text_size);
+    file->sdata_offset = sdata_offset;
+    file->text_size = header->text_size;
+    file->data_size = header->data_size;
+    file->sdata_size = header->sdata_size;
+    file->flags = header->flags;
+    file->blocks = NULL;
+    file->block_count = 0;
+    file->sections = NULL;
+    file->section_count = 0;
+    file->aligns = NULL;
+    file->align_count = 0;
+    file->strings = NULL;
+    file->string_count = 0;
+    file->name = NULL;
+    uint32_t *text = malloc(file->text_size);
     if (text == NULL) {
         goto _init_failure;
     }
     file->text = text;
-    uint8_t *data = malloc(data_size);
+    uint8_t *data = malloc(file->data_size);
     if (data == NULL) {
         free(text);
         goto _init_failure;
     }
     file->data = data;
+    uint8_t *sdata = malloc(file->sdata_size);
+    if (sdata == NULL) {
+        free(text);
+        free(data);
+        goto _init_failure;
+    }
+    file->sdata = sdata;
 
     RelocationTable *table = malloc(sizeof(RelocationTable));
     if (table == NULL) {
         free(text);
         free(data);
+        free(sdata);
         goto _init_failure;
     }
     rt_init(table);
@@ -38,6 +69,8 @@ int file_init(SourceFile *file, uint32_t text_offset, uint32_t data_offset, uint
     if (symbol_table == NULL) {
         free(text);
         free(data);
+        free(sdata);
+        rt_destroy(table);
         free(table);
         goto _init_failure;
     }
@@ -58,77 +91,137 @@ uint32_t get_final_address(const Symbol symbol, const uint32_t object_offset) {
         case TEXT:
             return TEXT_START + object_offset + symbol.offset;
         case DATA:
+        case SDATA:
             return DATA_START + object_offset + symbol.offset;
         default:
             return 0;
     }
 }
 
-int relocate(SourceFile file, RelocationEntry entry, uint32_t final_address) {
-    if (entry.segment == UNDEF) return 0;
-    const uint32_t instr_addr = TEXT_START + file.text_offset + entry.target_offset;
-    const uint32_t instr_offset = entry.target_offset/4;
+// Returns the offset of the object's part of a segment
+uint32_t segment_offset(const SourceFile *file, const enum Segment segment) {
+    switch (segment) {
+        case TEXT:
+            return file->text_offset;
+        case DATA:
+            return file->data_offset;
+        case SDATA:
+            return file->sdata_offset;
+        default:
+            return 0;
+    }
+}
+
+// Returns the final address of an offset in the object's text
+uint32_t text_address(const SourceFile *file, const uint32_t offset) {
+    if (file->block_count == 0) return TEXT_START + file->text_offset + offset;
+    uint32_t low = 0, high = file->block_count;
+    while (high - low > 1) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (file->blocks[middle].start <= offset) low = middle;
+        else high = middle;
+    }
+    return TEXT_START + file->blocks[low].address + offset - file->blocks[low].start;
+}
+
+// Returns the final address of a symbol the object defines
+uint32_t symbol_address(const SourceFile *file, const Symbol symbol) {
+    if (symbol.segment == TEXT) return text_address(file, symbol.offset);
+    return get_final_address(symbol, segment_offset(file, symbol.segment));
+}
+
+// Replaces the field of `word` that the relocation refers to with final_address
+// instr_addr is the final address of the word; name is used for error messages
+int resolve_field(uint32_t *word, const RelocationEntry entry, const uint32_t instr_addr, const uint32_t final_address, const char *name) {
     switch (entry.reloc_type) {
         case R_32:
             // Check segment
-            if (entry.segment != DATA) {
-                fprintf(stderr, "Error linking %s: attempted R_32 relocation outside data segment\n", file.name);
+            if (entry.segment != DATA && entry.segment != SDATA) {
+                fprintf(stderr, "Error linking %s: attempted R_32 relocation outside data segment\n", name);
                 return 0;
             }
-            // Replace bytes little-endian
-            file.data[entry.target_offset] = final_address & 0xFF;
-            file.data[entry.target_offset+1] = final_address >> 8 & 0xFF;
-            file.data[entry.target_offset+2] = final_address >> 16 & 0xFF;
-            file.data[entry.target_offset+3] = final_address >> 24 & 0xFF;
+            *word = final_address;
             return 1;
         case R_26:
             // Check segment
             if (entry.segment != TEXT) {
-                fprintf(stderr, "Error linking %s: attempted R_26 relocation outside text segment\n", file.name);
+                fprintf(stderr, "Error linking %s: attempted R_26 relocation outside text segment\n", name);
                 return 0;
             }
             // Check range (compare MSBs of instruction's real address and final address)
             if ((instr_addr & 0xF0000000) != (final_address & 0xF0000000)) {
-                fprintf(stderr, "Error linking %s: jump target out of range\n", file.name);
+                fprintf(stderr, "Error linking %s: jump target out of range\n", name);
                 return 0;
             }
             // Replace 26 lower bits
-            file.text[instr_offset] |= (final_address & 0x0FFFFFFFF) >> 2;
+            *word = (*word & 0xFC000000) | (final_address & 0x0FFFFFFF) >> 2;
             return 1;
         case R_PC16:
             // Check segment
             if (entry.segment != TEXT) {
-                fprintf(stderr, "Error linking %s: attempted R_PC16 relocation outside text segment\n", file.name);
+                fprintf(stderr, "Error linking %s: attempted R_PC16 relocation outside text segment\n", name);
                 return 0;
             }
             // Check range (within 2^15 instructions)
             const int32_t dist = ((int32_t) final_address - ((int32_t) instr_addr + 4))/4;
             if (dist < INT16_MIN || dist > INT16_MAX) {
-                fprintf(stderr, "Error linking %s: branch target out of range\n", file.name);
+                fprintf(stderr, "Error linking %s: branch target out of range\n", name);
                 return 0;
             }
-            file.text[instr_offset] |= (uint16_t) dist;
+            *word = (*word & 0xFFFF0000) | (uint16_t) dist;
             return 1;
         case R_HI16:
             if (entry.segment != TEXT) {
-                fprintf(stderr, "Error linking %s: attempted R_HI16 relocation outside text segment\n", file.name);
+                fprintf(stderr, "Error linking %s: attempted R_HI16 relocation outside text segment\n", name);
                 return 0;
             }
-            file.text[instr_offset] |= final_address >> 16;
+            *word = (*word & 0xFFFF0000) | final_address >> 16;
             return 1;
         case R_LO16:
             if (entry.segment != TEXT) {
-                fprintf(stderr, "Error linking %s: attempted R_LO16 relocation outside text segment\n", file.name);
+                fprintf(stderr, "Error linking %s: attempted R_LO16 relocation outside text segment\n", name);
+                return 0;
+            }
+            *word = (*word & 0xFFFF0000) | (final_address & 0x0000FFFF);
+            return 1;
+        case R_GP16:
+            if (entry.segment != TEXT) {
+                fprintf(stderr, "Error linking %s: attempted R_GP16 relocation outside text segment\n", name);
+                return 0;
+            }
+            // Check range (within 2^15 bytes of $gp)
+            const int32_t gp_offset = (int32_t) (final_address - GP_ADDRESS);
+            if (gp_offset < INT16_MIN || gp_offset > INT16_MAX) {
+                fprintf(stderr, "Error linking %s: symbol '%s' is out of range of $gp\n", name, entry.dependency);
                 return 0;
             }
-            file.text[instr_offset] |= final_address & 0x0000FFFF;
+            *word = (*word & 0xFFFF0000) | (uint16_t) gp_offset;
             return 1;
         default:
-            fprintf(stderr, "Error linking %s: unrecognized relocation directive\n", file.name);
+            fprintf(stderr, "Error linking %s: unrecognized relocation directive\n", name);
             return 0;
     }
 }
 
+int relocate(SourceFile file, RelocationEntry entry, uint32_t final_address) {
+    if (entry.segment == UNDEF) return 0;
+    const uint32_t instr_addr = text_address(&file, entry.target_offset);
+
+    if (entry.segment == DATA || entry.segment == SDATA) {
+        // Data words are stored little-endian
+        uint8_t *bytes = entry.segment == SDATA ? &file.sdata[entry.target_offset] : &file.data[entry.target_offset];
+        uint32_t word = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+        if (resolve_field(&word, entry, instr_addr, final_address, file.name) == 0) return 0;
+        bytes[0] = word & 0xFF;
+        bytes[1] = word >> 8 & 0xFF;
+        bytes[2] = word >> 16 & 0xFF;
+        bytes[3] = word >> 24 & 0xFF;
+        return 1;
+    }
+
+    return resolve_field(&file.text[entry.target_offset/4], entry, instr_addr, final_address, file.name);
+}
+
 void debug_section(const SourceFile file, const enum Segment segment) {
     if (segment == TEXT) {
         for (uint32_t i = 0; i < file.text_size/4; i++) {
@@ -137,7 +230,8 @@ void debug_section(const SourceFile file, const enum Segment segment) {
     }
 }
 
-void load_file(FILE *source, const SourceFile *file, const struct FileHeader * header, SymbolTable *global_symbols) {
+// Reads the segments and tables of an object into a file set up by file_init(); returns success
+int load_file(FILE *source, SourceFile *file, const struct FileHeader * header) {
     // Read text
     for (uint32_t i = 0; i < header->text_size/4; i++) {
         file->text[i] = read_word(source);
@@ -148,6 +242,11 @@ void load_file(FILE *source, const SourceFile *file, const struct FileHeader * h
         file->data[i] = read_byte(source);
     }
 
+    // Read small data
+    for (uint32_t i = 0; i < header->sdata_size; i++) {
+        file->sdata[i] = read_byte(source);
+    }
+
     // Read relocation table
     const uint32_t reloc_size = read_word(source);
     for (uint32_t i = 0; i < reloc_size; i++) {
@@ -162,44 +261,109 @@ void load_file(FILE *source, const SourceFile *file, const struct FileHeader * h
         Symbol symbol;
         fread(&symbol, sizeof(Symbol), 1, source);
         st_add_struct(file->symbol_table, symbol);
+    }
 
-        // Add global symbols to symbol table
-        if (symbol.binding == GLOBAL && symbol.segment != UNDEF) {
-            uint32_t final_address = 0;
-            if (symbol.segment == TEXT) {
-                final_address = get_final_address(symbol, file->text_offset);
-            } else if (symbol.segment == DATA) {
-                final_address = get_final_address(symbol, file->data_offset);
-            }
+    // Read named sections
+    if (header->flags & FILE_SECTIONS) {
+        const uint32_t section_count = read_word(source);
+        file->sections = malloc(sizeof(TextSection) * (section_count + 1));
+        if (file->sections == NULL) {
+            raise_error(MEM, NULL, __FILE__);
+            return 0;
+        }
+        file->section_count = (uint32_t) fread(file->sections, sizeof(TextSection), section_count, source);
+    }
+
+    // Read aligned offsets
+    if (header->flags & FILE_ALIGNED) {
+        const uint32_t align_count = read_word(source);
+        file->aligns = malloc(sizeof(TextAlign) * (align_count + 1));
+        if (file->aligns == NULL) {
+            raise_error(MEM, NULL, __FILE__);
+            return 0;
+        }
+        file->align_count = (uint32_t) fread(file->aligns, sizeof(TextAlign), align_count, source);
+    }
+
+    // Read read-only strings
+    if (header->flags & FILE_STRINGS) {
+        const uint32_t string_count = read_word(source);
+        file->strings = malloc(sizeof(DataString) * (string_count + 1));
+        if (file->strings == NULL) {
+            raise_error(MEM, NULL, __FILE__);
+            return 0;
+        }
+        file->string_count = (uint32_t) fread(file->strings, sizeof(DataString), string_count, source);
+    }
+    return 1;
+}
+
+// Alignment in bytes that the object's text must be placed at, so that its aligned offsets stay aligned
+uint32_t text_alignment(const SourceFile *file) {
+    uint32_t align = 4;
+    for (uint32_t i = 0; i < file->align_count; i++) {
+        if (file->aligns[i].align > align) align = file->aligns[i].align;
+    }
+    return align;
+}
+
+// Rounds offset up to a multiple of align, a power of two
+uint32_t align_up(const uint32_t offset, const uint32_t align) {
+    return (offset + align - 1) & ~(align - 1);
+}
+
+// Adds the global symbols a loaded object defines to the global symbol table, once its offsets are final
+void add_global_symbols(const SourceFile *file, SymbolTable *global_symbols) {
+    for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+        for (const SymbolBucket *cur = file->symbol_table->buckets[i]; cur != NULL; cur = cur->next) {
+            const Symbol symbol = cur->item;
+            if (symbol.binding != GLOBAL || symbol.segment == UNDEF) continue;
+            const uint32_t final_address = symbol_address(file, symbol);
             st_add_symbol(global_symbols, symbol.name, final_address, symbol.segment, GLOBAL);
         }
     }
 }
 
+// Defines the symbols provided by the linker, unless an object defines them: _gp, the value of $gp
+void add_linker_symbols(SymbolTable *global_symbols) {
+    if (st_get_symbol(global_symbols, "_gp") == NULL) {
+        st_add_symbol(global_symbols, "_gp", GP_ADDRESS, DATA, GLOBAL);
+    }
+}
+
+// Recomputes the global symbol table, once objects have moved
+void rebuild_global_symbols(const SourceFile *files, const int count, SymbolTable *global_symbols) {
+    st_destroy(global_symbols);
+    st_init(global_symbols);
+    for (int i = 0; i < count; i++) {
+        add_global_symbols(&files[i], global_symbols);
+    }
+    add_linker_symbols(global_symbols);
+}
+
 int file_relocation(const SourceFile *source, const SymbolTable *global_symbols) {
     const RelocationTable *reloc_table = source->relocation_table;
-    const uint32_t text_offset = source->text_offset;
-    const uint32_t data_offset = source->data_offset;
     for (size_t i = 0; i < reloc_table->len; i++) {
         const RelocationEntry entry = reloc_table->list[i];
         const Symbol *dependency = st_get_symbol_safe(source->symbol_table, entry.dependency);
+        if (dependency == NULL) return 0;
 
         // Get final address for each symbol
         uint32_t final_address = 0;
         switch (dependency->segment) {
             case TEXT:
-                final_address = get_final_address(*dependency, text_offset);
-                break;
             case DATA:
-                final_address = get_final_address(*dependency, data_offset);
+            case SDATA:
+                final_address = symbol_address(source, *dependency);
                 break;
             case UNDEF:
                 if (dependency->binding != GLOBAL) {
                     fprintf(stderr, "Error linking %s: symbol undefined\n", source->name);
                     return 0;
                 }
-                dependency = st_get_symbol_safe(global_symbols, entry.dependency);
+                dependency = st_get_symbol(global_symbols, entry.dependency);
                 if (dependency == NULL) {
+                    fprintf(stderr, "Error linking %s: undefined symbol '%s'\n", source->name, entry.dependency);
                     if (strcmp(entry.dependency, "main") == 0) {
                         fprintf(stderr, "Could not find symbol 'main'. Have you exported it with .globl?\n");
                     }
@@ -220,132 +384,1945 @@ int file_relocation(const SourceFile *source, const SymbolTable *global_symbols)
     return 1;
 }
 
-FILE * open_object_file(const char *path, struct FileHeader *final_header, struct FileHeader *header) {
+FILE * open_object_file(const char *path, struct FileHeader *header) {
     FILE *f = fopen(path, "rb");
     if (f == NULL) {
         raise_error(FILE_IO, path, __FILE__);
         return NULL;
     }
     fread(header, sizeof(struct FileHeader), 1, f);
-    final_header->text_size += header->text_size;
-    final_header->data_size += header->data_size;
     return f;
 }
 
-int link(const char *out_path, char *object_files[], int file_count, const char *entry_symbol) {
-    SourceFile source_files[file_count];
+// Opens the startup object: the file at `path` if given, otherwise the object built into the executable
+FILE * open_start_object(const char *path, struct FileHeader *header) {
+    if (path != NULL) return open_object_file(path, header);
 
-    SymbolTable global_symbols;
-    st_init(&global_symbols);
+    if (START_OBJECT_SIZE == 0) {
+        fprintf(stderr, "Error linking: no built-in startup object, one must be given with -s\n");
+        return NULL;
+    }
+    FILE *f = fmemopen((void *) START_OBJECT, START_OBJECT_SIZE, "rb");
+    if (f == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        return NULL;
+    }
+    fread(header, sizeof(struct FileHeader), 1, f);
+    return f;
+}
 
-    struct FileHeader final_header;
-    final_header.text_size = 0;
-    final_header.data_size = 0;
+// Opens the object at `index` in the link: one of the object files, or the startup object after them
+FILE * open_link_object(char *object_files[], const int file_count, const int index, const LinkOptions *options, struct FileHeader *header) {
+    if (index < file_count) return open_object_file(object_files[index], header);
+    return open_start_object(options->start_path, header);
+}
 
-    /*
-    For each file:
-       - load its text segment
-       - load its data segment
-       - load its relocation table
-       - load its symbol table and add global defined symbols to global symbol table
-    */
-    for (int file_index = 0; file_index < file_count; file_index++) {
-        uint32_t text_offset, data_offset;
-        if (file_index == 0) {
-            text_offset = 0;
-            data_offset = 0;
+// Name of the object at `index` in the link, used in error messages and the link state
+const char * link_object_name(char *object_files[], const int file_count, const int index, const LinkOptions *options) {
+    if (index < file_count) return object_files[index];
+    if (options->start_path != NULL) return options->start_path;
+    return "__start";
+}
+
+// Writes the given number of zero bytes (nop instructions in the text segment)
+int write_padding(FILE *file, uint32_t bytes) {
+    while (bytes > 0) {
+        if (write_byte(file, 0) == 0) return 0;
+        bytes--;
+    }
+    return 1;
+}
+
+/* === ALIGNMENT === */
+
+// Number of aligned offsets of the file's text at or before offset
+uint32_t aligns_up_to(const SourceFile *file, const uint32_t offset) {
+    uint32_t low = 0, high = file->align_count;
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (file->aligns[middle].offset <= offset) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+/*
+Resizes the nops before each aligned offset of the file's text so that it is aligned again once code before it
+was added or removed, and moves the code, symbols, relocations and named sections after it
+Offsets are aligned within the object, whose text is placed at a multiple of text_alignment(); returns success
+*/
+int realign_text(SourceFile *file) {
+    if (file->align_count == 0) return 1;
+    int64_t *shift = malloc(sizeof(int64_t) * file->align_count); // how far each aligned offset (and what follows) moves
+    if (shift == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        return 0;
+    }
+    int64_t moved = 0;
+    int changed = 0;
+    for (uint32_t i = 0; i < file->align_count; i++) {
+        const TextAlign *aligned = &file->aligns[i];
+        const uint32_t start = (uint32_t) (aligned->offset - aligned->pad + moved); // where its nops now start
+        const uint32_t pad = (aligned->align - start % aligned->align) % aligned->align;
+        if (pad != aligned->pad) changed = 1;
+        moved += (int64_t) pad - aligned->pad;
+        shift[i] = moved;
+    }
+    if (!changed) {
+        free(shift);
+        return 1;
+    }
+
+    const uint32_t text_size = (uint32_t) (file->text_size + moved);
+    uint32_t *text = malloc(text_size + 4);
+    if (text == NULL) {
+        free(shift);
+        raise_error(MEM, NULL, __FILE__);
+        return 0;
+    }
+    uint32_t from = 0, to = 0;
+    for (uint32_t i = 0; i < file->align_count; i++) {
+        const TextAlign *aligned = &file->aligns[i];
+        const uint32_t start = aligned->offset - aligned->pad;
+        memcpy(&text[to/4], &file->text[from/4], start - from);
+        to += start - from;
+        const uint32_t offset = (uint32_t) (aligned->offset + shift[i]);
+        memset(&text[to/4], 0, offset - to);
+        to = offset;
+        from = aligned->offset;
+    }
+    memcpy(&text[to/4], &file->text[from/4], file->text_size - from);
+    free(file->text);
+    file->text = text;
+    file->text_size = text_size;
+
+    RelocationTable *table = file->relocation_table;
+    for (size_t i = 0; i < table->len; i++) {
+        const uint32_t before = table->list[i].segment == TEXT ? aligns_up_to(file, table->list[i].target_offset) : 0;
+        if (before > 0) table->list[i].target_offset += shift[before-1];
+    }
+    for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+        for (SymbolBucket *cur = file->symbol_table->buckets[i]; cur != NULL; cur = cur->next) {
+            const uint32_t before = cur->item.segment == TEXT ? aligns_up_to(file, cur->item.offset) : 0;
+            if (before > 0) cur->item.offset += shift[before-1];
+        }
+    }
+    for (uint32_t i = 0; i < file->section_count; i++) {
+        const uint32_t before = aligns_up_to(file, file->sections[i].offset);
+        if (before > 0) file->sections[i].offset += shift[before-1];
+    }
+    for (uint32_t i = 0; i < file->align_count; i++) {
+        TextAlign *aligned = &file->aligns[i];
+        const uint32_t start = (uint32_t) (aligned->offset - aligned->pad + (i > 0 ? shift[i-1] : 0));
+        aligned->offset += shift[i];
+        aligned->pad = aligned->offset - start;
+    }
+    free(shift);
+    return 1;
+}
+
+/* === UNITS === */
+
+#define UNIT_SEGMENTS 3 // text, data and small data
+
+static const enum Segment UNIT_SEGMENT_LIST[UNIT_SEGMENTS] = {TEXT, DATA, SDATA};
+
+/*
+Part of an object's segment that the linker keeps, removes or folds as a whole: from a global symbol to the next one,
+or from the start of the segment to its first global symbol; text is also split where each named section starts
+*/
+typedef struct {
+    int file;
+    enum Segment segment;
+    uint32_t start;
+    uint32_t end;
+    uint32_t new_start; // Offset once the units before it are removed
+    int live;
+    int labeled;        // Whether a symbol is defined at its start
+} LinkUnit;
+
+typedef struct {
+    LinkUnit *list;
+    size_t len;
+    size_t *first;      // Index of the first unit of each file's segments, at file * UNIT_SEGMENTS + segment, then len
+    SymbolTable owners; // Defined global symbols, with the index of their unit as offset
+} UnitMap;
+
+int compare_offsets(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t *) a;
+    const uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+uint32_t segment_size(const SourceFile *file, const enum Segment segment) {
+    switch (segment) {
+        case TEXT:
+            return file->text_size;
+        case DATA:
+            return file->data_size;
+        case SDATA:
+            return file->sdata_size;
+        default:
+            return 0;
+    }
+}
+
+uint8_t * segment_bytes(const SourceFile *file, const enum Segment segment) {
+    switch (segment) {
+        case TEXT:
+            return (uint8_t *) file->text;
+        case DATA:
+            return file->data;
+        case SDATA:
+            return file->sdata;
+        default:
+            return NULL;
+    }
+}
+
+int unit_segment_index(const enum Segment segment) {
+    return segment == TEXT ? 0 : segment == DATA ? 1 : 2;
+}
+
+// Returns the unit of the file's segment that contains offset (the last one for the end of the segment), or SIZE_MAX
+size_t um_find(const UnitMap *map, const int file, const enum Segment segment, const uint32_t offset) {
+    const size_t *range = &map->first[file * UNIT_SEGMENTS + unit_segment_index(segment)];
+    size_t first = range[0], last = range[1];
+    if (first == last || map->list[first].start > offset) return SIZE_MAX;
+    while (last - first > 1) {
+        const size_t middle = first + (last - first) / 2;
+        if (map->list[middle].start <= offset) first = middle;
+        else last = middle;
+    }
+    return first;
+}
+
+// Returns the unit of the symbol the file refers to, and sets its offset in its segment; SIZE_MAX if it is not defined
+size_t um_target(const UnitMap *map, const SourceFile *files, const int file, const char *name, uint32_t *offset) {
+    const Symbol *symbol = st_get_symbol(files[file].symbol_table, name);
+    if (symbol != NULL && symbol->segment != UNDEF) {
+        *offset = symbol->offset;
+        return um_find(map, file, symbol->segment, symbol->offset);
+    }
+    const Symbol *owner = st_get_symbol(&map->owners, name);
+    if (owner == NULL) return SIZE_MAX;
+    *offset = st_get_symbol(files[map->list[owner->offset].file].symbol_table, name)->offset;
+    return owner->offset;
+}
+
+/*
+Splits the segments of the files into units, all live
+Segments are split at global symbols; with split_data, data and small data are also split at every other symbol
+*/
+int um_init(UnitMap *map, const SourceFile *files, const int count, const int split_data) {
+    map->list = NULL;
+    map->len = 0;
+    map->first = malloc(sizeof(size_t) * (count * UNIT_SEGMENTS + 1));
+    uint32_t *starts = NULL;
+    size_t cap = 0;
+    st_init(&map->owners);
+    if (map->first == NULL) goto _um_failed;
+
+    for (int f = 0; f < count; f++) {
+        const SymbolTable *symbols = files[f].symbol_table;
+        uint32_t *list = realloc(starts, sizeof(uint32_t) * (symbols->size + files[f].section_count + 1));
+        if (list == NULL) goto _um_failed;
+        starts = list;
+        for (int s = 0; s < UNIT_SEGMENTS; s++) {
+            const enum Segment segment = UNIT_SEGMENT_LIST[s];
+            const uint32_t size = segment_size(&files[f], segment);
+            const int every_symbol = split_data && segment != TEXT;
+            size_t n = 0;
+            int labeled = 0; // whether a symbol is defined at offset 0
+            for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+                for (const SymbolBucket *cur = symbols->buckets[i]; cur != NULL; cur = cur->next) {
+                    if (cur->item.segment != segment) continue;
+                    if (cur->item.offset == 0) labeled = 1;
+                    if (cur->item.binding == GLOBAL || every_symbol) starts[n++] = cur->item.offset;
+                }
+            }
+            for (uint32_t i = 0; segment == TEXT && i < files[f].section_count; i++) {
+                if (files[f].sections[i].offset < size) starts[n++] = files[f].sections[i].offset;
+            }
+            starts[n++] = 0;
+            qsort(starts, n, sizeof(uint32_t), compare_offsets);
+
+            map->first[f * UNIT_SEGMENTS + s] = map->len;
+            if (map->len + n > cap) {
+                cap = 2 * (map->len + n);
+                LinkUnit *grown = realloc(map->list, sizeof(LinkUnit) * cap);
+                if (grown == NULL) goto _um_failed;
+                map->list = grown;
+            }
+            for (size_t k = 0; k < n; k++) {
+                if (k + 1 < n && starts[k+1] == starts[k]) continue;
+                if (n == 1 && size == 0) continue; // empty segment
+                LinkUnit *unit = &map->list[map->len++];
+                unit->file = f;
+                unit->segment = segment;
+                unit->start = starts[k];
+                unit->end = k + 1 < n ? starts[k+1] : size;
+                unit->new_start = unit->start;
+                unit->live = 1;
+                unit->labeled = starts[k] != 0 || labeled;
+            }
         }
-        else {
-            text_offset = final_header.text_size;
-            data_offset = final_header.data_size;
+    }
+    map->first[count * UNIT_SEGMENTS] = map->len;
+
+    for (int f = 0; f < count; f++) {
+        for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+            for (const SymbolBucket *cur = files[f].symbol_table->buckets[i]; cur != NULL; cur = cur->next) {
+                Symbol symbol = cur->item;
+                if (symbol.binding != GLOBAL || symbol.segment == UNDEF || st_get_symbol(&map->owners, symbol.name) != NULL) continue;
+                symbol.offset = (uint32_t) um_find(map, f, symbol.segment, symbol.offset);
+                if (st_add_struct(&map->owners, symbol) == 0) {
+                    free(starts);
+                    return 0;
+                }
+            }
         }
-        // Open file
-        struct FileHeader header;
-        FILE *f = open_object_file(object_files[file_index], &final_header, &header);
-        if (f == NULL) {
-            for (int i = 0; i < file_index; i++) {
-                file_destroy(&source_files[i]);
+    }
+    free(starts);
+    return 1;
+
+    _um_failed:
+    raise_error(MEM, NULL, __FILE__);
+    free(starts);
+    return 0;
+}
+
+void um_destroy(UnitMap *map) {
+    free(map->list);
+    free(map->first);
+    st_destroy(&map->owners);
+}
+
+/*
+Indexes each file's relocations by the unit they are in: the relocations of unit u are
+files[unit u's file].relocation_table->list[edges[i]] for i in edge_first[u]..edge_first[u+1]
+*/
+int um_relocations(const UnitMap *map, const SourceFile *files, const int count, size_t **edge_first, size_t **edges) {
+    size_t relocations = 0;
+    for (int f = 0; f < count; f++) {
+        relocations += files[f].relocation_table->len;
+    }
+    size_t *firsts = calloc(map->len + 1, sizeof(size_t));
+    size_t *list = malloc(sizeof(size_t) * (relocations + 1));
+    size_t *next = malloc(sizeof(size_t) * (map->len + 1)); // next free slot of each unit
+    if (firsts == NULL || list == NULL || next == NULL) {
+        free(firsts);
+        free(list);
+        free(next);
+        raise_error(MEM, NULL, __FILE__);
+        return 0;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (int f = 0; f < count; f++) {
+            const RelocationTable *table = files[f].relocation_table;
+            for (size_t i = 0; i < table->len; i++) {
+                const size_t u = um_find(map, f, table->list[i].segment, table->list[i].target_offset);
+                if (u == SIZE_MAX) continue;
+                if (pass == 0) firsts[u+1]++;
+                else list[next[u]++] = i;
+            }
+        }
+        if (pass == 0) {
+            for (size_t u = 0; u < map->len; u++) {
+                firsts[u+1] += firsts[u];
+                next[u] = firsts[u];
             }
-            return 0;
         }
+    }
+    free(next);
+    *edge_first = firsts;
+    *edges = list;
+    return 1;
+}
 
-        // Load file
-        SourceFile file;
-        file_init(&file, text_offset, data_offset, header.text_size, header.data_size);
-        load_file(f, &file, &header, &global_symbols);
-        source_files[file_index] = file;
-        fclose(f);
+// Whether the text unit ends with `j` or `jr` (before its delay slot, and the nops that align what follows),
+// so execution cannot fall through into the next one
+int ends_with_jump(const SourceFile *file, const LinkUnit *unit) {
+    const uint32_t back = (file->flags & FILE_DELAY_SLOTS) ? 8 : 4;
+    uint32_t end = unit->end;
+    const uint32_t aligned = aligns_up_to(file, end);
+    if (aligned > 0 && file->aligns[aligned-1].offset == end && file->aligns[aligned-1].pad <= end - unit->start) end -= file->aligns[aligned-1].pad;
+    if (end - unit->start < back) return 0;
+    const uint32_t word = file->text[(end - back)/4];
+    return word >> 26 == 0x02 || (word >> 26 == 0 && (word & 0x3F) == 0x08);
+}
+
+// Removes the file's dead units, with the symbols defined in them and their relocations, and moves what follows them
+// Data keeps its offset modulo 8, so that aligned data stays aligned
+int compact_file(SourceFile *file, UnitMap *map, const int f) {
+    for (int s = 0; s < UNIT_SEGMENTS; s++) {
+        const enum Segment segment = UNIT_SEGMENT_LIST[s];
+        uint8_t *bytes = segment_bytes(file, segment);
+        uint32_t cursor = 0;
+        for (size_t u = map->first[f * UNIT_SEGMENTS + s]; u < map->first[f * UNIT_SEGMENTS + s + 1]; u++) {
+            LinkUnit *unit = &map->list[u];
+            if (!unit->live) continue;
+            unit->new_start = cursor + ((unit->start - cursor) & (segment == TEXT ? 3 : 7));
+            memset(bytes + cursor, 0, unit->new_start - cursor);
+            memmove(bytes + unit->new_start, bytes + unit->start, unit->end - unit->start);
+            cursor = unit->new_start + unit->end - unit->start;
+        }
+        if (segment == TEXT) file->text_size = cursor;
+        else if (segment == DATA) file->data_size = cursor;
+        else file->sdata_size = cursor;
     }
 
-    // If entry is __start, link __start.o
-    SourceFile start;
-    int link_start = 0;
-    if (entry_symbol != NULL && strcmp(entry_symbol, "__start") == 0) {
-        link_start = 1;
-        struct FileHeader header;
-        const uint32_t text_offset = final_header.text_size;
-        const uint32_t data_offset = final_header.data_size;
-        FILE *f = open_object_file("__start.o", &final_header, &header);
-        if (f == NULL) goto _link_failed;
+    // Aligned offsets move with their unit, with the nops before them that are kept; realign_text() resizes them
+    uint32_t kept_aligns = 0;
+    for (uint32_t i = 0; i < file->align_count; i++) {
+        TextAlign aligned = file->aligns[i];
+        const size_t u = um_find(map, f, TEXT, aligned.offset);
+        if (u == SIZE_MAX || !map->list[u].live) continue;
+        const uint32_t pad_start = aligned.offset - aligned.pad;
+        uint32_t pad = 0;
+        for (size_t p = u + 1; p-- > map->first[f * UNIT_SEGMENTS] && map->list[p].end > pad_start;) {
+            const uint32_t low = map->list[p].start > pad_start ? map->list[p].start : pad_start;
+            const uint32_t high = map->list[p].end < aligned.offset ? map->list[p].end : aligned.offset;
+            if (map->list[p].live && high > low) pad += high - low;
+        }
+        aligned.offset = map->list[u].new_start + aligned.offset - map->list[u].start;
+        aligned.pad = pad;
+        file->aligns[kept_aligns++] = aligned;
+    }
+    file->align_count = kept_aligns;
 
-        file_init(&start, text_offset, data_offset, header.text_size, header.data_size);
-        load_file(f, &start, &header, &global_symbols);
-        fclose(f);
+    // Named sections start at their first unit that is kept, or at the end of the text if none is
+    for (uint32_t i = 0; i < file->section_count; i++) {
+        uint32_t offset = file->text_size;
+        for (size_t u = map->first[f * UNIT_SEGMENTS]; u < map->first[f * UNIT_SEGMENTS + 1]; u++) {
+            if (map->list[u].live && map->list[u].start >= file->sections[i].offset) {
+                offset = map->list[u].new_start;
+                break;
+            }
+        }
+        file->sections[i].offset = offset;
     }
 
-    /*
-    In each relocation table,
-    resolve each relocation
-    */
-    for (int file_index = 0; file_index < file_count; file_index++) {
-        file_relocation(&source_files[file_index], &global_symbols);
+    // Read-only strings move with their unit; one that ends its unit keeps the zeros that now follow it
+    uint32_t kept_strings = 0;
+    for (uint32_t i = 0; i < file->string_count; i++) {
+        DataString string = file->strings[i];
+        const size_t u = um_find(map, f, DATA, string.offset);
+        if (u == SIZE_MAX || !map->list[u].live) continue;
+        const LinkUnit *unit = &map->list[u];
+        const int ends_unit = string.offset + string.size == unit->end;
+        string.offset = unit->new_start + string.offset - unit->start;
+        if (ends_unit) {
+            uint32_t end = file->data_size;
+            for (size_t next = u + 1; next < map->first[f * UNIT_SEGMENTS + unit_segment_index(DATA) + 1]; next++) {
+                if (map->list[next].live) {
+                    end = map->list[next].new_start;
+                    break;
+                }
+            }
+            string.size = end - string.offset;
+        }
+        file->strings[kept_strings++] = string;
+    }
+    file->string_count = kept_strings;
+
+    // Symbols
+    SymbolTable symbols;
+    if (st_init(&symbols) == 0) return 0;
+    for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+        for (const SymbolBucket *cur = file->symbol_table->buckets[i]; cur != NULL; cur = cur->next) {
+            Symbol symbol = cur->item;
+            if (symbol.segment != UNDEF) {
+                const size_t u = um_find(map, f, symbol.segment, symbol.offset);
+                if (u == SIZE_MAX || !map->list[u].live) continue;
+                symbol.offset = map->list[u].new_start + symbol.offset - map->list[u].start;
+            }
+            if (st_add_struct(&symbols, symbol) == 0) {
+                st_destroy(&symbols);
+                return 0;
+            }
+        }
     }
-    if (link_start) {
-        file_relocation(&start, &global_symbols);
+    st_destroy(file->symbol_table);
+    *file->symbol_table = symbols;
+
+    // Relocations
+    RelocationTable *table = file->relocation_table;
+    size_t kept = 0;
+    for (size_t i = 0; i < table->len; i++) {
+        RelocationEntry entry = table->list[i];
+        const size_t u = um_find(map, f, entry.segment, entry.target_offset);
+        if (u == SIZE_MAX || !map->list[u].live) continue;
+        entry.target_offset = map->list[u].new_start + entry.target_offset - map->list[u].start;
+        table->list[kept++] = entry;
     }
+    table->len = kept;
+    return 1;
+}
 
-    // Determine entry
+// Compacts every file; returns the number of bytes removed, or -1 on failure
+int64_t compact_files(SourceFile *files, const int count, UnitMap *map) {
+    int64_t removed = 0;
+    for (int f = 0; f < count; f++) {
+        const uint32_t size = files[f].text_size + files[f].data_size + files[f].sdata_size;
+        if (compact_file(&files[f], map, f) == 0 || realign_text(&files[f]) == 0) return -1;
+        removed += size - (files[f].text_size + files[f].data_size + files[f].sdata_size);
+    }
+    return removed;
+}
+
+// Places each object's segments right after the previous one's, once their sizes changed
+void place_objects(SourceFile *files, const int count, struct FileHeader *header) {
+    header->text_size = 0;
+    header->data_size = 0;
+    header->sdata_size = 0;
+    for (int f = 0; f < count; f++) {
+        files[f].text_offset = align_up(header->text_size, text_alignment(&files[f]));
+        files[f].data_offset = header->data_size;
+        files[f].sdata_offset = header->sdata_size;
+        header->text_size = files[f].text_offset + files[f].text_size;
+        header->data_size += files[f].data_size;
+        header->sdata_size += files[f].sdata_size;
+    }
+}
+
+/* === GARBAGE COLLECTION === */
+
+/*
+Removes the code and data that execution cannot reach from the entry (the first instruction if entry_symbol is NULL)
+A unit is reachable if a relocation in a reachable unit refers to a symbol in it, or, for text,
+if execution can fall through into it from the unit before
+Returns the number of bytes removed, or -1 on failure
+*/
+int64_t collect_garbage(SourceFile *files, const int count, const char *entry_symbol) {
+    UnitMap map;
+    size_t *edge_first = NULL, *edges = NULL, *stack = NULL;
+    int64_t removed = -1;
+    if (um_init(&map, files, count, 0) == 0 || um_relocations(&map, files, count, &edge_first, &edges) == 0) goto _gc_failed;
+    stack = malloc(sizeof(size_t) * (map.len + 1));
+    if (stack == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        goto _gc_failed;
+    }
+    for (size_t u = 0; u < map.len; u++) {
+        map.list[u].live = 0;
+    }
+
+    // Mark the units reachable from the entry
+    size_t top = 0;
     if (entry_symbol == NULL) {
-        final_header.entry = TEXT_START;
+        for (size_t u = 0; u < map.len; u++) {
+            if (map.list[u].segment == TEXT && map.list[u].end > map.list[u].start) {
+                map.list[u].live = 1;
+                stack[top++] = u;
+                break;
+            }
+        }
     } else {
-        final_header.entry = st_get_symbol_safe(&global_symbols, entry_symbol)->offset;
+        const Symbol *entry = st_get_symbol(&map.owners, entry_symbol);
+        if (entry != NULL) {
+            map.list[entry->offset].live = 1;
+            stack[top++] = entry->offset;
+        }
     }
+    while (top > 0) {
+        const size_t u = stack[--top];
+        const int f = map.list[u].file;
 
-    /*
-    Build file by combining text and data segments
-    */
-    FILE *out = fopen(out_path, "wb");
-    if (out == NULL) {
-        raise_error(FILE_IO, out_path, __FILE__);
-        goto _link_failed;
+        // Fall through into the next text unit
+        if (map.list[u].segment == TEXT && u + 1 < map.first[f * UNIT_SEGMENTS + 1] && !map.list[u+1].live && !ends_with_jump(&files[f], &map.list[u])) {
+            map.list[u+1].live = 1;
+            stack[top++] = u + 1;
+        }
+
+        for (size_t e = edge_first[u]; e < edge_first[u+1]; e++) {
+            uint32_t offset;
+            const size_t target = um_target(&map, files, f, files[f].relocation_table->list[edges[e]].dependency, &offset);
+            if (target != SIZE_MAX && !map.list[target].live) {
+                map.list[target].live = 1;
+                stack[top++] = target;
+            }
+        }
     }
-    fwrite(&final_header, sizeof(struct FileHeader), 1, out);
-    for (int file_index = 0; file_index < file_count; file_index++) {
-        // Write text segment
-        fwrite(source_files[file_index].text, sizeof(uint32_t), source_files[file_index].text_size/4, out);
+
+    removed = compact_files(files, count, &map);
+
+    _gc_failed:
+    um_destroy(&map);
+    free(edge_first);
+    free(edges);
+    free(stack);
+    return removed;
+}
+
+/* === IDENTICAL CODE FOLDING === */
+
+// Returns the unit that the unit was folded into, or the unit itself
+size_t fold_root(const size_t *folded, size_t u) {
+    while (folded[u] != u) u = folded[u];
+    return u;
+}
+
+// Whether the data from start to end is exactly one read-only string recorded by the assembler, with the padding after it
+int is_rodata_string(const SourceFile *file, const uint32_t start, const uint32_t end) {
+    uint32_t low = 0, high = file->string_count;
+    while (low < high) {
+        const uint32_t middle = low + (high - low)/2;
+        if (file->strings[middle].offset < start) low = middle + 1;
+        else high = middle;
     }
-    if (link_start) {
-        fwrite(start.text, sizeof(uint32_t), start.text_size/4, out);
+    return low < file->string_count && file->strings[low].offset == start && file->strings[low].offset + file->strings[low].size == end;
+}
+
+/*
+Sets sig to the signature of the unit, which is the same for units that can replace each other:
+  - for text, its words with the fields of its relocations masked, then the offset, type and target of each relocation,
+    where the target is the unit it is in (once folded), or the unit itself, and the offset in it
+  - for data, the string it holds (characters and terminating NUL), if it is one read-only string (see is_rodata_string())
+    that holds nothing else but up to 3 bytes of zeros
+Returns the length of the signature in words, or 0 if the unit cannot be folded
+*/
+size_t unit_signature(const UnitMap *map, const SourceFile *files, const size_t u, const size_t *folded,
+                      const size_t *edge_first, const size_t *edges, uint64_t *sig) {
+    const LinkUnit *unit = &map->list[u];
+    const SourceFile *file = &files[unit->file];
+    const uint32_t size = unit->end - unit->start;
+    if (!unit->labeled || size == 0) return 0;
+
+    if (unit->segment != TEXT) {
+        if (unit->segment != DATA || !is_rodata_string(file, unit->start, unit->end)) return 0;
+        const uint8_t *bytes = segment_bytes(file, unit->segment) + unit->start;
+        const uint8_t *nul = memchr(bytes, 0, size);
+        if (edge_first[u] != edge_first[u+1] || nul == NULL || nul == bytes) return 0;
+        const uint32_t length = (uint32_t) (nul - bytes) + 1;
+        for (uint32_t i = length; i < size; i++) {
+            if (bytes[i] != 0) return 0;
+        }
+        if (size - length >= 4) return 0;
+        sig[0] = unit->segment;
+        for (uint32_t i = 0; i < length; i++) {
+            sig[1 + i] = bytes[i];
+        }
+        return 1 + length;
     }
-    for (int file_index = 0; file_index < file_count; file_index++) {
-        // Write data segment
-        fwrite(source_files[file_index].data, sizeof(uint8_t), source_files[file_index].data_size, out);
+
+    // Execution must not fall through into or out of the unit
+    const size_t first = map->first[unit->file * UNIT_SEGMENTS];
+    if (!ends_with_jump(file, unit) || (u > first && !ends_with_jump(file, &map->list[u-1]))) return 0;
+
+    size_t len = 0;
+    sig[len++] = size;
+    for (uint32_t i = 0; i < size/4; i++) {
+        sig[len++] = file->text[unit->start/4 + i];
     }
-    if (link_start) {
-        fwrite(start.data, sizeof(uint8_t), start.data_size, out);
+    for (size_t e = edge_first[u]; e < edge_first[u+1]; e++) {
+        const RelocationEntry *entry = &file->relocation_table->list[edges[e]];
+        uint32_t offset;
+        const size_t target = um_target(map, files, unit->file, entry->dependency, &offset);
+        if (target == SIZE_MAX) return 0;
+        sig[1 + (entry->target_offset - unit->start)/4] &= entry->reloc_type == R_26 ? 0xFC000000 : 0xFFFF0000;
+        sig[len++] = entry->target_offset - unit->start;
+        sig[len++] = entry->reloc_type;
+        sig[len++] = target == u ? SIZE_MAX : fold_root(folded, target);
+        sig[len++] = offset - map->list[target].start;
     }
-    fclose(out);
+    return len;
+}
 
-    for (int file_index = 0; file_index < file_count; file_index++) {
-        file_destroy(&source_files[file_index]);
+// Whether the global symbols defined in the unit can move to the file of the unit it is folded into
+int can_forward(const UnitMap *map, const SourceFile *files, const size_t u, const size_t into) {
+    const int f = map->list[u].file;
+    const SymbolTable *target = files[map->list[into].file].symbol_table;
+    if (map->list[into].file == f) return 1;
+    for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+        for (const SymbolBucket *cur = files[f].symbol_table->buckets[i]; cur != NULL; cur = cur->next) {
+            const Symbol *symbol = &cur->item;
+            if (symbol->binding != GLOBAL || symbol->segment == UNDEF || um_find(map, f, symbol->segment, symbol->offset) != u) continue;
+            const Symbol *existing = st_get_symbol(target, symbol->name);
+            if (existing != NULL && existing->segment != UNDEF) return 0;
+        }
     }
-    if (link_start) file_destroy(&start);
-
     return 1;
+}
 
-    _link_failed:
-    for (int file_index = 0; file_index < file_count; file_index++) {
-        file_destroy(&source_files[file_index]);
-    }
-    return 0;
+/*
+Moves the symbols defined in each folded unit to the same offset in the unit it was folded into
+Global symbols move to that unit's object; local ones that the rest of their object refers to are renamed,
+in that object's relocations, to new global symbols defined there
+*/
+int forward_symbols(SourceFile *files, const int count, const UnitMap *map, const size_t *folded) {
+    uint32_t fresh = 0;
+    for (int f = 0; f < count; f++) {
+        for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+            for (SymbolBucket *cur = files[f].symbol_table->buckets[i]; cur != NULL; cur = cur->next) {
+                Symbol *symbol = &cur->item;
+                if (symbol->segment == UNDEF) continue;
+                const size_t u = um_find(map, f, symbol->segment, symbol->offset);
+                if (u == SIZE_MAX || map->list[u].live) continue;
+                const LinkUnit *into = &map->list[fold_root(folded, u)];
+                const uint32_t offset = into->start + symbol->offset - map->list[u].start;
+                if (into->file == f) {
+                    symbol->offset = offset;
+                } else if (symbol->binding == GLOBAL) {
+                    if (st_add_symbol(files[into->file].symbol_table, symbol->name, offset, symbol->segment, GLOBAL) == 0) return 0;
+                    symbol->segment = UNDEF;
+                }
+            }
+        }
+
+        SymbolTable renames; // local symbols renamed, with the number of their new name as offset
+        if (st_init(&renames) == 0) return 0;
+        RelocationTable *table = files[f].relocation_table;
+        for (size_t i = 0; i < table->len; i++) {
+            RelocationEntry *entry = &table->list[i];
+            const size_t site = um_find(map, f, entry->segment, entry->target_offset);
+            if (site == SIZE_MAX || !map->list[site].live) continue;
+            const Symbol *symbol = st_get_symbol(files[f].symbol_table, entry->dependency);
+            if (symbol == NULL || symbol->segment == UNDEF) continue;
+            const size_t u = um_find(map, f, symbol->segment, symbol->offset);
+            if (u == SIZE_MAX || map->list[u].live) continue;
+
+            char name[SYMBOL_SIZE];
+            const Symbol *renamed = st_get_symbol(&renames, entry->dependency);
+            if (renamed != NULL) {
+                snprintf(name, sizeof(name), "$icf%u", renamed->offset);
+            } else {
+                const LinkUnit *into = &map->list[fold_root(folded, u)];
+                snprintf(name, sizeof(name), "$icf%u", fresh);
+                if (st_add_symbol(&renames, entry->dependency, fresh++, UNDEF, LOCAL) == 0
+                    || st_add_symbol(files[into->file].symbol_table, name, into->start + symbol->offset - map->list[u].start, symbol->segment, GLOBAL) == 0
+                    || st_add_symbol(files[f].symbol_table, name, 0, UNDEF, GLOBAL) == 0) {
+                    st_destroy(&renames);
+                    return 0;
+                }
+            }
+            strcpy(entry->dependency, name);
+        }
+        st_destroy(&renames);
+    }
+    return 1;
+}
+
+/*
+Folds the text units that are identical, down to the targets of their relocations, into the first of them,
+and merges the data units that hold the same read-only string
+Text is compared again after each round of folding, since units that refer to folded units may have become identical
+*/
+int fold_identical(SourceFile *files, const int count) {
+    UnitMap map;
+    size_t *edge_first = NULL, *edges = NULL, *folded = NULL, *slots = NULL;
+    uint64_t *sigs = NULL;
+    size_t *sig_start = NULL;
+    int success = 0;
+    if (um_init(&map, files, count, 1) == 0 || um_relocations(&map, files, count, &edge_first, &edges) == 0) goto _fold_failed;
+
+    // Signatures take at most a word per byte of the unit, and 4 per relocation, plus 2
+    size_t sig_cap = 0;
+    for (int f = 0; f < count; f++) {
+        sig_cap += files[f].text_size + files[f].data_size + files[f].sdata_size + 4 * files[f].relocation_table->len;
+    }
+    size_t slot_count = 1;
+    while (slot_count < 2 * map.len) slot_count *= 2;
+    folded = malloc(sizeof(size_t) * (map.len + 1));
+    sig_start = malloc(sizeof(size_t) * (map.len + 1));
+    sigs = malloc(sizeof(uint64_t) * (sig_cap + 2 * map.len + 1));
+    slots = malloc(sizeof(size_t) * slot_count); // units by the hash of their signature, SIZE_MAX if empty
+    if (folded == NULL || sig_start == NULL || sigs == NULL || slots == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        goto _fold_failed;
+    }
+    for (size_t u = 0; u < map.len; u++) {
+        folded[u] = u;
+    }
+
+    uint64_t code_saved = 0, strings_saved = 0;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        size_t next = 0;
+        for (size_t k = 0; k < slot_count; k++) {
+            slots[k] = SIZE_MAX;
+        }
+        for (size_t u = 0; u < map.len; u++) {
+            sig_start[u] = next;
+            if (!map.list[u].live) continue;
+            const size_t len = unit_signature(&map, files, u, folded, edge_first, edges, &sigs[next]);
+            if (len == 0) continue;
+            const uint64_t hash = hash_bytes(&sigs[next], len * sizeof(uint64_t), HASH_BYTES_INIT);
+
+            size_t k = hash & (slot_count - 1);
+            for (; slots[k] != SIZE_MAX; k = (k + 1) & (slot_count - 1)) {
+                const size_t other = slots[k];
+                const size_t other_len = sig_start[other + 1] - sig_start[other];
+                if (other_len == len && memcmp(&sigs[sig_start[other]], &sigs[next], len * sizeof(uint64_t)) == 0) break;
+            }
+            if (slots[k] != SIZE_MAX && can_forward(&map, files, u, slots[k])) {
+                folded[u] = slots[k];
+                map.list[u].live = 0;
+                if (map.list[u].segment == TEXT) code_saved += map.list[u].end - map.list[u].start;
+                else strings_saved += map.list[u].end - map.list[u].start;
+                changed = 1;
+                continue;
+            }
+            if (slots[k] == SIZE_MAX) slots[k] = u;
+            next += len;
+            sig_start[u + 1] = next;
+        }
+    }
+    STATS_ADD(COUNT_ICF_FOLDED, code_saved);
+    STATS_ADD(COUNT_STRINGS_MERGED, strings_saved);
+
+    success = forward_symbols(files, count, &map, folded) && compact_files(files, count, &map) >= 0;
+
+    _fold_failed:
+    um_destroy(&map);
+    free(edge_first);
+    free(edges);
+    free(folded);
+    free(sig_start);
+    free(sigs);
+    free(slots);
+    return success;
+}
+
+/* === RELAXATION === */
+
+// Sets the final address and segment of a symbol the file refers to; returns 0 if it is not defined
+int dependency_address(const SourceFile *file, const char *name, const SymbolTable *global_symbols, uint32_t *address, enum Segment *segment) {
+    const Symbol *symbol = st_get_symbol(file->symbol_table, name);
+    if (symbol == NULL) return 0;
+    if (symbol->segment != UNDEF) {
+        *address = symbol_address(file, *symbol);
+        *segment = symbol->segment;
+        return 1;
+    }
+    symbol = st_get_symbol(global_symbols, name);
+    if (symbol == NULL) return 0;
+    *address = symbol->offset;
+    *segment = symbol->segment;
+    return 1;
+}
+
+// Number of offsets in the sorted list that are below `offset`
+uint32_t count_below(const uint32_t *offsets, const uint32_t count, const uint32_t offset) {
+    uint32_t low = 0, high = count;
+    while (low < high) {
+        const uint32_t middle = low + (high - low) / 2;
+        if (offsets[middle] < offset) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+// Removes the text words at the given sorted offsets, with their relocations, and moves the text symbols and relocations after them
+void remove_words(SourceFile *file, const uint32_t *removed, const uint32_t count) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0, r = 0; i < file->text_size/4; i++) {
+        if (r < count && removed[r] == 4*i) {
+            r++;
+            continue;
+        }
+        file->text[kept++] = file->text[i];
+    }
+    file->text_size = 4*kept;
+
+    RelocationTable *table = file->relocation_table;
+    size_t kept_entries = 0;
+    for (size_t i = 0; i < table->len; i++) {
+        RelocationEntry entry = table->list[i];
+        if (entry.segment == TEXT) {
+            const uint32_t before = count_below(removed, count, entry.target_offset);
+            if (before < count && removed[before] == entry.target_offset) continue;
+            entry.target_offset -= 4*before;
+        }
+        table->list[kept_entries++] = entry;
+    }
+    table->len = kept_entries;
+
+    for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+        for (SymbolBucket *cur = file->symbol_table->buckets[i]; cur != NULL; cur = cur->next) {
+            if (cur->item.segment == TEXT) cur->item.offset -= 4*count_below(removed, count, cur->item.offset);
+        }
+    }
+    for (uint32_t i = 0; i < file->section_count; i++) {
+        file->sections[i].offset -= 4*count_below(removed, count, file->sections[i].offset);
+    }
+    for (uint32_t i = 0; i < file->align_count; i++) {
+        file->aligns[i].offset -= 4*count_below(removed, count, file->aligns[i].offset);
+    }
+}
+
+/*
+Shortens each `la` of an address in the data segment, `lui $at %hi(label)` followed by `ori $R $at %lo(label)`, to one instruction:
+    - `addiu $R $gp %gp(label)` if use_gp is set and the address is within reach of $gp (unless $R is $gp, which is being set up)
+    - `lui $R %hi(label)` if the low half of the address is zero
+Only data addresses are considered, since they do not depend on the size of the text segment
+The code after aligned offsets is then aligned again (see realign_text())
+Returns the number of bytes of instructions removed from the file's text, or -1 on failure
+*/
+int64_t relax_file(SourceFile *file, const SymbolTable *global_symbols, const int use_gp) {
+    RelocationTable *table = file->relocation_table;
+    uint32_t *removed = malloc(sizeof(uint32_t) * (table->len / 2 + 1));
+    if (removed == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        return -1;
+    }
+    uint32_t count = 0;
+
+    for (size_t i = 0; i + 1 < table->len; i++) {
+        RelocationEntry *hi = &table->list[i];
+        const RelocationEntry *lo = &table->list[i+1];
+        if (hi->segment != TEXT || hi->reloc_type != R_HI16 || lo->segment != TEXT || lo->reloc_type != R_LO16) continue;
+        if (lo->target_offset != hi->target_offset + 4 || strcmp(hi->dependency, lo->dependency) != 0) continue;
+
+        // lui $at, then ori from $at
+        const uint32_t lui = file->text[hi->target_offset/4];
+        const uint32_t ori = file->text[lo->target_offset/4];
+        if (lui >> 26 != 0x0F || (lui >> 16 & 0x1F) != 1 || ori >> 26 != 0x0D || (ori >> 21 & 0x1F) != 1) continue;
+
+        uint32_t address;
+        enum Segment segment;
+        if (dependency_address(file, hi->dependency, global_symbols, &address, &segment) == 0) continue;
+        if (segment != DATA && segment != SDATA) continue;
+
+        const uint32_t rt = ori >> 16 & 0x1F;
+        const int32_t gp_offset = (int32_t) (address - GP_ADDRESS);
+        if (use_gp && rt != GP_REGISTER && gp_offset >= INT16_MIN && gp_offset <= INT16_MAX) {
+            file->text[hi->target_offset/4] = 0x09u << 26 | GP_REGISTER << 21 | rt << 16;
+            hi->reloc_type = R_GP16;
+        } else if ((address & 0xFFFF) == 0) {
+            file->text[hi->target_offset/4] = 0x0Fu << 26 | rt << 16;
+        } else {
+            continue;
+        }
+        removed[count++] = lo->target_offset;
+        i++;
+    }
+
+    if (count > 0) remove_words(file, removed, count);
+    free(removed);
+    if (count > 0 && realign_text(file) == 0) return -1;
+    return 4 * (int64_t) count;
+}
+
+/* === BRANCH RELAXATION === */
+
+// Whether the conditional branch at the relocation cannot reach its target; 0 if the target is undefined
+int branch_out_of_range(const SourceFile *file, const RelocationEntry *entry, const SymbolTable *global_symbols) {
+    uint32_t address;
+    enum Segment segment;
+    if (entry->segment != TEXT || entry->reloc_type != R_PC16) return 0;
+    if (dependency_address(file, entry->dependency, global_symbols, &address, &segment) == 0) return 0;
+    const int64_t distance = ((int64_t) address - (int64_t) (text_address(file, entry->target_offset) + 4)) / 4;
+    return distance < INT16_MIN || distance > INT16_MAX;
+}
+
+int needs_branch_relaxation(const SourceFile *file, const SymbolTable *global_symbols) {
+    for (size_t i = 0; i < file->relocation_table->len; i++) {
+        if (branch_out_of_range(file, &file->relocation_table->list[i], global_symbols)) return 1;
+    }
+    return 0;
+}
+
+/*
+Rewrites each conditional branch of the file that cannot reach its target into an inverted branch around a jump:
+    beq $s $t label    ->    bne $s $t 1
+                             j label
+In objects with delay slots, the jump goes after the branch's delay slot and gets a nop as its own:
+    beq $s $t label    ->    bne $s $t 3
+    (slot)                   (slot)
+                             j label
+                             nop
+`beq $0 $0 label` (b) is always taken, so it becomes `j label` in place; the code after aligned offsets is then aligned again
+Returns the number of branches rewritten, or -1 on failure
+*/
+int relax_branches(SourceFile *file, const SymbolTable *global_symbols) {
+    const int delay_slots = (file->flags & FILE_DELAY_SLOTS) != 0;
+    const uint32_t inserted = delay_slots ? 2 : 1; // words added after each rewritten branch
+    RelocationTable *table = file->relocation_table;
+
+    // Text relocations are in the order of their instructions, so the insertion points are sorted
+    uint32_t *points = malloc(sizeof(uint32_t) * (table->len + 1));
+    size_t *entries = malloc(sizeof(size_t) * (table->len + 1));
+    if (points == NULL || entries == NULL) {
+        free(points);
+        free(entries);
+        raise_error(MEM, NULL, __FILE__);
+        return -1;
+    }
+    uint32_t count = 0;
+    int rewritten = 0;
+    for (size_t i = 0; i < table->len; i++) {
+        RelocationEntry *entry = &table->list[i];
+        if (!branch_out_of_range(file, entry, global_symbols)) continue;
+        uint32_t *word = &file->text[entry->target_offset/4];
+        const uint32_t opcode = *word >> 26;
+        if (opcode != 0x04 && opcode != 0x05) continue; // reported when resolving
+
+        if (opcode == 0x04 && (*word >> 16 & 0x3FF) == 0) {
+            *word = 0x02u << 26;
+            entry->reloc_type = R_26;
+        } else {
+            *word = (*word ^ 1u << 26) & 0xFFFF0000; // beq <-> bne
+            *word |= 2 * inserted - 1;               // skip the jump, and the delay slots
+            points[count] = entry->target_offset + 4 * (1 + delay_slots);
+            entries[count++] = i;
+        }
+        rewritten++;
+    }
+
+    if (count > 0) {
+        const uint32_t text_size = file->text_size + 4 * inserted * count;
+        uint32_t *text = malloc(text_size);
+        if (text == NULL) {
+            free(points);
+            free(entries);
+            raise_error(MEM, NULL, __FILE__);
+            return -1;
+        }
+        uint32_t next = 0, p = 0;
+        for (uint32_t i = 0; i <= file->text_size/4; i++) {
+            for (; p < count && points[p] == 4*i; p++) {
+                text[next++] = 0x02u << 26; // j label
+                if (delay_slots) text[next++] = 0; // nop
+            }
+            if (i < file->text_size/4) text[next++] = file->text[i];
+        }
+        free(file->text);
+        file->text = text;
+        file->text_size = text_size;
+
+        // Move the code after each insertion point, then point the rewritten relocations at their jumps
+        for (size_t i = 0; i < table->len; i++) {
+            RelocationEntry *entry = &table->list[i];
+            if (entry->segment == TEXT) entry->target_offset += 4 * inserted * count_below(points, count, entry->target_offset + 1);
+        }
+        for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+            for (SymbolBucket *cur = file->symbol_table->buckets[i]; cur != NULL; cur = cur->next) {
+                if (cur->item.segment == TEXT) cur->item.offset += 4 * inserted * count_below(points, count, cur->item.offset + 1);
+            }
+        }
+        for (uint32_t i = 0; i < file->section_count; i++) {
+            file->sections[i].offset += 4 * inserted * count_below(points, count, file->sections[i].offset + 1);
+        }
+        for (uint32_t i = 0; i < file->align_count; i++) {
+            file->aligns[i].offset += 4 * inserted * count_below(points, count, file->aligns[i].offset + 1);
+        }
+        for (p = 0; p < count; p++) {
+            table->list[entries[p]].target_offset = points[p] + 4 * inserted * p;
+            table->list[entries[p]].reloc_type = R_26;
+        }
+    }
+
+    free(points);
+    free(entries);
+    if (count > 0 && realign_text(file) == 0) return -1;
+    return rewritten;
+}
+
+// Places each object's text after the previous one's and its padding, at its alignment, and recomputes the global symbols
+void place_text(SourceFile *files, const int count, const uint32_t padding, struct FileHeader *header, SymbolTable *global_symbols) {
+    header->text_size = 0;
+    for (int i = 0; i < count; i++) {
+        files[i].text_offset = align_up(header->text_size, text_alignment(&files[i]));
+        header->text_size = files[i].text_offset + files[i].text_size + padding;
+    }
+    rebuild_global_symbols(files, count, global_symbols);
+}
+
+/* === FUNCTION ORDERING === */
+
+typedef struct {
+    char name[SYMBOL_SIZE];
+    uint64_t count;
+    uint32_t line;
+} ProfileEntry;
+
+int compare_profile_entries(const void *a, const void *b) {
+    const ProfileEntry *x = a;
+    const ProfileEntry *y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+/*
+Reads the functions to place first into ranks, with their position in the order as offset:
+those listed in the symbol order file (a name per line) in that order, then those in the profile
+(a name and an execution count per line) by decreasing count, leaving out those that never ran
+Blank lines and lines starting with '#' are ignored; returns success
+*/
+int load_function_order(const char *order_path, const char *profile_path, SymbolTable *ranks) {
+    ProfileEntry *entries = NULL;
+    size_t len = 0, cap = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    int success = 1;
+
+    for (int profile = 0; success && profile < 2; profile++) {
+        const char *path = profile ? profile_path : order_path;
+        if (path == NULL) continue;
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+            general_error(FILE_IO, __FILE__, path);
+            success = 0;
+            break;
+        }
+        const size_t first = len;
+        uint32_t line_number = 0;
+        while (success && getline(&line, &line_size, f) != -1) {
+            line_number++;
+            char name[SYMBOL_SIZE];
+            unsigned long long count = 1;
+            char *c = line;
+            while (isspace(*c)) c++;
+            if (*c == '\0' || *c == '#') continue;
+            const int fields = profile ? sscanf(c, "%31s %llu", name, &count) : sscanf(c, "%31s", name);
+            if (fields != 1 + profile) {
+                fprintf(stderr, "Error linking: %s line %u: expected %s\n", path, line_number, profile ? "a symbol and a count" : "a symbol");
+                success = 0;
+                break;
+            }
+            if (count == 0) continue;
+
+            if (len >= cap) {
+                cap = cap == 0 ? 64 : 2 * cap;
+                ProfileEntry *grown = realloc(entries, sizeof(ProfileEntry) * cap);
+                if (grown == NULL) {
+                    raise_error(MEM, NULL, __FILE__);
+                    success = 0;
+                    break;
+                }
+                entries = grown;
+            }
+            strcpy(entries[len].name, name);
+            entries[len].count = count;
+            entries[len].line = line_number;
+            len++;
+        }
+        fclose(f);
+        if (profile) qsort(&entries[first], len - first, sizeof(ProfileEntry), compare_profile_entries);
+    }
+
+    for (size_t i = 0; success && i < len; i++) {
+        if (st_get_symbol(ranks, entries[i].name) != NULL) continue;
+        Symbol rank;
+        memset(&rank, 0, sizeof(rank));
+        strcpy(rank.name, entries[i].name);
+        rank.offset = (uint32_t) i;
+        rank.segment = TEXT;
+        rank.binding = GLOBAL;
+        success = st_add_struct(ranks, rank);
+    }
+    free(entries);
+    free(line);
+    return success;
+}
+
+// Number of named sections of the object's text that start at or before offset; 0 if it is in .text before them
+uint32_t text_section(const SourceFile *file, const uint32_t offset) {
+    uint32_t n = 0;
+    while (n < file->section_count && file->sections[n].offset <= offset) n++;
+    return n;
+}
+
+/*
+Where the blocks of a named text section are placed: .text.hot first, then .text and the other sections
+in the order they first appear (index), then .text.unlikely and .text.cold
+*/
+uint32_t section_group(const char *name, const uint32_t index) {
+    const uint32_t place = in_section(name, ".text.hot") ? 1 : in_section(name, ".text.unlikely") || in_section(name, ".text.cold") ? 3 : 2;
+    return place << 24 | index;
+}
+
+/*
+Splits each object's text into blocks: units (see --gc-sections), each joined with the unit after it if execution can fall
+through into it, and with the units of the same object that its branches go to, so that branches still reach their targets
+Units of different named sections are never joined: code must not fall through out of a section, and branches between
+sections are rewritten by relax_branches() if they end up out of range
+Returns the blocks by object and offset in *blocks, or 0 on failure
+*/
+int text_blocks(const SourceFile *files, const int count, TextBlock **blocks, size_t *len) {
+    UnitMap map;
+    size_t *edge_first = NULL, *edges = NULL, *reach = NULL;
+    int success = 0;
+    *blocks = NULL;
+    *len = 0;
+    if (um_init(&map, files, count, 0) == 0 || um_relocations(&map, files, count, &edge_first, &edges) == 0) goto _blocks_failed;
+    reach = malloc(sizeof(size_t) * (map.len + 1)); // last unit that each unit must be placed with
+    *blocks = malloc(sizeof(TextBlock) * (map.len + 1));
+    if (reach == NULL || *blocks == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        goto _blocks_failed;
+    }
+
+    for (int f = 0; f < count; f++) {
+        const size_t first = map.first[f * UNIT_SEGMENTS], last = map.first[f * UNIT_SEGMENTS + 1];
+        for (size_t u = first; u < last; u++) {
+            reach[u] = u + 1 < last && !ends_with_jump(&files[f], &map.list[u])
+                && text_section(&files[f], map.list[u+1].start) == text_section(&files[f], map.list[u].start) ? u + 1 : u;
+        }
+        for (size_t u = first; u < last; u++) {
+            for (size_t e = edge_first[u]; e < edge_first[u+1]; e++) {
+                const RelocationEntry *entry = &files[f].relocation_table->list[edges[e]];
+                if (entry->reloc_type != R_PC16) continue;
+                uint32_t offset;
+                const size_t target = um_target(&map, files, f, entry->dependency, &offset);
+                if (target == SIZE_MAX || map.list[target].file != f || map.list[target].segment != TEXT) continue;
+                if (text_section(&files[f], offset) != text_section(&files[f], map.list[u].start)) continue;
+                const size_t low = target < u ? target : u, high = target < u ? u : target;
+                if (reach[low] < high) reach[low] = high;
+            }
+        }
+        for (size_t u = first; u < last;) {
+            size_t end = reach[u];
+            for (size_t k = u; k <= end; k++) {
+                if (reach[k] > end) end = reach[k];
+            }
+            TextBlock *block = &(*blocks)[(*len)++];
+            block->file = f;
+            block->start = map.list[u].start;
+            block->end = map.list[end].end;
+            block->address = 0;
+            block->rank = UINT32_MAX;
+            block->group = 0;
+            u = end + 1;
+        }
+    }
+    success = 1;
+
+    _blocks_failed:
+    um_destroy(&map);
+    free(edge_first);
+    free(edges);
+    free(reach);
+    return success;
+}
+
+int compare_blocks(const void *a, const void *b) {
+    const TextBlock *x = *(const TextBlock * const *) a;
+    const TextBlock *y = *(const TextBlock * const *) b;
+    if (x->group != y->group) return x->group < y->group ? -1 : 1;
+    if (x->rank != y->rank) return x->rank < y->rank ? -1 : 1;
+    return (x > y) - (x < y); // Otherwise, by object and offset
+}
+
+/*
+Places the blocks of text grouped by named section (see section_group()), and in each group, those that define
+the functions in ranks first, in that order, then the others in their usual order
+If keep_first is set, the first instruction stays first (it is the entry)
+Sets each object's blocks, and returns the len blocks in the order they are placed in *order
+Returns the number of blocks placed by their rank, or -1 on failure
+*/
+int64_t order_text(SourceFile *files, const int count, const SymbolTable *ranks, const int keep_first,
+                   TextBlock **blocks, TextBlock ***order, size_t *len_out) {
+    size_t len;
+    *order = NULL;
+    if (text_blocks(files, count, blocks, &len) == 0) return -1;
+    *order = malloc(sizeof(TextBlock *) * (len + 1));
+    if (*order == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        return -1;
+    }
+    SymbolTable names; // Named sections, with the order they first appear in as offset
+    st_init(&names);
+
+    size_t next = 0; // first block of the next object
+    for (int f = 0; f < count; f++) {
+        const size_t first = next;
+        while (next < len && (*blocks)[next].file == f) next++;
+        files[f].blocks = &(*blocks)[first];
+        files[f].block_count = (uint32_t) (next - first);
+
+        for (size_t b = first; b < next; b++) {
+            const uint32_t section = text_section(&files[f], (*blocks)[b].start);
+            const char *name = section == 0 ? ".text" : files[f].sections[section-1].name;
+            const Symbol *seen = st_get_symbol(&names, name);
+            if (seen == NULL) {
+                Symbol entry;
+                memset(&entry, 0, sizeof(entry));
+                strcpy(entry.name, name);
+                entry.offset = names.size;
+                entry.segment = TEXT;
+                if (st_add_struct(&names, entry) == 0) {
+                    st_destroy(&names);
+                    return -1;
+                }
+                seen = st_get_symbol(&names, name);
+            }
+            (*blocks)[b].group = section_group(name, seen->offset);
+        }
+
+        for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+            for (const SymbolBucket *cur = files[f].symbol_table->buckets[i]; cur != NULL; cur = cur->next) {
+                if (cur->item.binding != GLOBAL || cur->item.segment != TEXT) continue;
+                const Symbol *rank = st_get_symbol(ranks, cur->item.name);
+                if (rank == NULL) continue;
+                size_t b = first;
+                while (b + 1 < next && (*blocks)[b+1].start <= cur->item.offset) b++;
+                if (rank->offset < (*blocks)[b].rank) (*blocks)[b].rank = rank->offset;
+            }
+        }
+    }
+    st_destroy(&names);
+
+    int64_t ordered = 0;
+    for (size_t b = 0; b < len; b++) {
+        (*order)[b] = &(*blocks)[b];
+        if ((*blocks)[b].rank != UINT32_MAX) ordered++;
+    }
+    if (keep_first) {
+        for (size_t b = 0; b < len; b++) {
+            (*blocks)[b].group = 0;
+            (*blocks)[b].rank = 0; // with the empty blocks before it
+            if ((*blocks)[b].end > (*blocks)[b].start) break;
+        }
+    }
+    qsort(*order, len, sizeof(TextBlock *), compare_blocks);
+
+    // A block keeps its offset modulo the alignment of the aligned offsets in it
+    uint32_t address = 0;
+    for (size_t b = 0; b < len; b++) {
+        TextBlock *block = (*order)[b];
+        const SourceFile *file = &files[block->file];
+        uint32_t align = 4;
+        for (uint32_t i = 0; i < file->align_count; i++) {
+            const TextAlign *aligned = &file->aligns[i];
+            if (aligned->offset >= block->start && aligned->offset < block->end && aligned->align > align) align = aligned->align;
+        }
+        address += (block->start - address) & (align - 1);
+        block->address = address;
+        address += block->end - block->start;
+    }
+    *len_out = len;
+    return ordered;
+}
+
+/* === INCREMENTAL LINKING === */
+
+// Writes the hash of the contents of the object at `index` to `hash`
+int hash_link_object(char *object_files[], const int file_count, const int index, const LinkOptions *options, uint64_t *hash) {
+    if (index >= file_count && options->start_path == NULL) {
+        *hash = hash_bytes(START_OBJECT, START_OBJECT_SIZE, HASH_BYTES_INIT);
+        return 1;
+    }
+
+    const char *path = link_object_name(object_files, file_count, index, options);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        raise_error(FILE_IO, path, __FILE__);
+        return 0;
+    }
+    uint8_t buf[4096];
+    size_t n;
+    *hash = HASH_BYTES_INIT;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        *hash = hash_bytes(buf, n, *hash);
+    }
+    fclose(f);
+    return 1;
+}
+
+// Records the global symbols a loaded object defines and the relocations it needs from other objects
+int record_link_object(LinkStateObject *object, const SourceFile *file, const SymbolTable *global_symbols) {
+    lso_clear(object);
+
+    for (int i = 0; i < SYMBOL_TABLE_SIZE; i++) {
+        const SymbolBucket *cur = file->symbol_table->buckets[i];
+        while (cur != NULL) {
+            if (cur->item.binding == GLOBAL && cur->item.segment != UNDEF) {
+                const Symbol *global = st_get_symbol(global_symbols, cur->item.name);
+                if (global == NULL || lso_add_global(object, *global) == 0) return 0;
+            }
+            cur = cur->next;
+        }
+    }
+
+    for (size_t i = 0; i < file->relocation_table->len; i++) {
+        const RelocationEntry entry = file->relocation_table->list[i];
+        const Symbol *dependency = st_get_symbol(file->symbol_table, entry.dependency);
+        if (dependency != NULL && dependency->segment == UNDEF) {
+            if (rt_add(&object->externals, entry) == 0) return 0;
+        }
+    }
+    return 1;
+}
+
+// A relocation site of an unchanged object, re-resolved before it is written to the executable
+typedef struct {
+    long location;
+    uint32_t word;
+} SitePatch;
+
+// Returns whether resolve_field() can resolve the site without its target being out of range
+int site_in_range(const RelocationEntry entry, const uint32_t instr_addr, const uint32_t final_address) {
+    switch (entry.reloc_type) {
+        case R_26:
+            return (instr_addr & 0xF0000000) == (final_address & 0xF0000000);
+        case R_PC16: {
+            const int32_t dist = ((int32_t) final_address - ((int32_t) instr_addr + 4))/4;
+            return dist >= INT16_MIN && dist <= INT16_MAX;
+        }
+        case R_GP16: {
+            const int32_t gp_offset = (int32_t) (final_address - GP_ADDRESS);
+            return gp_offset >= INT16_MIN && gp_offset <= INT16_MAX;
+        }
+        default:
+            return 1;
+    }
+}
+
+/*
+Re-resolves a relocation site of an unchanged object, reading its current word from the executable
+Returns 1 on success, 0 on failure, or -1 if the new address is out of range of the site
+*/
+int resolve_site(FILE *out, const struct FileHeader *header, const LinkStateObject *object, const RelocationEntry entry, const uint32_t final_address, SitePatch *patch) {
+    patch->location = sizeof(struct FileHeader) + entry.target_offset;
+    if (entry.segment == TEXT) patch->location += object->text_offset;
+    else if (entry.segment == SDATA) patch->location += header->text_size + object->sdata_offset;
+    else patch->location += header->text_size + object->data_offset;
+
+    const uint32_t instr_addr = TEXT_START + object->text_offset + entry.target_offset;
+    if (site_in_range(entry, instr_addr, final_address) == 0) return -1;
+
+    if (fseek(out, patch->location, SEEK_SET) != 0 || fread(&patch->word, sizeof(patch->word), 1, out) != 1) return 0;
+    return resolve_field(&patch->word, entry, instr_addr, final_address, object->name);
+}
+
+// Overwrites an object's slots in the executable with its relocated segments, padded with zeros
+int write_slots(FILE *out, const struct FileHeader *header, const LinkStateObject *object, const SourceFile *file) {
+    if (fseek(out, (long) (sizeof(struct FileHeader) + object->text_offset), SEEK_SET) != 0) return 0;
+    if (fwrite(file->text, sizeof(uint32_t), file->text_size/4, out) != file->text_size/4) return 0;
+    if (write_padding(out, object->text_slot - file->text_size) == 0) return 0;
+
+    if (fseek(out, (long) (sizeof(struct FileHeader) + header->text_size + object->sdata_offset), SEEK_SET) != 0) return 0;
+    if (fwrite(file->sdata, sizeof(uint8_t), file->sdata_size, out) != file->sdata_size) return 0;
+    if (write_padding(out, object->sdata_slot - file->sdata_size) == 0) return 0;
+
+    if (fseek(out, (long) (sizeof(struct FileHeader) + header->text_size + object->data_offset), SEEK_SET) != 0) return 0;
+    if (fwrite(file->data, sizeof(uint8_t), file->data_size, out) != file->data_size) return 0;
+    return write_padding(out, object->data_slot - file->data_size);
+}
+
+/*
+Relinks using the layout saved by the previous incremental link, patching only the objects whose contents
+changed and the relocation sites in other objects that refer to their global symbols.
+Returns 1 on success, 0 on failure, or -1 if the layout changed and a full link is needed.
+*/
+int link_incremental(const char *out_path, char *object_files[], const int file_count, const LinkOptions *options) {
+    char *state_path = ls_path(out_path);
+    if (state_path == NULL) return 0;
+
+    LinkState state;
+    if (ls_read(&state, state_path) == 0) {
+        free(state_path);
+        return -1;
+    }
+
+    const int link_start = options->entry_symbol != NULL && strcmp(options->entry_symbol, "__start") == 0;
+    const int object_count = file_count + link_start;
+    int result = -1;
+
+    uint64_t *hashes = malloc(object_count * sizeof(uint64_t));
+    int *changed = malloc(object_count * sizeof(int));
+    SourceFile *files = malloc(object_count * sizeof(SourceFile));
+    int loaded = 0;
+    if (hashes == NULL || changed == NULL || files == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        result = 0;
+        goto _incremental_done;
+    }
+
+    // The previous link must have had the same objects, in the same order, with the same options
+    const char *entry = options->entry_symbol != NULL ? options->entry_symbol : "";
+    if ((int) state.object_count != object_count || state.padding != options->padding || strcmp(state.entry, entry) != 0) {
+        goto _incremental_done;
+    }
+    for (int i = 0; i < object_count; i++) {
+        if (strcmp(state.objects[i].name, link_object_name(object_files, file_count, i, options)) != 0) {
+            goto _incremental_done;
+        }
+    }
+
+    // Find changed objects
+    int changed_count = 0;
+    for (int i = 0; i < object_count; i++) {
+        if (hash_link_object(object_files, file_count, i, options, &hashes[i]) == 0) {
+            result = 0;
+            goto _incremental_done;
+        }
+        changed[i] = hashes[i] != state.objects[i].hash;
+        changed_count += changed[i];
+    }
+    if (changed_count == 0) {
+        FILE *out = fopen(out_path, "rb");
+        if (out != NULL) {
+            fclose(out);
+            result = 1;
+        }
+        goto _incremental_done;
+    }
+
+    // Global symbols of unchanged objects keep their addresses
+    SymbolTable global_symbols;
+    st_init(&global_symbols);
+    for (int i = 0; i < object_count; i++) {
+        if (changed[i]) continue;
+        for (uint32_t j = 0; j < state.objects[i].global_count; j++) {
+            st_add_struct(&global_symbols, state.objects[i].globals[j]);
+        }
+    }
+
+    // Load changed objects into their previous slots
+    for (int i = 0; i < object_count; i++) {
+        if (!changed[i]) continue;
+        const LinkStateObject *object = &state.objects[i];
+        struct FileHeader header;
+        FILE *f = open_link_object(object_files, file_count, i, options, &header);
+        if (f == NULL) {
+            result = 0;
+            goto _incremental_unload;
+        }
+        if (header.text_size > object->text_slot || header.data_size > object->data_slot || header.sdata_size > object->sdata_slot) {
+            fclose(f);
+            goto _incremental_unload;
+        }
+        if (file_init(&files[loaded], &header, object->text_offset, object->data_offset, object->sdata_offset) == 0) {
+            fclose(f);
+            result = 0;
+            goto _incremental_unload;
+        }
+        files[loaded].name = object->name;
+        const int read = load_file(f, &files[loaded], &header);
+        fclose(f);
+        loaded++;
+        if (read == 0) {
+            result = 0;
+            goto _incremental_unload;
+        }
+        if (object->text_offset % text_alignment(&files[loaded-1]) != 0) goto _incremental_unload; // must move to stay aligned
+        add_global_symbols(&files[loaded-1], &global_symbols);
+    }
+    add_linker_symbols(&global_symbols);
+
+    // A changed object must define the same global symbols, though they may have moved
+    for (int i = 0, k = 0; i < object_count; i++) {
+        if (!changed[i]) continue;
+        const LinkStateObject *object = &state.objects[i];
+        uint32_t global_count = 0;
+        for (int j = 0; j < SYMBOL_TABLE_SIZE; j++) {
+            for (const SymbolBucket *cur = files[k].symbol_table->buckets[j]; cur != NULL; cur = cur->next) {
+                if (cur->item.binding == GLOBAL && cur->item.segment != UNDEF) global_count++;
+            }
+        }
+        if (global_count != object->global_count) goto _incremental_unload;
+        for (uint32_t j = 0; j < object->global_count; j++) {
+            const Symbol *symbol = st_get_symbol(files[k].symbol_table, object->globals[j].name);
+            if (symbol == NULL || symbol->binding != GLOBAL || symbol->segment == UNDEF) goto _incremental_unload;
+        }
+        k++;
+    }
+
+    // A branch that would need rewriting changes the object's size, which needs a full link
+    for (int k = 0; k < loaded; k++) {
+        if (needs_branch_relaxation(&files[k], &global_symbols)) goto _incremental_unload;
+    }
+
+    // Resolve the changed objects' relocations
+    for (int k = 0; k < loaded; k++) {
+        if (file_relocation(&files[k], &global_symbols) == 0) {
+            result = 0;
+            goto _incremental_unload;
+        }
+    }
+
+    // The executable must still have the recorded layout
+    FILE *out = fopen(out_path, "r+b");
+    if (out == NULL) goto _incremental_unload;
+    struct FileHeader header;
+    if (fread(&header, sizeof(header), 1, out) != 1 || header.text_size != state.header.text_size || header.data_size != state.header.data_size) {
+        fclose(out);
+        goto _incremental_unload;
+    }
+
+    // Resolve every relocation site in unchanged objects whose dependency moved before writing anything
+    SitePatch *patches = NULL;
+    size_t patch_count = 0, patch_cap = 0;
+    for (int i = 0; i < object_count; i++) {
+        if (!changed[i]) continue;
+        const LinkStateObject *object = &state.objects[i];
+        for (uint32_t j = 0; j < object->global_count; j++) {
+            const Symbol old = object->globals[j];
+            const Symbol *new = st_get_symbol(&global_symbols, old.name);
+            if (new->offset == old.offset) continue;
+
+            for (int m = 0; m < object_count; m++) {
+                if (changed[m]) continue;
+                const RelocationTable *externals = &state.objects[m].externals;
+                for (size_t n = 0; n < externals->len; n++) {
+                    if (strcmp(externals->list[n].dependency, old.name) != 0) continue;
+                    if (patch_count == patch_cap) {
+                        patch_cap = patch_cap == 0 ? 16 : patch_cap*2;
+                        SitePatch *grown = realloc(patches, patch_cap * sizeof(SitePatch));
+                        if (grown == NULL) {
+                            raise_error(MEM, NULL, __FILE__);
+                            result = 0;
+                            goto _incremental_close;
+                        }
+                        patches = grown;
+                    }
+                    const int resolved = resolve_site(out, &header, &state.objects[m], externals->list[n], new->offset, &patches[patch_count]);
+                    if (resolved != 1) {
+                        if (resolved == 0) fprintf(stderr, "Error linking %s: could not patch relocation\n", state.objects[m].name);
+                        result = resolved; // out of range: a full link lays the program out again
+                        goto _incremental_close;
+                    }
+                    patch_count++;
+                }
+            }
+        }
+    }
+
+    // Update the entry if it moved
+    if (options->entry_symbol != NULL) {
+        const Symbol *entry_sym = st_get_symbol(&global_symbols, options->entry_symbol);
+        if (entry_sym == NULL) goto _incremental_close; // reported by the full link
+        header.entry = entry_sym->offset;
+    }
+
+    // Record the new layout; the globals of changed objects were needed above to find the sites that moved
+    state.header = header;
+    for (int i = 0, k = 0; i < object_count; i++) {
+        if (!changed[i]) continue;
+        state.objects[i].hash = hashes[i];
+        if (record_link_object(&state.objects[i], &files[k], &global_symbols) == 0) {
+            result = 0;
+            goto _incremental_close;
+        }
+        k++;
+    }
+
+    // From here on the executable is modified; remove the state so a failure forces a full link next time
+    remove(state_path);
+    result = 0;
+
+    for (int i = 0, k = 0; i < object_count; i++) {
+        if (!changed[i]) continue;
+        if (write_slots(out, &header, &state.objects[i], &files[k]) == 0) {
+            raise_error(FILE_IO, out_path, __FILE__);
+            goto _incremental_close;
+        }
+        k++;
+    }
+    for (size_t n = 0; n < patch_count; n++) {
+        if (fseek(out, patches[n].location, SEEK_SET) != 0 || write_word(out, patches[n].word) == 0) {
+            raise_error(FILE_IO, out_path, __FILE__);
+            goto _incremental_close;
+        }
+    }
+    if (fseek(out, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, out) != 1) {
+        raise_error(FILE_IO, out_path, __FILE__);
+        goto _incremental_close;
+    }
+
+    if (ls_write(&state, state_path) == 0) goto _incremental_close;
+    result = 1;
+
+    _incremental_close:
+    free(patches);
+    if (fclose(out) != 0 && result == 1) {
+        raise_error(FILE_IO, out_path, __FILE__);
+        result = 0;
+    }
+
+    _incremental_unload:
+    for (int k = 0; k < loaded; k++) {
+        file_destroy(&files[k]);
+    }
+    st_destroy(&global_symbols);
+
+    _incremental_done:
+    free(hashes);
+    free(changed);
+    free(files);
+    ls_destroy(&state);
+    free(state_path);
+    return result;
+}
+
+/* === LINKER === */
+
+/*
+Links the object files into an executable at out_path
+If the entry symbol is __start, the startup object is also linked: options->start_path if given, otherwise the built-in one
+If options->incremental is set, the layout is saved next to the executable so the next link can patch it
+*/
+int link(const char *out_path, char *object_files[], int file_count, const LinkOptions *options) {
+    if (MEMORY_ENABLED) mem_reset();
+    if (options->incremental) {
+        const int success = link_incremental(out_path, object_files, file_count, options);
+        if (success == 1 && MEMORY_ENABLED) mem_print(stderr, "link", out_path);
+        if (success != -1) return success;
+    }
+
+    const int link_start = options->entry_symbol != NULL && strcmp(options->entry_symbol, "__start") == 0;
+    const int object_count = file_count + link_start;
+    const uint32_t padding = options->incremental ? options->padding : 0;
+    const uint32_t text_padding = (padding + 3) & ~3u; // keep instructions aligned
+
+    SourceFile source_files[object_count];
+    int loaded = 0;
+    int success = 0;
+    TextBlock *text_blocks_list = NULL; // Set if the text is ordered
+    TextBlock **text_order = NULL;
+    size_t text_block_count = 0;
+
+    SymbolTable global_symbols;
+    st_init(&global_symbols);
+
+    struct FileHeader final_header;
+    final_header.text_size = 0;
+    final_header.data_size = 0;
+    final_header.sdata_size = 0;
+    final_header.gp = GP_ADDRESS;
+    final_header.flags = 0;
+
+    /*
+    For each file (the startup object last):
+       - load its text segment
+       - load its data and small data segments
+       - load its relocation table
+       - load its symbol table
+    Then place the data after the small data of every file, and add global defined symbols to global symbol table
+    */
+    uint64_t phase_start = STATS_START();
+    for (int file_index = 0; file_index < object_count; file_index++) {
+        const uint64_t load_start = STATS_START();
+
+        // Open file
+        struct FileHeader header;
+        FILE *f = open_link_object(object_files, file_count, file_index, options, &header);
+        if (f == NULL) goto _link_failed;
+
+        // Load file
+        SourceFile file;
+        if (file_init(&file, &header, final_header.text_size, final_header.data_size, final_header.sdata_size) == 0) {
+            fclose(f);
+            goto _link_failed;
+        }
+        file.name = link_object_name(object_files, file_count, file_index, options);
+        const int read = load_file(f, &file, &header);
+        source_files[loaded++] = file;
+        fclose(f);
+        if (read == 0) goto _link_failed;
+
+        // Text with aligned offsets starts at a multiple of its alignment; the gap before it is filled with nops
+        source_files[loaded-1].text_offset = align_up(final_header.text_size, text_alignment(&source_files[loaded-1]));
+        final_header.text_size = source_files[loaded-1].text_offset + header.text_size + text_padding;
+        final_header.data_size += header.data_size + padding;
+        final_header.sdata_size += header.sdata_size;
+        final_header.flags |= header.flags;
+        TRACE_SPAN("load", "link", file.name, load_start);
+    }
+
+    // Remove what the entry cannot reach, then place the objects again
+    // Incremental links keep every object's layout, so they are neither collected nor folded
+    if (options->gc_sections && !options->incremental) {
+        const int64_t removed = collect_garbage(source_files, object_count, options->entry_symbol);
+        if (removed < 0) goto _link_failed;
+        STATS_ADD(COUNT_GC_REMOVED, removed);
+        place_objects(source_files, object_count, &final_header);
+    }
+
+    // Keep one copy of identical code and strings
+    if (options->icf && !options->incremental) {
+        if (fold_identical(source_files, object_count) == 0) goto _link_failed;
+        place_objects(source_files, object_count, &final_header);
+    }
+
+    // Small data must be within reach of $gp
+    if (final_header.sdata_size > SMALL_DATA_LIMIT) {
+        fprintf(stderr, "Error linking: %u bytes of small data, more than the %u that $gp can reach\n", final_header.sdata_size, SMALL_DATA_LIMIT);
+        goto _link_failed;
+    }
+    const uint32_t sdata_region = (final_header.sdata_size + 7) & ~7u; // keep the data that follows aligned
+    final_header.data_size += sdata_region;
+    for (int file_index = 0; file_index < object_count; file_index++) {
+        source_files[file_index].data_offset += sdata_region;
+        add_global_symbols(&source_files[file_index], &global_symbols);
+    }
+    add_linker_symbols(&global_symbols);
+
+    // Shorten `la` sequences, then place the text again and recompute the global symbols
+    // $gp is only set up by the startup object; incremental links keep every object's layout, so they are not relaxed
+    if (options->relax && !options->incremental) {
+        int64_t removed = 0;
+        for (int file_index = 0; file_index < object_count; file_index++) {
+            const int64_t bytes = relax_file(&source_files[file_index], &global_symbols, link_start);
+            if (bytes < 0) goto _link_failed;
+            removed += bytes;
+        }
+        if (removed > 0) place_text(source_files, object_count, text_padding, &final_header, &global_symbols);
+    }
+
+    // Group the text by named section and place the listed functions first (not in incremental links, which keep every object's layout)
+    int order = 0;
+    for (int file_index = 0; file_index < object_count; file_index++) {
+        if (source_files[file_index].section_count > 0) order = 1;
+    }
+    order = (order || options->symbol_order != NULL || options->profile != NULL) && !options->incremental;
+    SymbolTable ranks;
+    st_init(&ranks);
+    if (order && load_function_order(options->symbol_order, options->profile, &ranks) == 0) {
+        st_destroy(&ranks);
+        goto _link_failed;
+    }
+
+    // Order the text, then rewrite the branches that cannot reach their targets; this moves the code after them,
+    // which may put other branches out of range, so repeat until the layout settles (it only ever grows)
+    // Blocks keep what branches reach together, but branches between sections or objects may end up out of range
+    int64_t ordered = 0;
+    while (1) {
+        if (order) {
+            free(text_blocks_list);
+            free(text_order);
+            ordered = order_text(source_files, object_count, &ranks, options->entry_symbol == NULL, &text_blocks_list, &text_order, &text_block_count);
+            if (ordered < 0) {
+                st_destroy(&ranks);
+                goto _link_failed;
+            }
+            rebuild_global_symbols(source_files, object_count, &global_symbols);
+        }
+        int rewritten = 0;
+        for (int file_index = 0; file_index < object_count; file_index++) {
+            const int count = relax_branches(&source_files[file_index], &global_symbols);
+            if (count < 0) {
+                st_destroy(&ranks);
+                goto _link_failed;
+            }
+            rewritten += count;
+        }
+        if (rewritten == 0) break;
+        STATS_ADD(COUNT_BRANCHES_RELAXED, rewritten);
+        for (int file_index = 0; file_index < object_count; file_index++) {
+            source_files[file_index].blocks = NULL; // their offsets moved
+            source_files[file_index].block_count = 0;
+        }
+        place_text(source_files, object_count, text_padding, &final_header, &global_symbols);
+    }
+    st_destroy(&ranks);
+    STATS_ADD(COUNT_FUNCTIONS_ORDERED, ordered);
+    if (text_block_count > 0) {
+        const TextBlock *last = text_order[text_block_count - 1];
+        final_header.text_size = last->address + last->end - last->start;
+    }
+    STATS_STOP(PHASE_OBJECT_LOADING, phase_start);
+    STATS_ADD(COUNT_OBJECTS_LINKED, object_count);
+
+    /*
+    In each relocation table,
+    resolve each relocation
+    */
+    phase_start = STATS_START();
+    for (int file_index = 0; file_index < object_count; file_index++) {
+        const uint64_t relocation_start = STATS_START();
+        if (file_relocation(&source_files[file_index], &global_symbols) == 0) goto _link_failed;
+        TRACE_SPAN("relocate", "link", source_files[file_index].name, relocation_start);
+    }
+    STATS_STOP(PHASE_RELOCATION_RESOLUTION, phase_start);
+
+    // Determine entry
+    if (options->entry_symbol == NULL) {
+        final_header.entry = TEXT_START;
+    } else {
+        const Symbol *entry = st_get_symbol_safe(&global_symbols, options->entry_symbol);
+        if (entry == NULL) goto _link_failed;
+        final_header.entry = entry->offset;
+    }
+
+    /*
+    Build file by combining text and data segments
+    */
+    phase_start = STATS_START();
+    FILE *out = fopen(out_path, "wb");
+    if (out == NULL) {
+        raise_error(FILE_IO, out_path, __FILE__);
+        goto _link_failed;
+    }
+    fwrite(&final_header, sizeof(struct FileHeader), 1, out);
+    uint32_t text_written = 0; // gaps left by alignment are filled with nops
+    for (size_t b = 0; b < text_block_count; b++) {
+        // Write text blocks in order
+        const TextBlock *block = text_order[b];
+        write_padding(out, block->address - text_written);
+        fwrite(&source_files[block->file].text[block->start/4], sizeof(uint32_t), (block->end - block->start)/4, out);
+        text_written = block->address + block->end - block->start;
+    }
+    for (int file_index = 0; text_order == NULL && file_index < object_count; file_index++) {
+        // Write text segment
+        const SourceFile *file = &source_files[file_index];
+        write_padding(out, file->text_offset - text_written);
+        fwrite(file->text, sizeof(uint32_t), file->text_size/4, out);
+        write_padding(out, text_padding);
+        text_written = file->text_offset + file->text_size + text_padding;
+    }
+    for (int file_index = 0; file_index < object_count; file_index++) {
+        // Write small data segment
+        fwrite(source_files[file_index].sdata, sizeof(uint8_t), source_files[file_index].sdata_size, out);
+    }
+    write_padding(out, sdata_region - final_header.sdata_size);
+    for (int file_index = 0; file_index < object_count; file_index++) {
+        // Write data segment
+        fwrite(source_files[file_index].data, sizeof(uint8_t), source_files[file_index].data_size, out);
+        write_padding(out, padding);
+    }
+    if (fclose(out) != 0) {
+        raise_error(FILE_IO, out_path, __FILE__);
+        goto _link_failed;
+    }
+    STATS_STOP(PHASE_OUTPUT_WRITING, phase_start);
+    TRACE_SPAN("write", "link", out_path, phase_start);
+
+    // Save the layout for the next incremental link
+    if (options->incremental) {
+        char *state_path = ls_path(out_path);
+        LinkState state;
+        if (state_path == NULL || ls_init(&state, object_count) == 0) {
+            free(state_path);
+            goto _link_failed;
+        }
+        state.header = final_header;
+        state.padding = padding;
+        if (options->entry_symbol != NULL) strcpy(state.entry, options->entry_symbol);
+
+        int recorded = 1;
+        for (int file_index = 0; recorded && file_index < object_count; file_index++) {
+            LinkStateObject *object = &state.objects[file_index];
+            const SourceFile *file = &source_files[file_index];
+            object->text_offset = file->text_offset;
+            object->data_offset = file->data_offset;
+            object->sdata_offset = file->sdata_offset;
+            object->text_slot = file->text_size + text_padding;
+            object->data_slot = file->data_size + padding;
+            object->sdata_slot = file->sdata_size; // not padded, so that small data stays within reach of $gp
+            recorded = lso_set_name(object, file->name)
+                && hash_link_object(object_files, file_count, file_index, options, &object->hash)
+                && record_link_object(object, file, &global_symbols);
+        }
+        if (recorded == 0 || ls_write(&state, state_path) == 0) remove(state_path);
+        ls_destroy(&state);
+        free(state_path);
+        if (recorded == 0) goto _link_failed;
+    }
+
+    success = 1;
+
+    _link_failed:
+    for (int file_index = 0; file_index < loaded; file_index++) {
+        file_destroy(&source_files[file_index]);
+    }
+    st_destroy(&global_symbols);
+    free(text_blocks_list);
+    free(text_order);
+    if (success && MEMORY_ENABLED) mem_print(stderr, "link", out_path);
+    return success;
 }
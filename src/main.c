@@ -5,53 +5,186 @@
 #include "assembler.h"
 #include "preprocess.h"
 #include "linker.h"
+#include "object_cache.h"
+#include "server.h"
+#include "batch.h"
+#include "stats.h"
 
 /*
  $ ./mips_assembler a.out src1 src2 [...src_i]            # assemble and link, linking __start.o and beginning execution there
  $ ./mips_assembler -c src1 src2 [...src_i]               # only assemble into object files
  $ ./mips_assembler -e. a.out src1 src2 [...src_i]        # -e. begins execution at the first instruction
  $ ./mips_assembler -e symbol a.out src1 src2 [...src_i]  # -e (arg) begins execution at arg
+ $ ./mips_assembler -s start.o a.out src1 src2 [...src_i] # -s (arg) links arg instead of the built-in __start.o
+ $ ./mips_assembler -i a.out src1 src2 [...src_i]         # -i links incrementally, patching only changed objects
+ $ ./mips_assembler -i64 a.out src1 src2 [...src_i]       # -i(n) also reserves n bytes after each object's segments
+ $ ./mips_assembler --relax a.out src1 src2 [...src_i]    # shortens `la` of data addresses to one instruction where possible
+ $ ./mips_assembler --gc-sections a.out src1 [...src_i]   # removes the functions and data that the entry cannot reach
+ $ ./mips_assembler --icf a.out src1 [...src_i]           # keeps one copy of identical functions and read-only strings
+ $ ./mips_assembler --symbol-order file a.out src1 [...src_i] # places the functions listed in file first, in that order
+ $ ./mips_assembler --profile file a.out src1 [...src_i]  # places the functions in file first, by decreasing execution count
+ $ ./mips_assembler --cache dir a.out src1 src2 [...src_i] # reuses objects in dir for unchanged sources
+ $ ./mips_assembler --cache dir --cache-size n ...         # limits the cache to n bytes (default 64 MB)
+ $ ./mips_assembler --single-pass a.out src1 [...src_i]   # encodes each line as soon as it is parsed
+ $ ./mips_assembler --stream a.out src1 [...src_i]        # also reads the sources a chunk at a time, in bounded memory
+ $ ./mips_assembler -O a.out src1 [...src_i]              # removes redundant instructions (see peephole.h)
+ $ ./mips_assembler --delay-slots a.out src1 [...src_i]   # fills the delay slot after each branch and jump (with -O, not only with nop)
+ $ ./mips_assembler -falign-functions=16 a.out src1 [...] # aligns each global function to 16 bytes with nops
+
+ $ ./mips_assembler --batch manifest                      # builds every target listed in manifest (see batch.h)
+ $ ./mips_assembler --batch -j n --cache dir manifest     # builds n targets at a time, sharing the object cache in dir
+
+ $ ./mips_assembler --server sock                         # stays resident, handling requests sent to the socket sock
+ $ ./mips_assembler --client sock [args...]               # sends the arguments to the server at sock
+ $ ./mips_assembler --client sock --inline [args...]      # also sends the contents of the .asm files among the arguments
+ $ ./mips_assembler --client sock --stop                  # stops the server
+
+ $ ./mips_assembler --time-report [args...]               # prints the time spent in each phase and counts of what was built
+ $ ./mips_assembler --stats-json file [args...]           # writes the same report to file as JSON ("-" for stdout)
+ $ ./mips_assembler --trace file [args...]                # writes a Chrome trace of each file's phases, per thread
+ $ ./mips_assembler --mem-report [args...]                # prints the memory used by each data structure, per file
  */
 
-int main(int argc, char *argv[]) {
+// Assembles and links according to the arguments; returns the exit status
+int run(int argc, char *argv[]) {
     int performLinking = 1;
     int clean = 1;
+    AssemblyOptions assembly_options;
+    assembly_options.mode = TWO_PASS;
+    assembly_options.optimize = 0;
+    assembly_options.delay_slots = 0;
+    assembly_options.align_functions = 0;
     if (argc < 3) {
         fprintf(stderr, "error in %s: invalid arguments\n", __FILE__);
         return 1;
     }
 
-    char *entry = "__start"; // symbol that execution should begin at; if null, begins at TEXT_START (0x00400000)
-    const char *out_path = argv[1];
-    int file_count = argc-2;
+    LinkOptions link_options;
+    link_options.entry_symbol = "__start"; // symbol that execution should begin at; if null, begins at TEXT_START (0x00400000)
+    link_options.start_path = NULL;        // startup object linked when entry is __start; if null, uses the built-in one
+    link_options.incremental = 0;
+    link_options.padding = 0;
+    link_options.relax = 0;
+    link_options.gc_sections = 0;
+    link_options.icf = 0;
+    link_options.symbol_order = NULL;
+    link_options.profile = NULL;
+    const char *out_path = NULL;
+
+    ObjectCache cache;
+    cache.dir = NULL; // if null, objects are not cached
+    cache.size_limit = OBJECT_CACHE_DEFAULT_SIZE;
 
     // Handle options, determine entry and outpath
-    if (argv[1][0] == '-') {
-        switch (argv[1][1]) {
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-') {
+        switch (argv[arg][1]) {
             case 'c':
                 performLinking = 0;
-                out_path = NULL;
                 break;
+            case 'O':
+                assembly_options.optimize = 1;
+                break;
+            case 'f': {
+                if (strncmp(argv[arg], "-falign-functions=", strlen("-falign-functions=")) != 0) {
+                    fprintf(stderr, "error in %s: unrecognized option %s\n", __FILE__, argv[arg]);
+                    return 1;
+                }
+                char *endptr;
+                const long align = strtol(&argv[arg][strlen("-falign-functions=")], &endptr, 10);
+                if (*endptr != '\0' || align < 0 || align > TEXT_ALIGN_MAX || (align & (align - 1)) != 0) {
+                    fprintf(stderr, "error in %s: invalid alignment \"%s\"\n", __FILE__, argv[arg]);
+                    return 1;
+                }
+                assembly_options.align_functions = (uint32_t) align;
+                break;
+            }
             case 'e':
-                if (argv[1][2] == '.') {
-                    file_count = argc-3;
-                    entry = NULL;
-                    out_path = argv[2];
+                if (argv[arg][2] == '.') {
+                    link_options.entry_symbol = NULL;
                 }
                 else {
-                    if (argc < 4) {
+                    if (arg+1 >= argc) {
                         fprintf(stderr, "error in %s: invalid arguments\n", __FILE__);
                         return 1;
                     }
-                    file_count = argc-4;
-                    entry = argv[2];
-                    out_path = argv[3];
+                    link_options.entry_symbol = argv[++arg];
+                }
+                break;
+            case 's':
+                if (arg+1 >= argc) {
+                    fprintf(stderr, "error in %s: invalid arguments\n", __FILE__);
+                    return 1;
+                }
+                link_options.start_path = argv[++arg];
+                break;
+            case 'i': {
+                char *endptr;
+                const long padding = strtol(&argv[arg][2], &endptr, 10);
+                if (*endptr != '\0' || padding < 0) {
+                    fprintf(stderr, "error in %s: invalid padding \"%s\"\n", __FILE__, &argv[arg][2]);
+                    return 1;
+                }
+                link_options.incremental = 1;
+                link_options.padding = (uint32_t) padding;
+                break;
+            }
+            case '-':
+                // Long options
+                if (strcmp(argv[arg], "--cache") == 0 && arg+1 < argc) {
+                    cache.dir = argv[++arg];
+                }
+                else if (strcmp(argv[arg], "--single-pass") == 0) {
+                    assembly_options.mode = SINGLE_PASS;
+                }
+                else if (strcmp(argv[arg], "--stream") == 0) {
+                    assembly_options.mode = STREAMING;
+                }
+                else if (strcmp(argv[arg], "--delay-slots") == 0) {
+                    assembly_options.delay_slots = 1;
+                }
+                else if (strcmp(argv[arg], "--relax") == 0) {
+                    link_options.relax = 1;
+                }
+                else if (strcmp(argv[arg], "--gc-sections") == 0) {
+                    link_options.gc_sections = 1;
+                }
+                else if (strcmp(argv[arg], "--icf") == 0) {
+                    link_options.icf = 1;
+                }
+                else if (strcmp(argv[arg], "--symbol-order") == 0 && arg+1 < argc) {
+                    link_options.symbol_order = argv[++arg];
+                }
+                else if (strcmp(argv[arg], "--profile") == 0 && arg+1 < argc) {
+                    link_options.profile = argv[++arg];
+                }
+                else if (strcmp(argv[arg], "--cache-size") == 0 && arg+1 < argc) {
+                    char *endptr;
+                    const long long size = strtoll(argv[++arg], &endptr, 10);
+                    if (*endptr != '\0' || size < 0) {
+                        fprintf(stderr, "error in %s: invalid cache size \"%s\"\n", __FILE__, argv[arg]);
+                        return 1;
+                    }
+                    cache.size_limit = (uint64_t) size;
+                }
+                else {
+                    fprintf(stderr, "error in %s: unrecognized option %s\n", __FILE__, argv[arg]);
+                    return 1;
                 }
                 break;
             default:
-                fprintf(stderr, "error in %s: unrecognized option %c\n", __FILE__, argv[1][1]);
+                fprintf(stderr, "error in %s: unrecognized option %c\n", __FILE__, argv[arg][1]);
                 return 1;
         }
+        arg++;
+    }
+    if (performLinking && arg < argc) {
+        out_path = argv[arg++];
+    }
+    const int file_count = argc-arg;
+    if (file_count <= 0) {
+        fprintf(stderr, "error in %s: invalid arguments\n", __FILE__);
+        return 1;
     }
 
     char *object_files[file_count+1];
@@ -72,38 +205,17 @@ int main(int argc, char *argv[]) {
         object_path[j] = '\0';
         object_files[i-(argc-file_count)] = object_path;
 
-        FILE *inp_file = open_file(inp_path);
-        if (inp_file == NULL) return 1;
-
-        Text text;
-        text_init(&text);
-
-        if (preprocess(inp_file, inp_path, &text) == 0) {
-            fprintf(stderr, "Error in %s: could not preprocess file \"%s\"\n", __FILE__, inp_path);
-            text_destroy(&text);
-            for (int k = 0; k <= i-2; k++) {
-                free(object_files[k]);
-            }
-            return 2;
-        }
-
-        // text_debug(&text);
-
-        if (assemble(&text, object_path) == 0) {
-            fprintf(stderr, "Error in %s: could not assemble file \"%s\"\n", __FILE__, inp_path);
-            text_destroy(&text);
-            for (int k = 0; k <= i-2; k++) {
+        const int status = assemble_file(inp_path, object_path, &cache, &assembly_options);
+        if (status != 0) {
+            for (int k = 0; k <= i-(argc-file_count); k++) {
                 free(object_files[k]);
             }
-            return 3;
+            return status;
         }
-
-        // debug_binary(object_path);
-        text_destroy(&text);
     }
 
     if (performLinking) {
-        if (link(out_path, object_files, file_count, entry) == 0) {
+        if (link(out_path, object_files, file_count, &link_options) == 0) {
             fprintf(stderr, "Error in %s: could not link files\n", __FILE__);
             for (int i = 0; i < file_count; i++) {
                 free(object_files[i]);
@@ -118,4 +230,35 @@ int main(int argc, char *argv[]) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+// Dispatches to the mode given by the first argument
+int run_mode(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--server") == 0) {
+        return server_run(argv[2], &run);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--client") == 0) {
+        if (argc == 4 && strcmp(argv[3], "--stop") == 0) {
+            return client_run(argv[2], 0, NULL, 0);
+        }
+        if (argc >= 4 && strcmp(argv[3], "--inline") == 0) {
+            return client_run(argv[2], argc-4, argv+4, 1);
+        }
+        return client_run(argv[2], argc-3, argv+3, 0);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--batch") == 0) {
+        return batch_run(argc-2, argv+2);
+    }
+    return run(argc, argv);
+}
+
+int main(int argc, char *argv[]) {
+    if (stats_options(&argc, argv) == 0) return 1;
+
+    const uint64_t start = STATS_START();
+    int status = run_mode(argc, argv);
+    STATS_STOP(PHASE_TOTAL, start);
+
+    if (STATS_ENABLED && stats_report() == 0 && status == 0) status = 1;
+    return status;
+}
@@ -0,0 +1,168 @@
+#include "object_cache.h"
+#include "assembler.h"
+#include "utils.h"
+
+#include <dirent.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+/* Object cache
+
+Stores assembled objects in a directory, keyed by a hash of the preprocessed input
+(which includes the built-in macros from pseudo.asm) and the assembler version, so
+unchanged sources are not assembled again.
+
+Several assemblers may share a cache directory: objects are written to a temporary file
+and renamed into place, so a cached object is never seen half-written. When the total
+size of the cache exceeds its limit, the least recently used objects are removed.
+*/
+
+atomic_uint TMP_COUNTER = 0; // Distinguishes temporary files written by threads of the same process
+
+typedef struct {
+    char *path;
+    off_t size;
+    time_t used;
+} CacheEntry;
+
+// Returns the cache key of the preprocessed input; `variant` stands for the options that change the object, such as -O and --delay-slots
+uint64_t oc_key(const Text *preprocessed, const uint64_t variant) {
+    uint64_t hash = hash_bytes(ASSEMBLER_VERSION, strlen(ASSEMBLER_VERSION) + 1, HASH_BYTES_INIT);
+    if (variant != 0) hash = hash_bytes(&variant, sizeof(variant), hash);
+    for (const Line *line = preprocessed->head; line != NULL; line = line->next) {
+        hash = hash_bytes(line->text, strlen(line->text) + 1, hash);
+    }
+    return hash;
+}
+
+// Writes the path of the cached object with the given key (or name, if not NULL) into path; returns success
+int oc_path(char *path, const size_t size, const ObjectCache *cache, const uint64_t key, const char *name) {
+    int len;
+    if (name != NULL) len = snprintf(path, size, "%s/%s", cache->dir, name);
+    else len = snprintf(path, size, "%s/%016llx.o", cache->dir, (unsigned long long) key);
+    return len > 0 && (size_t) len < size;
+}
+
+// Copies the file at src to dst; returns success
+int copy_file(const char *src, const char *dst) {
+    FILE *in = fopen(src, "rb");
+    if (in == NULL) return 0;
+    FILE *out = fopen(dst, "wb");
+    if (out == NULL) {
+        fclose(in);
+        raise_error(FILE_IO, dst, __FILE__);
+        return 0;
+    }
+
+    uint8_t buf[4096];
+    size_t n;
+    int success = 1;
+    while (success && (n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        success = fwrite(buf, 1, n, out) == n;
+    }
+    success = success && !ferror(in);
+    fclose(in);
+    if (fclose(out) != 0 || !success) {
+        raise_error(FILE_IO, dst, __FILE__);
+        remove(dst);
+        return 0;
+    }
+    return 1;
+}
+
+// Copies the cached object with the given key to object_path. Returns 0 if it is not cached
+int oc_fetch(const ObjectCache *cache, const uint64_t key, const char *object_path) {
+    char path[4096];
+    if (oc_path(path, sizeof(path), cache, key, NULL) == 0) return 0;
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return 0;
+    fclose(f);
+
+    if (copy_file(path, object_path) == 0) return 0;
+    utime(path, NULL); // mark as recently used
+    return 1;
+}
+
+int compare_entries(const void *a, const void *b) {
+    const time_t x = ((const CacheEntry *) a)->used;
+    const time_t y = ((const CacheEntry *) b)->used;
+    return (x > y) - (x < y);
+}
+
+// Removes the least recently used objects until the cache fits in its size limit
+void oc_evict(const ObjectCache *cache) {
+    DIR *dir = opendir(cache->dir);
+    if (dir == NULL) return;
+
+    size_t len = 0, cap = 64;
+    CacheEntry *entries = malloc(cap * sizeof(CacheEntry));
+    uint64_t total = 0;
+    const struct dirent *ent;
+    while (entries != NULL && (ent = readdir(dir)) != NULL) {
+        const size_t name_len = strlen(ent->d_name);
+        if (name_len < 3 || strcmp(ent->d_name + name_len - 2, ".o") != 0) continue;
+
+        char path[4096];
+        struct stat st;
+        if (oc_path(path, sizeof(path), cache, 0, ent->d_name) == 0 || stat(path, &st) != 0) continue;
+
+        if (len >= cap) {
+            cap *= 2;
+            CacheEntry *new = realloc(entries, cap * sizeof(CacheEntry));
+            if (new == NULL) break;
+            entries = new;
+        }
+        entries[len].path = strdup(path);
+        if (entries[len].path == NULL) break;
+        entries[len].size = st.st_size;
+        entries[len].used = st.st_mtime;
+        total += st.st_size;
+        len++;
+    }
+    closedir(dir);
+    if (entries == NULL) return;
+
+    if (total > cache->size_limit) {
+        qsort(entries, len, sizeof(CacheEntry), compare_entries);
+        for (size_t i = 0; i < len && total > cache->size_limit; i++) {
+            // Another assembler may have removed it already
+            if (remove(entries[i].path) == 0 || errno == ENOENT) total -= entries[i].size;
+        }
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+// Adds the object at object_path to the cache under the given key
+int oc_store(const ObjectCache *cache, const uint64_t key, const char *object_path) {
+    if (mkdir(cache->dir, 0777) != 0 && errno != EEXIST) {
+        raise_error(FILE_IO, cache->dir, __FILE__);
+        return 0;
+    }
+
+    // Write to a file no other process or thread uses, then publish it by renaming
+    char tmp_name[80], tmp_path[4096], path[4096];
+    snprintf(tmp_name, sizeof(tmp_name), "tmp.%ld.%u.%016llx", (long) getpid(), atomic_fetch_add(&TMP_COUNTER, 1), (unsigned long long) key);
+    if (oc_path(tmp_path, sizeof(tmp_path), cache, key, tmp_name) == 0 || oc_path(path, sizeof(path), cache, key, NULL) == 0) {
+        raise_error(FILE_IO, cache->dir, __FILE__);
+        return 0;
+    }
+    if (copy_file(object_path, tmp_path) == 0) return 0;
+    if (rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        raise_error(FILE_IO, path, __FILE__);
+        return 0;
+    }
+
+    oc_evict(cache);
+    return 1;
+}
@@ -0,0 +1,260 @@
+#include "peephole.h"
+#include "stats.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* Peephole optimizer
+
+Removes redundant instructions, mostly left by the expansion of pseudoinstructions and macros,
+as they are added to the InstructionList, and fills delay slots. See peephole.h for the rules.
+Labels may only be defined between instructions that have been added, so their offsets never need to change.
+*/
+
+// How the operands of an arithmetic or logic instruction are given
+enum OperandForm {
+    NOT_ALU,   // Any other instruction, or malformed operands; left as is
+    ALU_R,     // rd rs rt
+    ALU_SHIFT, // rd rt shamt
+    ALU_I,     // rt rs imm
+    ALU_LUI    // rt imm
+};
+
+static const struct {
+    const char *mnemonic;
+    enum OperandForm form;
+} ALU_INSTRUCTIONS[] = {
+    {"add", ALU_R}, {"addu", ALU_R}, {"sub", ALU_R}, {"subu", ALU_R}, {"and", ALU_R},
+    {"or", ALU_R}, {"xor", ALU_R}, {"nor", ALU_R}, {"slt", ALU_R}, {"sltu", ALU_R},
+    {"sll", ALU_SHIFT}, {"srl", ALU_SHIFT}, {"sra", ALU_SHIFT},
+    {"addi", ALU_I}, {"addiu", ALU_I}, {"slti", ALU_I}, {"sltiu", ALU_I}, {"andi", ALU_I}, {"ori", ALU_I},
+    {"lui", ALU_LUI}
+};
+
+/* === OPERANDS === */
+
+// Returns the form of the instruction's operands, or NOT_ALU unless it is an arithmetic or logic instruction
+// with well-formed operands that writes a register other than $0
+enum OperandForm operand_form(const Instruction *instruction) {
+    enum OperandForm form = NOT_ALU;
+    for (size_t i = 0; i < sizeof(ALU_INSTRUCTIONS) / sizeof(ALU_INSTRUCTIONS[0]); i++) {
+        if (strcmp(instruction->mnemonic, ALU_INSTRUCTIONS[i].mnemonic) == 0) {
+            form = ALU_INSTRUCTIONS[i].form;
+            break;
+        }
+    }
+
+    const unsigned char *r = instruction->registers;
+    const enum ImmType imm = instruction->imm.type;
+    int valid;
+    switch (form) {
+        case ALU_R:
+            valid = r[1] != 255 && r[2] != 255 && imm == NONE;
+            break;
+        case ALU_SHIFT:
+            valid = r[1] != 255 && r[2] == 255 && imm == NUM;
+            break;
+        case ALU_I:
+            valid = r[1] != 255 && r[2] == 255 && (imm == NUM || imm == SYMBOL);
+            break;
+        case ALU_LUI:
+            valid = r[1] == 255 && r[2] == 255 && (imm == NUM || imm == SYMBOL);
+            break;
+        default:
+            return NOT_ALU;
+    }
+    if (!valid || r[0] == 255 || r[0] == 0) return NOT_ALU;
+    return form;
+}
+
+int reads_register(const Instruction *instruction, const enum OperandForm form, const unsigned char reg) {
+    switch (form) {
+        case ALU_R:
+            return instruction->registers[1] == reg || instruction->registers[2] == reg;
+        case ALU_SHIFT:
+        case ALU_I:
+            return instruction->registers[1] == reg;
+        default:
+            return 0;
+    }
+}
+
+int same_instruction(const Instruction *a, const Instruction *b) {
+    if (strcmp(a->mnemonic, b->mnemonic) != 0 || memcmp(a->registers, b->registers, sizeof(a->registers)) != 0) return 0;
+    if (a->imm.type != b->imm.type || a->imm.modifier != b->imm.modifier) return 0;
+    switch (a->imm.type) {
+        case NUM:
+            return a->imm.intValue == b->imm.intValue;
+        case NONE:
+            return 1;
+        default:
+            return strcmp(a->imm.symbol, b->imm.symbol) == 0;
+    }
+}
+
+int is_zero(const Immediate imm) {
+    return imm.type == NUM && imm.modifier == 0 && imm.intValue == 0;
+}
+
+// Whether the instruction leaves its register unchanged, e.g. `addu $t0 $0 $t0` (move $t0 $t0)
+int is_no_op(const Instruction *instruction, const enum OperandForm form) {
+    const char *mnemonic = instruction->mnemonic;
+    const unsigned char d = instruction->registers[0];
+    const unsigned char s = instruction->registers[1];
+    const unsigned char t = instruction->registers[2];
+    switch (form) {
+        case ALU_R:
+            if (strcmp(mnemonic, "add") == 0 || strcmp(mnemonic, "addu") == 0 || strcmp(mnemonic, "or") == 0 || strcmp(mnemonic, "xor") == 0) {
+                if ((s == d && t == 0) || (s == 0 && t == d)) return 1;
+            }
+            if (strcmp(mnemonic, "sub") == 0 || strcmp(mnemonic, "subu") == 0) return s == d && t == 0;
+            if (strcmp(mnemonic, "and") == 0 || strcmp(mnemonic, "or") == 0) return s == d && t == d;
+            return 0;
+        case ALU_SHIFT:
+            return s == d && is_zero(instruction->imm);
+        case ALU_I:
+            if (strcmp(mnemonic, "addi") == 0 || strcmp(mnemonic, "addiu") == 0 || strcmp(mnemonic, "ori") == 0) {
+                return s == d && is_zero(instruction->imm);
+            }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+// `addiu` of a signed 16-bit number
+int is_short_addiu(const Instruction *instruction) {
+    return strcmp(instruction->mnemonic, "addiu") == 0 && operand_form(instruction) == ALU_I
+        && instruction->imm.type == NUM && instruction->imm.modifier == 0
+        && instruction->imm.intValue >= INT16_MIN && instruction->imm.intValue <= INT16_MAX;
+}
+
+// Whether executing the pair `a b` again right after it leaves every register as it was
+// True if neither reads a register the pair writes, except for b reading the register a writes
+int repeatable_pair(const Instruction *a, const Instruction *b) {
+    const enum OperandForm a_form = operand_form(a);
+    const enum OperandForm b_form = operand_form(b);
+    if (a_form == NOT_ALU || b_form == NOT_ALU) return 0;
+    const unsigned char a_dest = a->registers[0];
+    const unsigned char b_dest = b->registers[0];
+    return !reads_register(a, a_form, a_dest) && !reads_register(a, a_form, b_dest)
+        && (b_dest == a_dest || !reads_register(b, b_form, b_dest));
+}
+
+/* === RULES === */
+
+void remove_last(InstructionList *instruction_list, const size_t count) {
+    instruction_list->len -= count;
+    instruction_list->text_offset -= 4 * count;
+}
+
+void peephole_push(InstructionList *instruction_list, const Instruction instruction) {
+    Instruction *list = instruction_list->list;
+    const size_t len = instruction_list->len;
+    const size_t block = len - instruction_list->block_start; // Instructions the rules may look at
+    const enum OperandForm form = operand_form(&instruction);
+
+    if (form != NOT_ALU) {
+        const unsigned char dest = instruction.registers[0];
+        if (is_no_op(&instruction, form)) {
+            STATS_ADD(COUNT_PEEPHOLE_REMOVED, 1);
+            return;
+        }
+
+        if (block >= 1) {
+            // addiu $r $s a; addiu $r $r b
+            Instruction *prev = &list[len-1];
+            if (is_short_addiu(&instruction) && instruction.registers[1] == dest && is_short_addiu(prev) && prev->registers[0] == dest) {
+                const int32_t sum = prev->imm.intValue + instruction.imm.intValue;
+                if (sum == 0 && prev->registers[1] == dest) {
+                    remove_last(instruction_list, 1);
+                    STATS_ADD(COUNT_PEEPHOLE_REMOVED, 2);
+                    return;
+                }
+                if (sum >= INT16_MIN && sum <= INT16_MAX) {
+                    prev->imm.intValue = sum;
+                    STATS_ADD(COUNT_PEEPHOLE_REMOVED, 1);
+                    return;
+                }
+            }
+
+            // Same instruction twice
+            if (same_instruction(prev, &instruction) && !reads_register(&instruction, form, dest)) {
+                STATS_ADD(COUNT_PEEPHOLE_REMOVED, 1);
+                return;
+            }
+        }
+
+        // Same pair twice, e.g. lui $at hi; ori $r $at lo
+        if (block >= 3 && same_instruction(&list[len-2], &instruction) && same_instruction(&list[len-3], &list[len-1])
+            && repeatable_pair(&list[len-1], &instruction)) {
+            remove_last(instruction_list, 1);
+            STATS_ADD(COUNT_PEEPHOLE_REMOVED, 2);
+            return;
+        }
+    }
+
+    list[len] = instruction;
+    instruction_list->len++;
+    instruction_list->text_offset += 4;
+}
+
+/* === DELAY SLOTS === */
+
+int has_delay_slot(const Instruction *instruction) {
+    const char *mnemonic = instruction->mnemonic;
+    return strcmp(mnemonic, "beq") == 0 || strcmp(mnemonic, "bne") == 0 || strcmp(mnemonic, "j") == 0
+        || strcmp(mnemonic, "jal") == 0 || strcmp(mnemonic, "jr") == 0;
+}
+
+// Whether the arithmetic or logic instruction can execute after the branch or jump instead of before it
+int independent_of_branch(const Instruction *instruction, const enum OperandForm form, const Instruction *branch) {
+    const unsigned char dest = instruction->registers[0];
+    if (strcmp(branch->mnemonic, "jal") == 0 && (dest == 31 || reads_register(instruction, form, 31))) return 0; // jal sets $ra first
+    if (strcmp(branch->mnemonic, "j") == 0 || strcmp(branch->mnemonic, "jal") == 0) return 1;
+    if (strcmp(branch->mnemonic, "jr") == 0) return branch->registers[0] != dest;
+    return branch->registers[0] != dest && branch->registers[1] != dest;
+}
+
+// Whether two arithmetic or logic instructions can be swapped
+int independent(const Instruction *a, const enum OperandForm a_form, const Instruction *b, const enum OperandForm b_form) {
+    const unsigned char a_dest = a->registers[0];
+    const unsigned char b_dest = b->registers[0];
+    return a_dest != b_dest && !reads_register(a, a_form, b_dest) && !reads_register(b, b_form, a_dest);
+}
+
+void fill_delay_slot(InstructionList *instruction_list) {
+    Instruction *list = instruction_list->list;
+    const size_t branch = instruction_list->len - 1;
+
+    if (instruction_list->optimize) {
+        const size_t first = branch > PEEPHOLE_WINDOW ? branch - PEEPHOLE_WINDOW : 0;
+        for (size_t k = branch; k-- > first && k >= instruction_list->block_start;) {
+            const enum OperandForm form = operand_form(&list[k]);
+            if (form == NOT_ALU) break; // it could not be moved past either
+
+            int movable = independent_of_branch(&list[k], form, &list[branch]);
+            for (size_t q = k + 1; movable && q < branch; q++) {
+                movable = independent(&list[k], form, &list[q], operand_form(&list[q]));
+            }
+            if (movable) {
+                const Instruction moved = list[k];
+                memmove(&list[k], &list[k+1], (branch - k) * sizeof(Instruction));
+                list[branch] = moved;
+                instruction_list->block_start = instruction_list->len;
+                STATS_ADD(COUNT_DELAY_SLOTS_FILLED, 1);
+                return;
+            }
+        }
+    }
+
+    Instruction nop;
+    memset(&nop, 0, sizeof(nop));
+    strcpy(nop.mnemonic, "nop");
+    memset(nop.registers, 255, sizeof(nop.registers));
+    nop.imm.type = NONE;
+    nop.loc = list[branch].loc;
+    list[instruction_list->len++] = nop;
+    instruction_list->text_offset += 4;
+    instruction_list->block_start = instruction_list->len;
+}
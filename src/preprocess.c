@@ -12,58 +12,90 @@ Reads through the input file:
 - Moves labels inline
 */
 
-FILE * open_file(const char *path) {
-    FILE *inp = fopen(path, "r");
-    if (inp == NULL) {
-        general_error(FILE_IO, __FILE__, path);
-        return NULL;
+const InlineSource *INLINE_SOURCES = NULL; // Sources given in memory instead of on disk (used by the server)
+size_t INLINE_SOURCE_COUNT = 0;
+
+// Sources with these paths are read from memory by open_file() instead of from disk
+void set_inline_sources(const InlineSource *sources, const size_t count) {
+    INLINE_SOURCES = sources;
+    INLINE_SOURCE_COUNT = count;
+}
+
+// Opens a source file without reporting errors; inline sources and the built-in pseudo.asm are read from memory
+FILE * open_source(const char *path) {
+    if (strcmp(path, PSEUDO_PATH) == 0) {
+        return fmemopen((void *) PSEUDO_SOURCE, PSEUDO_SOURCE_SIZE, "r");
     }
+    for (size_t i = 0; i < INLINE_SOURCE_COUNT; i++) {
+        if (strcmp(INLINE_SOURCES[i].path, path) == 0) {
+            return fmemopen((void *) INLINE_SOURCES[i].text, INLINE_SOURCES[i].len, "r");
+        }
+    }
+    return fopen(path, "r");
+}
+
+// Opens a source file, reporting an error if it cannot be read
+FILE * open_file(const char *path) {
+    FILE *inp = open_source(path);
+    if (inp == NULL) general_error(FILE_IO, __FILE__, path);
     return inp;
 }
 
-// Preprocesses the contents of 'inp', writes the result to the Text structure
-int preprocess_file(FILE *inp, const char *path, Text *text) {
-    int c;
-    int prev = '\0';
+// Prepares to preprocess the contents of 'inp' a few lines at a time into the Text structure; inp is closed once it has been read
+// The path is added to the Text's file table, and must outlive it
+int pp_init(Preprocessor *pp, FILE *inp, const char *path, Text *text) {
+    pp->inp = inp;
+    pp->prev = '\0';
+    pp->reading_string = 0;
+    pp->line_number = 1; // Increment on every \n
+    if (text_add_file(text, path, &pp->file) == 0 || line_init(&pp->line, pp->file) == 0) {
+        fclose(inp);
+        pp->inp = NULL;
+        return 0;
+    }
+    pp->line.number = pp->line_number;
+    return 1;
+}
 
-    Line line;
-    line_init(&line, path);
-    unsigned int line_number = 1; // Increment on every \n
-    line.number = line_number;
+// Preprocesses the next lines of the input, adding up to max_lines lines (0 for no limit) to the Text structure
+// pp->inp is NULL once the whole input has been read
+int pp_read(Preprocessor *pp, Text *text, const size_t max_lines) {
+    if (pp->inp == NULL) return 1;
 
-    int readingString = 0;
-    while ((c = fgetc(inp)) != EOF) {
+    const size_t target = text->len + max_lines;
+    int c = '\0';
+    while ((max_lines == 0 || text->len < target) && (c = fgetc(pp->inp)) != EOF) {
 
         // End of line, add to list
         if (c == '\n') {
-            line_number++;
-            if (prev == '\0') {
-                line.number = line_number;
+            pp->line_number++;
+            if (pp->prev == '\0') {
+                pp->line.number = pp->line_number;
                 continue;
             } // Skip if empty line
-            if (isspace(prev)) line.text[line.len-1] = '\0'; // overwrite trailing space
-            else line_add_char(&line, '\0'); // otherwise append null terminator
-            text_add(text, line);
-            line_init(&line, path); // Reset line
-            line.number = line_number;
-            prev = '\0'; // Reset prev
+            if (isspace(pp->prev)) pp->line.text[pp->line.len-1] = '\0'; // overwrite trailing space
+            else line_add_char(&pp->line, '\0'); // otherwise append null terminator
+            text_add(text, pp->line);
+            line_init(&pp->line, pp->file); // Reset line
+            pp->line.number = pp->line_number;
+            pp->prev = '\0'; // Reset prev
             continue;
         }
 
-        if (!readingString) { // Character is not in a string
-            if (c == '\"' && prev != '\\') {
-                readingString = 1;
+        if (!pp->reading_string) { // Character is not in a string
+            if (c == '\"' && pp->prev != '\\') {
+                pp->reading_string = 1;
             }
 
             else if (c == ',') {
-                if (isspace(prev) || prev == '\0') continue;
-                line_add_char(&line, ' ');
-                prev = ' ';
+                if (isspace(pp->prev) || pp->prev == '\0') continue;
+                line_add_char(&pp->line, ' ');
+                pp->prev = ' ';
                 continue;
             }
 
             // Skip whitespace if previous character was also whitespace
-            else if (isspace(c) && (isspace(prev) || prev == '\0')) {
+            else if (isspace(c) && (isspace(pp->prev) || pp->prev == '\0')) {
                 continue; // without updating prev
             }
             // Replace tab with space
@@ -71,22 +103,22 @@ int preprocess_file(FILE *inp, const char *path, Text *text) {
 
             // If character is a comment, stop reading and add the line as is
             else if (c == '#') {
-                if (prev != '\0') { // Add the line
-                    if (isspace(prev)) line.text[line.len-1] = '\0'; // overwrite trailing space
-                    else line_add_char(&line, '\0'); // otherwise append null terminator
-                    text_add(text, line);
-                    line_init(&line, path); // Reset line
-                    line.number = line_number;
-                    prev = '\0'; // Reset prev
+                if (pp->prev != '\0') { // Add the line
+                    if (isspace(pp->prev)) pp->line.text[pp->line.len-1] = '\0'; // overwrite trailing space
+                    else line_add_char(&pp->line, '\0'); // otherwise append null terminator
+                    text_add(text, pp->line);
+                    line_init(&pp->line, pp->file); // Reset line
+                    pp->line.number = pp->line_number;
+                    pp->prev = '\0'; // Reset prev
                 }
 
                 // Read until next line
                 do {
-                    c = fgetc(inp);
+                    c = fgetc(pp->inp);
                 } while (c != EOF && c != '\n');
                 if (c == EOF) break;
-                line_number++;
-                line.number++;
+                pp->line_number++;
+                pp->line.number++;
 
                 continue;
             }
@@ -94,65 +126,95 @@ int preprocess_file(FILE *inp, const char *path, Text *text) {
             // Labels should be moved to the next line with text
             else if (c == ':') {
                 // skip over whitespace and comments until an instruction is found
-                line_add_char(&line, (char) c);
-                line_add_char(&line, ' ');
-                prev = ' ';
-                c = fgetc(inp);
+                line_add_char(&pp->line, (char) c);
+                line_add_char(&pp->line, ' ');
+                pp->prev = ' ';
+                c = fgetc(pp->inp);
                 while (isspace(c) || c == '#') {
                     if (c == '\n') {
-                        line_number++; // increment both number counter and line's number
-                        line.number++; // because line's number was the start of the label
+                        pp->line_number++; // increment both number counter and line's number
+                        pp->line.number++; // because line's number was the start of the label
                     }
                     else if (c == '#') {
                         // Loop until end of line
                         while (c != '\n' && c != EOF) {
-                            c = fgetc(inp);
+                            c = fgetc(pp->inp);
                         }
                         if (c == EOF) break;
-                        line.number++;
-                        line_number++;
+                        pp->line.number++;
+                        pp->line_number++;
                     }
                     else if (c == EOF) break;
-                    c = fgetc(inp);
+                    c = fgetc(pp->inp);
                 }
                 if (c == EOF) break;
-                line_add_char(&line, (char) c);
+                line_add_char(&pp->line, (char) c);
 
                 continue;
             }
 
-            line_add_char(&line, (char) c);
+            line_add_char(&pp->line, (char) c);
         }
 
         else { // Character is part of a string
             // Check for end quote
-            if (c == '\"' && prev != '\\') {
-                readingString = 0;
+            if (c == '\"' && pp->prev != '\\') {
+                pp->reading_string = 0;
             }
 
             // Add character
-            line_add_char(&line, (char) c);
+            line_add_char(&pp->line, (char) c);
         }
 
-        prev = c;
+        pp->prev = c;
     }
 
+    if (c != EOF) return 1; // Stopped after max_lines
+
     // Add last line
-    if (prev != '\0') {
-        line_add_char(&line, '\0');
-        text_add(text, line);
-    }
+    if (pp->prev != '\0') {
+        line_add_char(&pp->line, '\0');
+        text_add(text, pp->line);
+    } else line_destroy(&pp->line);
 
-    fclose(inp);
+    fclose(pp->inp);
+    pp->inp = NULL;
     return 1;
 }
 
+// Frees resources, if the input was not read to the end
+void pp_destroy(Preprocessor *pp) {
+    if (pp->inp == NULL) return;
+    fclose(pp->inp);
+    line_destroy(&pp->line);
+    pp->inp = NULL;
+}
+
+// Preprocesses the contents of 'inp', writes the result to the Text structure
+int preprocess_file(FILE *inp, const char *path, Text *text) {
+    Preprocessor pp;
+    if (pp_init(&pp, inp, path, text) == 0) return 0;
+    return pp_read(&pp, text, 0);
+}
+
 // Preprocesses pseudo.asm, followed by the input file
 int preprocess(FILE *inp, const char *path, Text *text) {
-    FILE *pseudo = fopen("src/pseudo.asm", "r");
-    if (preprocess_file(pseudo, "src/pseudo.asm", text) == 0) return 0;
+    Preprocessor pp;
+    if (preprocess_stream(inp, path, text, &pp) == 0) return 0;
+    return pp_read(&pp, text, 0);
+}
 
-    if (preprocess_file(inp, path, text) == 0) return 0;
+// Preprocesses pseudo.asm, and prepares to preprocess the input file a few lines at a time with pp_read()
+int preprocess_stream(FILE *inp, const char *path, Text *text, Preprocessor *pp) {
+    FILE *pseudo = open_file(PSEUDO_PATH);
+    if (pseudo == NULL) {
+        fclose(inp);
+        return 0;
+    }
+    if (preprocess_file(pseudo, PSEUDO_PATH, text) == 0) {
+        fclose(inp);
+        return 0;
+    }
 
-    return 1;
+    return pp_init(pp, inp, path, text);
 }
\ No newline at end of file
@@ -0,0 +1,15 @@
+#include "preprocess.h"
+
+/* Built-in macros
+
+The contents of pseudo.asm, embedded in the executable at build time so the assembler does not
+need to find it on disk. The Makefile generates pseudo_source.inc from src/pseudo.asm;
+open_file() serves PSEUDO_PATH from these bytes.
+*/
+
+static const char pseudo_source_bytes[] = {
+#include "pseudo_source.inc"
+};
+
+const char *PSEUDO_SOURCE = pseudo_source_bytes;
+const size_t PSEUDO_SOURCE_SIZE = sizeof(pseudo_source_bytes);
@@ -1,4 +1,5 @@
 #include "pseudoinstructions.h"
+#include "stats.h"
 
 #include <ctype.h>
 
@@ -16,78 +17,154 @@ and add its real equivalents directly to the InstructionList
 */
 
 int mt_init(MacroTable *table) {
-    table->buckets = malloc(245 * sizeof(MacroBucket));
-    if (table->buckets == NULL) {
+    memset(table, 0, sizeof(MacroTable));
+
+    table->bucket_count = MACRO_TABLE_INITIAL_SIZE;
+    table->buckets = calloc(table->bucket_count, sizeof(uint32_t));
+    table->cap = MACRO_TABLE_INITIAL_SIZE / 2;
+    table->macros = malloc(table->cap * sizeof(Macro));
+    if (table->buckets == NULL || table->macros == NULL) {
         raise_error(MEM, NULL, __FILE__);
         return 0;
     }
+    MEM_ALLOC(MEM_MACROS, table->bucket_count * sizeof(uint32_t));
+    MEM_ALLOC(MEM_MACROS, table->cap * sizeof(Macro));
+
+    return 1;
+}
 
-    table->size = 0;
+// Returns the bucket holding the macro with the given name, or the empty bucket where it would go
+unsigned long mt_find_bucket(const MacroTable *table, const char *name) {
+    unsigned long index = hash_key(name, table->bucket_count);
+    while (table->buckets[index] != 0 && strcmp(table->macros[table->buckets[index] - 1].name, name) != 0) {
+        index = (index + 1) & (table->bucket_count - 1);
+    }
+    return index;
+}
 
-    // Fill with empty buckets
-    for (int i = 0; i < MACRO_TABLE_LENGTH; i++) {
-        const MacroBucket bucket = {.inUse = 0};
-        table->buckets[i] = bucket;
+// Doubles the number of buckets and reinserts every macro
+int mt_grow(MacroTable *table) {
+    uint32_t *old = table->buckets;
+    table->buckets = calloc(table->bucket_count * 2, sizeof(uint32_t));
+    if (table->buckets == NULL) {
+        table->buckets = old;
+        raise_error(MEM, NULL, __FILE__);
+        return 0;
     }
+    MEM_ALLOC(MEM_MACROS, table->bucket_count * 2 * sizeof(uint32_t));
+    free(old);
+    MEM_FREE(MEM_MACROS, table->bucket_count * sizeof(uint32_t));
+    table->bucket_count *= 2;
 
+    for (size_t i = 0; i < table->size; i++) {
+        table->buckets[mt_find_bucket(table, table->macros[i].name)] = (uint32_t) i + 1;
+    }
     return 1;
 }
 
+// Adds the macro to the table, which takes ownership of its template and arguments
 int mt_add(MacroTable *table, const Macro macro) {
-    unsigned long index = hash_key(macro.name, MACRO_TABLE_LENGTH);
-    while (table->buckets[index].inUse) {
-        if (strcmp(table->buckets[index].macro.name, macro.name) == 0) {
-            raise_error(DUPL_DEF, macro.name, __FILE__);
+    if (table->buckets[mt_find_bucket(table, macro.name)] != 0) {
+        raise_error(DUPL_DEF, macro.name, __FILE__);
+        return 0;
+    }
+
+    if ((table->size + 1) * 4 > table->bucket_count * 3 && mt_grow(table) == 0) return 0;
+    if (table->size >= table->cap) {
+        Macro *new = realloc(table->macros, table->cap * 2 * sizeof(Macro));
+        if (new == NULL) {
+            raise_error(MEM, NULL, __FILE__);
             return 0;
         }
-        index = (index + 1) % MACRO_TABLE_LENGTH;
+        MEM_GROW(MEM_MACROS, table->cap * sizeof(Macro), table->cap * 2 * sizeof(Macro));
+        table->macros = new;
+        table->cap *= 2;
     }
 
-    table->buckets[index].inUse = 1;
-    table->buckets[index].macro = macro;
+    table->macros[table->size] = macro;
     table->size++;
+    table->buckets[mt_find_bucket(table, macro.name)] = (uint32_t) table->size;
 
     return 1;
 }
 
+// Returns the index of the macro in table->macros, or MACRO_NOT_FOUND
 unsigned long mt_exists(const MacroTable *table, const char *name) {
-    unsigned long index = hash_key(name, MACRO_TABLE_LENGTH);
-    if (!table->buckets[index].inUse) {
-        return MACRO_TABLE_LENGTH;
-    }
-    int indices_searched = 0;
-    while (strcmp(name, table->buckets[index].macro.name) != 0) {
-        index = (index + 1) % MACRO_TABLE_LENGTH;
-        indices_searched++;
-        if (indices_searched == MACRO_TABLE_LENGTH) {
-            return MACRO_TABLE_LENGTH;
-        }
-    }
-    return index;
+    const uint32_t bucket = table->buckets[mt_find_bucket(table, name)];
+    if (bucket == 0) return MACRO_NOT_FOUND;
+    return bucket - 1;
 }
 
+// Returns the macro, which is valid until the next call to mt_add()
 Macro * mt_get(const MacroTable *table, const char *name) {
-    unsigned long index = mt_exists(table, name);
-    if (index == MACRO_TABLE_LENGTH) {
+    const unsigned long index = mt_exists(table, name);
+    if (index == MACRO_NOT_FOUND) {
         raise_error(TOKEN_ERR, name, __FILE__);
         return NULL;
     }
 
-    return &table->buckets[index].macro;
+    return &table->macros[index];
+}
+
+// Returns the table's copy of an argument name, adding it if needed
+const char * mt_intern(MacroTable *table, const char *name) {
+    for (size_t i = 0; i < table->arg_name_count; i++) {
+        if (strcmp(table->arg_names[i], name) == 0) return table->arg_names[i];
+    }
+
+    if (table->arg_name_count >= table->arg_name_cap) {
+        const size_t cap = table->arg_name_cap == 0 ? 16 : table->arg_name_cap * 2;
+        char **new = realloc(table->arg_names, cap * sizeof(char *));
+        if (new == NULL) {
+            raise_error(MEM, NULL, __FILE__);
+            return NULL;
+        }
+        MEM_GROW(MEM_MACROS, table->arg_name_cap * sizeof(char *), cap * sizeof(char *));
+        table->arg_names = new;
+        table->arg_name_cap = cap;
+    }
+
+    char *copy = malloc(strlen(name) + 1);
+    if (copy == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        return NULL;
+    }
+    MEM_ALLOC(MEM_MACROS, strlen(name) + 1);
+    strcpy(copy, name);
+    table->arg_names[table->arg_name_count++] = copy;
+    return copy;
 }
 
 void mt_destroy(const MacroTable *t) {
+    for (size_t i = 0; i < t->size; i++) {
+        macro_destroy(&t->macros[i]);
+    }
+    for (size_t i = 0; i < t->arg_name_count; i++) {
+        MEM_FREE(MEM_MACROS, strlen(t->arg_names[i]) + 1);
+        free(t->arg_names[i]);
+    }
+    free(t->arg_names);
+    free(t->macros);
     free(t->buckets);
+    MEM_FREE(MEM_MACROS, t->arg_name_cap * sizeof(char *));
+    MEM_FREE(MEM_MACROS, t->cap * sizeof(Macro));
+    MEM_FREE(MEM_MACROS, t->bucket_count * sizeof(uint32_t));
 }
 
 void mt_debug(const MacroTable *table) {
-    for (int i = 0; i < MACRO_TABLE_LENGTH; i++) {
-        if (table->buckets[i].inUse) {
-            macro_debug(&table->buckets[i].macro);
-        }
+    for (size_t i = 0; i < table->size; i++) {
+        macro_debug(&table->macros[i]);
     }
 }
 
+// Frees the macro's template and argument list; the argument names belong to the table
+void macro_destroy(const Macro *m) {
+    if (m->template != NULL) MEM_FREE(MEM_MACROS, m->template_length * sizeof(TemplateInstruction));
+    if (m->args != NULL) MEM_FREE(MEM_MACROS, m->argc * sizeof(char *));
+    free(m->template);
+    free(m->args);
+}
+
 void macro_debug(const Macro *m) {
     printf("macro \"%s\"\n", m->name);
     Line *cur = m->definition_start;
@@ -97,8 +174,99 @@ void macro_debug(const Macro *m) {
     }
 }
 
+// Parses a token (with an optional trailing comma) into a register or an immediate, as the first pass does
+// Returns 0 on failure
+int parse_operand(char *token, MacroOperand *operand) {
+    size_t len = strlen(token);
+    if (len > 1 && token[len-1] == ',') token[--len] = '\0'; // Remove comma
+
+    operand->reg = get_register(token);
+    operand->imm.type = NONE;
+    operand->imm.intValue = 0;
+    operand->imm.modifier = 0;
+    if (operand->reg != 255) return 1;
+
+    operand->imm = parse_imm(token);
+    return operand->imm.modifier != 255;
+}
+
+// Parses the body of a macro into a template of instructions whose operands may be argument slots
+// Leaves the template empty if the body can only be expanded as text; returns 0 on failure
+int compile_template(Macro *macro) {
+    macro->template = NULL;
+    macro->template_length = 0;
+    if (macro->definition_length == 0) return 1;
+
+    const size_t template_size = macro->definition_length * sizeof(TemplateInstruction);
+    TemplateInstruction *template = malloc(template_size);
+    if (template == NULL) {
+        raise_error(MEM, NULL, __FILE__);
+        return 0;
+    }
+    MEM_ALLOC(MEM_MACROS, template_size);
+
+    const Line *line = macro->definition_start;
+    for (size_t i = 0; i < macro->definition_length; i++, line = line->next) {
+        TemplateInstruction *instr = &template[i];
+        memset(instr, 0, sizeof(TemplateInstruction));
+
+        char buf[strlen(line->text)+1];
+        strcpy(buf, line->text);
+
+        // Labels and directives are left to the text expansion
+        char *token = tokenize(buf, ' ');
+        const size_t len = token == NULL ? 0 : strlen(token);
+        if (len == 0 || len >= MNEMONIC_LENGTH || token[0] == '.' || token[len-1] == ':') goto _text_only;
+        strcpy(instr->mnemonic, token);
+
+        while ((token = tokenize(NULL, ' ')) != NULL) {
+            if (instr->operand_count >= 3) goto _text_only;
+            MacroOperand *operand = &instr->operands[instr->operand_count++];
+
+            if (strchr(token, '%') == NULL) {
+                if (parse_operand(token, operand) == 0) {
+                    free(template);
+                    MEM_FREE(MEM_MACROS, template_size);
+                    return 0;
+                }
+                continue;
+            }
+
+            // Argument slot; the whole token must name an argument
+            size_t slot = 0;
+            while (slot < macro->argc && strcmp(macro->args[slot], token) != 0) slot++;
+            if (slot == macro->argc) goto _text_only;
+            operand->reg = 255;
+            operand->imm.type = NONE;
+            operand->imm.intValue = slot;
+            operand->imm.modifier = 254;
+        }
+    }
+
+    macro->template = template;
+    macro->template_length = macro->definition_length;
+    return 1;
+
+    _text_only:
+    free(template);
+    MEM_FREE(MEM_MACROS, template_size);
+    return 1;
+}
+
+// Returns whether the macro, and every macro it invokes, can be expanded from its template
+int template_complete(const MacroTable *table, const Macro *macro, const int depth) {
+    if (macro->template == NULL) return macro->definition_length == 0;
+    if (depth >= MACRO_MAX_DEPTH) return 1; // reported when the template is expanded
+
+    for (size_t i = 0; i < macro->template_length; i++) {
+        const unsigned long index = mt_exists(table, macro->template[i].mnemonic);
+        if (index != MACRO_NOT_FOUND && !template_complete(table, &table->macros[index], depth + 1)) return 0;
+    }
+    return 1;
+}
+
 // Returns last line (.end_macro ...)
-Line *define_macro(Macro *macro, const Line *line) {
+Line *define_macro(MacroTable *table, Macro *macro, const Line *line) {
 
     memset(macro, '\0', sizeof(Macro));
 
@@ -126,9 +294,10 @@ Line *define_macro(Macro *macro, const Line *line) {
     }
 
     // Get argument names (up to 32 arguments should be plenty)
+    const char *args[MACRO_MAX_ARGS];
     token = tokenize(NULL, ' ');
     size_t argc = 0;
-    while (argc < 32) {
+    while (argc < MACRO_MAX_ARGS) {
         if (token == NULL) break;
 
         if (strlen(token) >= 32 || token[0] != '%') {
@@ -136,17 +305,18 @@ Line *define_macro(Macro *macro, const Line *line) {
             return NULL;
         }
 
-        strcpy(macro->args[argc++], token);
-        for (size_t i = 1; i < strlen(macro->args[argc-1]); i++) {
-            if (!isalnum(macro->args[argc-1][i])) {
-                raise_error(SYMBOL_INV, macro->args[argc-1], __FILE__);
+        for (size_t i = 1; i < strlen(token); i++) {
+            if (!isalnum(token[i])) {
+                raise_error(SYMBOL_INV, token, __FILE__);
                 return NULL;
             }
         }
+        args[argc] = mt_intern(table, token);
+        if (args[argc++] == NULL) return NULL;
 
         token = tokenize(NULL, ' ');
     }
-    if (argc >= 32) {
+    if (argc >= MACRO_MAX_ARGS) {
         raise_error(ARGS_INV, NULL, __FILE__);
         return NULL;
     }
@@ -170,6 +340,21 @@ Line *define_macro(Macro *macro, const Line *line) {
         }
     }
 
+    if (argc > 0) {
+        macro->args = malloc(argc * sizeof(char *));
+        if (macro->args == NULL) {
+            raise_error(MEM, NULL, __FILE__);
+            return NULL;
+        }
+        MEM_ALLOC(MEM_MACROS, argc * sizeof(char *));
+        memcpy(macro->args, args, argc * sizeof(char *));
+        macro->argc = argc;
+    }
+
+    if (compile_template(macro) == 0) {
+        macro_destroy(macro);
+        return NULL;
+    }
     return temp;
 }
 
@@ -221,7 +406,7 @@ int insert_macro(Text *text_list, const MacroTable *table, const char *name, Lin
 
         // Initialize new line
         Line to_insert;
-        line_init(&to_insert, line->filename);
+        line_init(&to_insert, line->file);
         to_insert.number = line->number;
 
         // Read definition line
@@ -248,28 +433,27 @@ int insert_macro(Text *text_list, const MacroTable *table, const char *name, Lin
                 }
 
                 // Find index in macro->args
-                j = 0;
-                int res = 0;
-                while (strcmp(macro->args[j++], argbuf) != 0) {
-                    if (j == SYMBOL_SIZE || macro->args[j-1][0] == '\0') { // if we've checked every argument
-                        raise_error(ARG_INV, argbuf, __FILE__);
-                        return 0;
-                    }
+                size_t res = 0;
+                while (res < macro->argc && strcmp(macro->args[res], argbuf) != 0) res++;
+                if (res == macro->argc) { // if we've checked every argument
+                    raise_error(ARG_INV, argbuf, __FILE__);
+                    return 0;
                 }
-                res = j-1;
 
                 // Real argument is args[res]; copy that
                 for (size_t k = 0; k < strlen(args[res]); k++) {
                     line_add_char(&to_insert, args[res][k]);
                 }
 
-                // Add space
+                // Add space, or stop at the end of the definition line
+                if (end_char == '\0') break;
                 line_add_char(&to_insert, end_char);
             }
 
             // Otherwise insert normally
             else line_add_char(&to_insert, c);
         }
+        line_add_char(&to_insert, '\0');
 
         // Insert into text
         before = text_insert(text_list, to_insert, before);
@@ -281,6 +465,9 @@ int insert_macro(Text *text_list, const MacroTable *table, const char *name, Lin
     return 1;
 }
 
+// Expands li into the shortest sequence that loads the constant:
+// addiu (signed 16 bits), ori (unsigned 16 bits), lui (low half zero), or lui $at and ori
+// Returns the number of instructions added, or 0 on failure
 int li(const Instruction instruction, InstructionList* instructions) {
     // li $R IMM
     if (instruction.registers[1] != 255 || instruction.registers[2] != 255 || instruction.imm.type != NUM) {
@@ -289,25 +476,37 @@ int li(const Instruction instruction, InstructionList* instructions) {
     }
     const unsigned char r1 = instruction.registers[0];
     const Immediate imm = instruction.imm;
+    const uint32_t value = (uint32_t) imm.intValue;
 
     Instruction i1;
-    i1.line = instruction.line;
+    i1.loc = instruction.loc;
     memset(i1.mnemonic, '\0', sizeof(i1.mnemonic));
+    i1.registers[0] = r1;
+    i1.registers[1] = 0;
+    i1.registers[2] = 255;
 
     // Determine size
-    if (instruction.imm.intValue >= SHRT_MIN && instruction.imm.intValue <= SHRT_MAX) {
-        // 16-bit
-        // addi $R $0 IMM
+    if (imm.intValue >= SHRT_MIN && imm.intValue <= SHRT_MAX) {
+        // 16-bit signed
+        // addiu $R $0 IMM
         strcpy(i1.mnemonic, "addiu");
-        i1.registers[0] = r1;
-        i1.registers[1] = 0;
-        i1.registers[2] = 255;
         i1.imm = imm;
         if (add_instruction(instructions, i1) == 0) {
             return 0;
         }
         return 1;
     }
+    if (value <= 0xFFFF) {
+        // 16-bit unsigned
+        // ori $R $0 IMM
+        strcpy(i1.mnemonic, "ori");
+        i1.imm = imm;
+        if (add_instruction(instructions, i1) == 0) {
+            return 0;
+        }
+        return 1;
+    }
+
     // 32-bit
     const int32_t hi = imm.intValue >> 16;     // Sign extended upper 16-bits
     const int32_t lo = imm.intValue & 0x0000FFFF;  // Low 16-bits
@@ -315,11 +514,21 @@ int li(const Instruction instruction, InstructionList* instructions) {
     const Immediate hiImm = {NUM, .intValue = hi};
     const Immediate loImm = {NUM, .intValue = lo};
 
+    if (lo == 0) {
+        // lui $R %hi(IMM)
+        strcpy(i1.mnemonic, "lui");
+        i1.registers[1] = 255;
+        i1.imm = hiImm;
+        if (add_instruction(instructions, i1) == 0) {
+            return 0;
+        }
+        return 1;
+    }
+
     // lui $1 %hi(IMM)
     strcpy(i1.mnemonic, "lui");
     i1.registers[0] = 1;
     i1.registers[1] = 255;
-    i1.registers[2] = 255;
     i1.imm = hiImm;
 
     // ori $R $1 %lo(IMM)
@@ -329,7 +538,7 @@ int li(const Instruction instruction, InstructionList* instructions) {
     i2.registers[0] = r1;
     i2.registers[1] = 1;
     i2.registers[2] = 255;
-    i2.line = instruction.line;
+    i2.loc = instruction.loc;
     i2.imm = loImm;
 
     if (add_instruction(instructions, i1) == 0 || add_instruction(instructions, i2) == 0) {
@@ -349,6 +558,22 @@ int la(const Instruction instruction, InstructionList* instructions) {
         return 0;
     }
 
+    // Small data: addiu $R $gp label (offset from $gp)
+    if (imm.modifier == 3) {
+        Instruction i1;
+        memset(i1.mnemonic, '\0', sizeof(i1.mnemonic));
+        strcpy(i1.mnemonic, "addiu");
+        i1.registers[0] = r1;
+        i1.registers[1] = GP_REGISTER;
+        i1.registers[2] = 255;
+        i1.loc = instruction.loc;
+        i1.imm = imm;
+        if (add_instruction(instructions, i1) == 0) {
+            return 0;
+        }
+        return 1;
+    }
+
     // lui $at %hi(label)
     Instruction i1;
     memset(i1.mnemonic, '\0', sizeof(i1.mnemonic));
@@ -356,7 +581,7 @@ int la(const Instruction instruction, InstructionList* instructions) {
     i1.registers[0] = 1;
     i1.registers[1] = 255;
     i1.registers[2] = 255;
-    i1.line = instruction.line;
+    i1.loc = instruction.loc;
 
     // Take the low bits of the immediate
     Immediate hiImm;
@@ -372,7 +597,7 @@ int la(const Instruction instruction, InstructionList* instructions) {
     i2.registers[0] = r1;
     i2.registers[1] = 1;
     i2.registers[2] = 255;
-    i2.line = instruction.line;
+    i2.loc = instruction.loc;
 
     // Take the lo bits of the immediate
     Immediate loImm;
@@ -3,6 +3,7 @@
 //
 
 #include "reloc_table.h"
+#include "stats.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -21,11 +22,13 @@ int rt_init(RelocationTable *table) {
         raise_error(MEM, NULL, __FILE__);
         return 0;
     }
+    MEM_ALLOC(MEM_RELOCATIONS, table->cap * sizeof(RelocationEntry));
     return 1;
 }
 
 // Initializes a RelocationEntry
 int re_init(RelocationEntry *reloc, uint32_t offset, enum Segment segment, enum RelocType reloc_type, const char *dependency) {
+    memset(reloc, 0, sizeof(RelocationEntry)); // entries are written to object files as is, so clear the unused bytes
     reloc->target_offset = offset;
     reloc->reloc_type = reloc_type;
     reloc->segment = segment;
@@ -43,6 +46,7 @@ int rt_add(RelocationTable *table, RelocationEntry entry) {
         table->cap *= 2;
         RelocationEntry *new = realloc(table->list, table->cap * sizeof(RelocationEntry));
         if (new == NULL) return 0;
+        MEM_GROW(MEM_RELOCATIONS, table->cap / 2 * sizeof(RelocationEntry), table->cap * sizeof(RelocationEntry));
         table->list = new;
     }
     table->list[table->len] = entry;
@@ -53,6 +57,7 @@ int rt_add(RelocationTable *table, RelocationEntry entry) {
 // Frees resources
 void rt_destroy(const RelocationTable *table) {
     free(table->list);
+    MEM_FREE(MEM_RELOCATIONS, table->cap * sizeof(RelocationEntry));
 }
 
 void rt_debug(const RelocationTable *table) {
@@ -62,9 +67,11 @@ void rt_debug(const RelocationTable *table) {
 }
 
 void re_debug(const RelocationEntry entry) {
-    char segment[6];
+    char segment[7];
     if (entry.segment == TEXT) {
         strcpy(segment, ".text");
+    } else if (entry.segment == SDATA) {
+        strcpy(segment, ".sdata");
     } else {
         strcpy(segment, ".data");
     }
@@ -0,0 +1,322 @@
+#include "server.h"
+#include "instructions.h"
+#include "preprocess.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Server
+
+Keeps an assembler resident so that builds do not pay for process startup or for
+setting up the instruction table each time.
+Requests are handled one at a time, in the order they are accepted: the assembler
+relies on global state (ERROR_HANDLER, tokenize()) and writes diagnostics to stderr,
+which is captured and returned to the client.
+
+See server.h for the protocol.
+*/
+
+/* === SOCKET I/O === */
+
+// Reads exactly `len` bytes; returns success
+int read_all(const int fd, void *buf, size_t len) {
+    uint8_t *b = buf;
+    while (len > 0) {
+        const ssize_t n = read(fd, b, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        b += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// Writes exactly `len` bytes; returns success
+int write_all(const int fd, const void *buf, size_t len) {
+    const uint8_t *b = buf;
+    while (len > 0) {
+        const ssize_t n = write(fd, b, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        b += n;
+        len -= n;
+    }
+    return 1;
+}
+
+int send_word(const int fd, const uint32_t word) {
+    return write_all(fd, &word, sizeof(word));
+}
+
+int recv_word(const int fd, uint32_t *word) {
+    return read_all(fd, word, sizeof(*word));
+}
+
+int send_string(const int fd, const char *str, const uint32_t len) {
+    return send_word(fd, len) && write_all(fd, str, len);
+}
+
+// Receives a string, null-terminated; returns NULL on failure. Must be freed by the caller
+char * recv_string(const int fd, uint32_t *len) {
+    uint32_t n;
+    if (recv_word(fd, &n) == 0) return NULL;
+    char *str = malloc((size_t) n + 1);
+    if (str == NULL) return NULL;
+    if (read_all(fd, str, n) == 0) {
+        free(str);
+        return NULL;
+    }
+    str[n] = '\0';
+    if (len != NULL) *len = n;
+    return str;
+}
+
+// Opens a socket at the given path, either listening on it or connected to it
+int open_socket(const char *socket_path, const int listening) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error in %s: socket path \"%s\" is too long\n", __FILE__, socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        general_error(FILE_IO, __FILE__, socket_path);
+        return -1;
+    }
+
+    if (listening) {
+        unlink(socket_path); // left over from a previous server
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+            general_error(FILE_IO, __FILE__, socket_path);
+            close(fd);
+            return -1;
+        }
+    } else if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        general_error(FILE_IO, __FILE__, socket_path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* === SERVER === */
+
+typedef struct {
+    int argc;
+    char **argv;          // argv[0] is the program name, as in main()
+    char *cwd;
+    InlineSource *sources;
+    uint32_t source_count;
+} Request;
+
+void request_destroy(const Request *request) {
+    for (int i = 0; i < request->argc; i++) {
+        free(request->argv[i]);
+    }
+    free(request->argv);
+    free(request->cwd);
+    for (uint32_t i = 0; i < request->source_count; i++) {
+        free((char *) request->sources[i].path);
+        free((char *) request->sources[i].text);
+    }
+    free(request->sources);
+}
+
+// Reads a request from the client; returns success
+int read_request(const int fd, Request *request) {
+    memset(request, 0, sizeof(Request));
+
+    uint32_t magic, argc;
+    if (recv_word(fd, &magic) == 0 || magic != SERVER_MAGIC || recv_word(fd, &argc) == 0 || argc > 65536) return 0;
+
+    request->argv = calloc(argc + 2, sizeof(char *));
+    if (request->argv == NULL) return 0;
+    request->argv[request->argc++] = strdup("mips_assembler");
+    for (uint32_t i = 0; i < argc; i++) {
+        request->argv[request->argc] = recv_string(fd, NULL);
+        if (request->argv[request->argc] == NULL) return 0;
+        request->argc++;
+    }
+
+    request->cwd = recv_string(fd, NULL);
+    uint32_t source_count;
+    if (request->cwd == NULL || recv_word(fd, &source_count) == 0 || source_count > 65536) return 0;
+
+    request->sources = calloc(source_count + 1, sizeof(InlineSource));
+    if (request->sources == NULL) return 0;
+    for (uint32_t i = 0; i < source_count; i++) {
+        uint32_t len;
+        request->sources[i].path = recv_string(fd, NULL);
+        if (request->sources[i].path == NULL) return 0;
+        request->source_count++;
+        request->sources[i].text = recv_string(fd, &len);
+        if (request->sources[i].text == NULL) return 0;
+        request->sources[i].len = len;
+    }
+    return 1;
+}
+
+// Runs the request with stdout and stderr redirected to a temporary file, and sends the result
+int handle_request(const int fd, const Request *request, int (*handler)(int, char **)) {
+    FILE *output = tmpfile();
+    if (output == NULL || chdir(request->cwd) != 0) {
+        const char *msg = "mips_assembler server: could not set up request\n";
+        if (output != NULL) fclose(output);
+        return send_word(fd, 1) && send_string(fd, msg, strlen(msg));
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    const int saved_stdout = dup(STDOUT_FILENO);
+    const int saved_stderr = dup(STDERR_FILENO);
+    dup2(fileno(output), STDOUT_FILENO);
+    dup2(fileno(output), STDERR_FILENO);
+
+    set_inline_sources(request->sources, request->source_count);
+    ERROR_HANDLER.line = NULL;
+    const int status = handler(request->argc, request->argv);
+    set_inline_sources(NULL, 0);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_stdout, STDOUT_FILENO);
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stdout);
+    close(saved_stderr);
+
+    // Send status and captured output
+    const long size = lseek(fileno(output), 0, SEEK_END);
+    char *text = malloc(size > 0 ? size : 1);
+    int success = text != NULL && size >= 0 && lseek(fileno(output), 0, SEEK_SET) == 0;
+    success = success && read_all(fileno(output), text, size);
+    success = success && send_word(fd, (uint32_t) status) && send_string(fd, text, size);
+    free(text);
+    fclose(output);
+    return success;
+}
+
+// Runs the server until a request with no arguments is received
+int server_run(const char *socket_path, int (*handler)(int argc, char *argv[])) {
+    // Set up everything that is shared between requests before changing directories
+    if (it_shared() == NULL) return 1;
+
+    const int server = open_socket(socket_path, 1);
+    if (server < 0) return 1;
+    signal(SIGPIPE, SIG_IGN); // clients may disconnect early
+
+    int running = 1;
+    while (running) {
+        const int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            general_error(FILE_IO, __FILE__, socket_path);
+            break;
+        }
+
+        Request request;
+        if (read_request(client, &request)) {
+            if (request.argc <= 1) {
+                send_word(client, 0);
+                send_string(client, "", 0);
+                running = 0;
+            } else {
+                handle_request(client, &request, handler);
+            }
+        }
+        request_destroy(&request);
+        close(client);
+    }
+
+    close(server);
+    unlink(socket_path);
+    return 0;
+}
+
+/* === CLIENT === */
+
+// Reads a whole file into memory; returns NULL on failure. Must be freed by the caller
+char * read_source(const char *path, uint32_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) return NULL;
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = size >= 0 ? malloc(size > 0 ? size : 1) : NULL;
+    if (text != NULL && fread(text, 1, size, f) != (size_t) size) {
+        free(text);
+        text = NULL;
+    }
+    fclose(f);
+    *len = (uint32_t) size;
+    return text;
+}
+
+// Returns whether the argument names an .asm file that exists
+int is_source(const char *arg) {
+    const size_t len = strlen(arg);
+    struct stat st;
+    return len > 4 && strcmp(arg + len - 4, ".asm") == 0 && stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+int client_run(const char *socket_path, const int argc, char *argv[], const int send_inline) {
+    const int fd = open_socket(socket_path, 0);
+    if (fd < 0) return 1;
+
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        general_error(FILE_IO, __FILE__, ".");
+        close(fd);
+        return 1;
+    }
+
+    int success = send_word(fd, SERVER_MAGIC) && send_word(fd, (uint32_t) argc);
+    for (int i = 0; success && i < argc; i++) {
+        success = send_string(fd, argv[i], strlen(argv[i]));
+    }
+    success = success && send_string(fd, cwd, strlen(cwd));
+
+    // Inline sources
+    uint32_t source_count = 0;
+    for (int i = 0; send_inline && i < argc; i++) {
+        source_count += is_source(argv[i]);
+    }
+    success = success && send_word(fd, source_count);
+    for (int i = 0; success && source_count > 0 && i < argc; i++) {
+        if (!is_source(argv[i])) continue;
+        uint32_t len;
+        char *text = read_source(argv[i], &len);
+        if (text == NULL) {
+            general_error(FILE_IO, __FILE__, argv[i]);
+            close(fd);
+            return 1;
+        }
+        success = send_string(fd, argv[i], strlen(argv[i])) && send_string(fd, text, len);
+        free(text);
+    }
+
+    // Response
+    uint32_t status = 1;
+    char *output = NULL;
+    uint32_t output_len = 0;
+    success = success && recv_word(fd, &status) && (output = recv_string(fd, &output_len)) != NULL;
+    close(fd);
+    if (!success) {
+        fprintf(stderr, "Error in %s: no response from server at \"%s\"\n", __FILE__, socket_path);
+        return 1;
+    }
+
+    fwrite(output, 1, output_len, stderr);
+    free(output);
+    return (int) status;
+}
@@ -0,0 +1,21 @@
+#include "linker.h"
+
+/* Startup object
+
+The object assembled from __start.asm at build time, embedded in the executable so the linker
+does not need to find __start.o on disk. The Makefile compiles this file twice:
+ - without START_OBJECT_INC, for the bootstrap assembler that assembles __start.asm
+ - with START_OBJECT_INC, which includes the bytes of the resulting object
+*/
+
+#ifdef START_OBJECT_INC
+static const uint8_t start_object_bytes[] = {
+#include "start_object.inc"
+};
+
+const uint8_t *START_OBJECT = start_object_bytes;
+const uint32_t START_OBJECT_SIZE = sizeof(start_object_bytes);
+#else
+const uint8_t *START_OBJECT = NULL;
+const uint32_t START_OBJECT_SIZE = 0;
+#endif
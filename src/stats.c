@@ -0,0 +1,297 @@
+#include "stats.h"
+#include "utils.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Stats
+
+Times the phases of a build and counts what went through them, for --time-report and --stats-json.
+Recording is compiled in everywhere but guarded by STATS_ENABLED, so a disabled build only pays for a test.
+
+Totals are shared by every thread: in batch mode, the time of a phase is summed over all targets
+and may exceed the wall-clock total.
+
+With --trace, each span (a phase of one file) is also kept, with the thread it ran on, and written
+at the end as Chrome trace-event JSON, which chrome://tracing, Perfetto and speedscope can open.
+
+With --mem-report, the data structures record their allocations, and the totals are printed after
+each file is assembled and each executable is linked. Those totals are per thread, since a thread
+assembles or links one file at a time, and are reset at the start of each.
+*/
+
+int STATS_ENABLED = 0;
+int TRACE_ENABLED = 0;
+int MEMORY_ENABLED = 0;
+
+const char *PHASE_NAMES[PHASE_COUNT] = {
+    "preprocess", "macro_expansion", "first_pass", "encoding", "relocation_writing",
+    "object_loading", "relocation_resolution", "output_writing", "total"
+};
+
+const char *COUNTER_NAMES[COUNTER_COUNT] = {
+    "lines", "instructions", "data_bytes", "symbols", "relocations", "macro_expansions", "objects_linked",
+    "peephole_removed", "delay_slots_filled", "branches_relaxed", "gc_removed_bytes", "icf_folded_bytes", "strings_merged_bytes",
+    "functions_ordered"
+};
+
+_Atomic uint64_t PHASE_TIME[PHASE_COUNT];  // nanoseconds
+_Atomic uint64_t PHASE_CALLS[PHASE_COUNT];
+_Atomic uint64_t COUNTERS[COUNTER_COUNT];
+
+int TIME_REPORT = 0;              // Print the table to stderr
+const char *STATS_JSON = NULL;    // Write the JSON document to this file ("-" for stdout)
+const char *TRACE_PATH = NULL;    // Write the trace to this file ("-" for stdout)
+
+typedef struct {
+    const char *name;
+    const char *category;
+    char *file;                   // Copied, since the span may outlive the path
+    uint64_t start;               // nanoseconds, from stats_now()
+    uint64_t duration;
+    unsigned int thread;
+} TraceSpan;
+
+TraceSpan *TRACE_SPANS = NULL;
+size_t TRACE_SPAN_COUNT = 0;
+size_t TRACE_SPAN_CAP = 0;
+uint64_t TRACE_START = 0;
+pthread_mutex_t TRACE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+atomic_uint TRACE_THREADS = 0;
+_Thread_local unsigned int TRACE_THREAD = 0; // 0 until the thread records its first span
+
+const char *MEMORY_NAMES[MEM_KIND_COUNT] = {
+    "text", "instructions", "data", "symbols", "relocations", "macros"
+};
+
+typedef struct {
+    uint64_t allocated;           // Bytes requested by allocations and reallocations
+    uint64_t allocations;
+    uint64_t growths;             // Reallocations to a larger size
+    uint64_t live;                // Bytes currently allocated
+    uint64_t peak;
+} MemoryStats;
+
+_Thread_local MemoryStats MEMORY[MEM_KIND_COUNT];
+_Thread_local uint64_t MEMORY_LIVE = 0;  // Sum of live bytes over every kind
+_Thread_local uint64_t MEMORY_PEAK = 0;
+
+/* === RECORDING === */
+
+// Returns a monotonic time in nanoseconds
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// Adds the time since start (from stats_now()) to the phase
+void stats_stop(const enum StatsPhase phase, const uint64_t start) {
+    atomic_fetch_add(&PHASE_TIME[phase], stats_now() - start);
+    atomic_fetch_add(&PHASE_CALLS[phase], 1);
+}
+
+void stats_add(const enum StatsCounter counter, const uint64_t n) {
+    atomic_fetch_add(&COUNTERS[counter], n);
+}
+
+// Records a span of the trace from start (from stats_now()) to now; `file` may be NULL
+// Spans that cannot be recorded for lack of memory are dropped
+void trace_span(const char *name, const char *category, const char *file, const uint64_t start) {
+    TraceSpan span;
+    span.name = name;
+    span.category = category;
+    span.file = file != NULL ? strdup(file) : NULL;
+    span.start = start;
+    span.duration = stats_now() - start;
+    if (TRACE_THREAD == 0) TRACE_THREAD = atomic_fetch_add(&TRACE_THREADS, 1) + 1;
+    span.thread = TRACE_THREAD;
+
+    pthread_mutex_lock(&TRACE_LOCK);
+    if (TRACE_SPAN_COUNT >= TRACE_SPAN_CAP) {
+        const size_t cap = TRACE_SPAN_CAP == 0 ? 256 : TRACE_SPAN_CAP * 2;
+        TraceSpan *new = realloc(TRACE_SPANS, cap * sizeof(TraceSpan));
+        if (new == NULL) {
+            pthread_mutex_unlock(&TRACE_LOCK);
+            free(span.file);
+            return;
+        }
+        TRACE_SPANS = new;
+        TRACE_SPAN_CAP = cap;
+    }
+    TRACE_SPANS[TRACE_SPAN_COUNT++] = span;
+    pthread_mutex_unlock(&TRACE_LOCK);
+}
+
+void mem_alloc(const enum MemoryKind kind, const size_t bytes) {
+    MemoryStats *stats = &MEMORY[kind];
+    stats->allocated += bytes;
+    stats->allocations++;
+    stats->live += bytes;
+    if (stats->live > stats->peak) stats->peak = stats->live;
+    MEMORY_LIVE += bytes;
+    if (MEMORY_LIVE > MEMORY_PEAK) MEMORY_PEAK = MEMORY_LIVE;
+}
+
+void mem_grow(const enum MemoryKind kind, const size_t old_bytes, const size_t new_bytes) {
+    mem_alloc(kind, new_bytes);
+    mem_free(kind, old_bytes);
+    MEMORY[kind].allocations--;
+    MEMORY[kind].growths++;
+}
+
+void mem_free(const enum MemoryKind kind, const size_t bytes) {
+    MEMORY[kind].live -= bytes;
+    MEMORY_LIVE -= bytes;
+}
+
+// Starts accounting for a new file on this thread
+void mem_reset(void) {
+    memset(MEMORY, 0, sizeof(MEMORY));
+    MEMORY_LIVE = 0;
+    MEMORY_PEAK = 0;
+}
+
+// Prints the totals since mem_reset(); `step` is what was done to the file at path
+// Bytes still live once the structures are destroyed have leaked
+void mem_print(FILE *file, const char *step, const char *path) {
+    flockfile(file); // keep reports from different threads apart
+    fprintf(file, "memory (%s %s):\n", step, path);
+    fprintf(file, "  %-14s %12s %12s %10s %12s %10s\n", "structure", "allocated", "allocations", "growths", "peak live", "live");
+    for (int i = 0; i < MEM_KIND_COUNT; i++) {
+        const MemoryStats *stats = &MEMORY[i];
+        fprintf(file, "  %-14s %12llu %12llu %10llu %12llu %10llu\n", MEMORY_NAMES[i],
+            (unsigned long long) stats->allocated, (unsigned long long) stats->allocations,
+            (unsigned long long) stats->growths, (unsigned long long) stats->peak, (unsigned long long) stats->live);
+    }
+    fprintf(file, "  %-14s %12s %12s %10s %12llu %10llu\n", "total", "", "", "",
+        (unsigned long long) MEMORY_PEAK, (unsigned long long) MEMORY_LIVE);
+    funlockfile(file);
+}
+
+/* === REPORTING === */
+
+int stats_options(int *argc, char *argv[]) {
+    int arg = 1;
+    while (arg < *argc) {
+        if (strcmp(argv[arg], "--time-report") == 0) {
+            TIME_REPORT = 1;
+        }
+        else if (strcmp(argv[arg], "--stats-json") == 0 && arg+1 < *argc) {
+            STATS_JSON = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--mem-report") == 0) {
+            MEMORY_ENABLED = 1;
+        }
+        else if (strcmp(argv[arg], "--trace") == 0 && arg+1 < *argc) {
+            TRACE_PATH = argv[++arg];
+        }
+        else if (strcmp(argv[arg], "--stats-json") == 0 || strcmp(argv[arg], "--trace") == 0) {
+            fprintf(stderr, "error in %s: invalid arguments\n", __FILE__);
+            return 0;
+        }
+        else break;
+        arg++;
+    }
+
+    // Shift the remaining arguments into place
+    const int removed = arg - 1;
+    for (int i = arg; i <= *argc; i++) {
+        argv[i - removed] = argv[i]; // includes the terminating NULL
+    }
+    *argc -= removed;
+    TRACE_ENABLED = TRACE_PATH != NULL;
+    STATS_ENABLED = TIME_REPORT || STATS_JSON != NULL || TRACE_ENABLED;
+    if (TRACE_ENABLED) TRACE_START = stats_now();
+    return 1;
+}
+
+// Writes a report to the file at path, or to stdout if path is "-"; returns success
+int write_report(const char *path, void (*write)(FILE *)) {
+    FILE *file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (file == NULL) {
+        general_error(FILE_IO, __FILE__, path);
+        return 0;
+    }
+    write(file);
+    if (file != stdout && fclose(file) != 0) {
+        general_error(FILE_IO, __FILE__, path);
+        return 0;
+    }
+    return 1;
+}
+
+int stats_report(void) {
+    int success = 1;
+    if (TIME_REPORT) stats_print(stderr);
+    if (STATS_JSON != NULL) success = write_report(STATS_JSON, stats_json);
+    if (TRACE_PATH != NULL) success = write_report(TRACE_PATH, trace_json) && success;
+
+    for (size_t i = 0; i < TRACE_SPAN_COUNT; i++) {
+        free(TRACE_SPANS[i].file);
+    }
+    free(TRACE_SPANS);
+    TRACE_SPANS = NULL;
+    TRACE_SPAN_COUNT = 0;
+    TRACE_SPAN_CAP = 0;
+    return success;
+}
+
+void stats_print(FILE *file) {
+    fprintf(file, "%-24s %12s %10s\n", "phase", "time (ms)", "calls");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const uint64_t calls = atomic_load(&PHASE_CALLS[i]);
+        if (calls == 0) continue;
+        fprintf(file, "%-24s %12.3f %10llu\n", PHASE_NAMES[i], atomic_load(&PHASE_TIME[i]) / 1e6, (unsigned long long) calls);
+    }
+    fprintf(file, "\n%-24s %12s\n", "counter", "value");
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        fprintf(file, "%-24s %12llu\n", COUNTER_NAMES[i], (unsigned long long) atomic_load(&COUNTERS[i]));
+    }
+}
+
+void stats_json(FILE *file) {
+    fprintf(file, "{\n  \"phases\": {\n");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(file, "    \"%s\": {\"seconds\": %.9f, \"calls\": %llu}%s\n", PHASE_NAMES[i],
+            atomic_load(&PHASE_TIME[i]) / 1e9, (unsigned long long) atomic_load(&PHASE_CALLS[i]), i+1 < PHASE_COUNT ? "," : "");
+    }
+    fprintf(file, "  },\n  \"counters\": {\n");
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        fprintf(file, "    \"%s\": %llu%s\n", COUNTER_NAMES[i], (unsigned long long) atomic_load(&COUNTERS[i]), i+1 < COUNTER_COUNT ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+}
+
+// Writes a string as a JSON string literal
+void json_string(FILE *file, const char *str) {
+    fputc('"', file);
+    for (; *str != '\0'; str++) {
+        const unsigned char c = *str;
+        if (c == '"' || c == '\\') fprintf(file, "\\%c", c);
+        else if (c < 0x20) fprintf(file, "\\u%04x", c);
+        else fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+// Writes the spans as complete ("X") events, in microseconds since the start of the build
+void trace_json(FILE *file) {
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (size_t i = 0; i < TRACE_SPAN_COUNT; i++) {
+        const TraceSpan *span = &TRACE_SPANS[i];
+        fprintf(file, "  {\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u",
+            span->name, span->category, (span->start - TRACE_START) / 1e3, span->duration / 1e3, span->thread);
+        if (span->file != NULL) {
+            fprintf(file, ", \"args\": {\"file\": ");
+            json_string(file, span->file);
+            fputc('}', file);
+        }
+        fprintf(file, "}%s\n", i+1 < TRACE_SPAN_COUNT ? "," : "");
+    }
+    fprintf(file, "]}\n");
+}
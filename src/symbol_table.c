@@ -1,4 +1,5 @@
 #include "symbol_table.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,6 +21,7 @@ int st_init(SymbolTable *table) {
         raise_error(MEM, NULL, __FILE__);
         return 0;
     }
+    MEM_ALLOC(MEM_SYMBOLS, SYMBOL_TABLE_SIZE * sizeof(SymbolBucket *));
 
     table->size = 0;
 
@@ -40,8 +42,10 @@ int st_add_struct(SymbolTable *table, const Symbol symbol) {
             raise_error(MEM, NULL, __FILE__);
             return 0;
         }
+        MEM_ALLOC(MEM_SYMBOLS, sizeof(SymbolBucket));
         table->buckets[index] = new;
         table->buckets[index]->item = symbol;
+        table->buckets[index]->next = NULL;
         table->size++;
     } else {
         SymbolBucket *prev = NULL;
@@ -66,8 +70,10 @@ int st_add_struct(SymbolTable *table, const Symbol symbol) {
             raise_error(MEM, NULL, __FILE__);
             return 0;
         }
+        MEM_ALLOC(MEM_SYMBOLS, sizeof(SymbolBucket));
         if (prev != NULL) prev->next = new;
         new->item = symbol;
+        new->next = NULL;
         table->size++;
     }
 
@@ -82,6 +88,7 @@ int st_add_symbol(SymbolTable * table, const char *name, const uint32_t offset,
     }
 
     Symbol s;
+    memset(&s, 0, sizeof(s)); // symbols are written to object files as is, so clear the unused bytes
     if (strlen(name) >= SYMBOL_SIZE) {
         raise_error(SYMBOL_INV, name, __FILE__);
         return 0;
@@ -140,6 +147,7 @@ void bucket_destroy(SymbolBucket *bucket) {
     if (bucket == NULL) return;
     if (bucket->next != NULL) bucket_destroy(bucket->next);
     free(bucket);
+    MEM_FREE(MEM_SYMBOLS, sizeof(SymbolBucket));
 }
 
 // Frees resources
@@ -148,6 +156,7 @@ void st_destroy(const SymbolTable *t) {
         bucket_destroy(t->buckets[i]);
     }
     free(t->buckets);
+    MEM_FREE(MEM_SYMBOLS, SYMBOL_TABLE_SIZE * sizeof(SymbolBucket *));
 }
 
 void symbol_debug(const Symbol s) {
@@ -155,6 +164,8 @@ void symbol_debug(const Symbol s) {
         printf("%s: .text + %d, binding %d\n", s.name, s.offset, s.binding);
     else if (s.segment == DATA)
         printf("%s: .data + %d, binding %d\n", s.name, s.offset, s.binding);
+    else if (s.segment == SDATA)
+        printf("%s: .sdata + %d, binding %d\n", s.name, s.offset, s.binding);
     else if (s.segment == UNDEF)
         printf("%s: undefined, binding %d\n", s.name, s.binding);
 }
@@ -1,8 +1,8 @@
 #include "text.h"
 
 #include <stdlib.h>
-#include <string.h>
 
+#include "stats.h"
 #include "utils.h"
 
 /* Text
@@ -11,32 +11,26 @@ Used by the preprocessor to store the preprocessed input file
 Implemented as a linked list of Line structures,
 itself a dynamic array of characters.
 
-Lines also contain information for error handling (filename and number)
+Lines also contain information for error handling (file and number);
+files are numbered by the Text, which keeps their paths
 */
 
 // Initializes and allocates memory
-int line_init(Line *line, const char *fileName) {
+int line_init(Line *line, const uint32_t file) {
     line->len = 0;
     line->cap = 64;
     line->number = -1;
+    line->file = file;
     line->next = NULL;
     line->prev = NULL;
 
     char *text = malloc(line->cap);
     if (text == NULL) {
         general_error(MEM, __FILE__, NULL);
-    }
-    line->text = text;
-
-    char *fname = malloc(strlen(fileName)+1);
-    if (fname == NULL) {
-        free(text);
-        general_error(MEM, __FILE__, NULL);
         return 0;
     }
-
-    strcpy(fname, fileName);
-    line->filename = fname;
+    MEM_ALLOC(MEM_TEXT, line->cap);
+    line->text = text;
     return 1;
 }
 
@@ -49,6 +43,7 @@ int line_add_char(Line * line, const char c) {
             general_error(MEM, __FILE__, NULL);
             return 0;
         }
+        MEM_GROW(MEM_TEXT, line->cap / 2, line->cap);
         line->text = new;
     }
     line->text[line->len] = c;
@@ -56,21 +51,29 @@ int line_add_char(Line * line, const char c) {
     return 1;
 }
 
-// Frees resources (text and filename)
+// Frees resources
 void line_destroy(Line *line) {
-    if (line->filename != NULL) {
-        free(line->filename);
-    }
     if (line->text != NULL) {
         free(line->text);
+        MEM_FREE(MEM_TEXT, line->cap);
     }
 }
 
+// Returns the location of the line, which remains valid after the line is freed
+SourceLoc line_loc(const Line *line) {
+    SourceLoc loc;
+    loc.file = line->file;
+    loc.number = line->number;
+    return loc;
+}
+
 // Initializes and allocates memory
 int text_init(Text *text) {
     text->len = 0;
     text->head = NULL;
     text->tail = NULL;
+    text->files = NULL;
+    text->file_count = 0;
     return 1;
 }
 
@@ -81,6 +84,7 @@ int text_add(Text *text, const Line line) {
         raise_error(MEM, __FILE__, NULL);
         return 0;
     }
+    MEM_ALLOC(MEM_TEXT, sizeof(Line));
     *ptr = line;
 
     if (text->len == 0) {
@@ -106,6 +110,7 @@ Line * text_insert(Text *text, Line line, Line *before) {
         raise_error(MEM, __FILE__, NULL);
         return 0;
     }
+    MEM_ALLOC(MEM_TEXT, sizeof(Line));
     *ptr = line;
 
     // before -> ptr -> old
@@ -119,8 +124,8 @@ Line * text_insert(Text *text, Line line, Line *before) {
     return ptr;
 }
 
-// Removes the line at that pointer and returns its value
-Line text_remove(Text *text, Line *line) {
+// Removes the line at that pointer and frees it
+void text_remove(Text *text, Line *line) {
     // line.prev -> line -> line.next
     // line.prev -> line.next
 
@@ -135,9 +140,44 @@ Line text_remove(Text *text, Line *line) {
     } else next->prev = prev;
 
     text->len--;
-    const Line ret = *line;
     line_destroy(line);
-    return ret;
+    free(line);
+    MEM_FREE(MEM_TEXT, sizeof(Line));
+}
+
+// Adds a source file to the file table, setting `file` to its index. The path must outlive the Text
+int text_add_file(Text *text, const char *path, uint32_t *file) {
+    const char **new = realloc(text->files, (text->file_count + 1) * sizeof(char *));
+    if (new == NULL) {
+        general_error(MEM, __FILE__, NULL);
+        return 0;
+    }
+    MEM_GROW(MEM_TEXT, text->file_count * sizeof(char *), (text->file_count + 1) * sizeof(char *));
+    text->files = new;
+    text->files[text->file_count] = path;
+    *file = text->file_count++;
+    return 1;
+}
+
+// Returns the path of a source file, or "?" if it is not in the file table
+const char * text_filename(const Text *text, const uint32_t file) {
+    if (text == NULL || file >= text->file_count) return "?";
+    return text->files[file];
+}
+
+// Frees every line, keeping the file table so that locations can still be reported
+void text_clear(Text *text) {
+    Line *cur = text->head;
+    while (cur != NULL) {
+        Line *next = cur->next;
+        line_destroy(cur);
+        free(cur);
+        MEM_FREE(MEM_TEXT, sizeof(Line));
+        cur = next;
+    }
+    text->head = NULL;
+    text->tail = NULL;
+    text->len = 0;
 }
 
 // Frees resources (internal array and all Line resources)
@@ -146,8 +186,12 @@ void text_destroy(const Text *text) {
     while (cur != NULL) {
         Line *next = cur->next;
         line_destroy(cur);
+        free(cur);
+        MEM_FREE(MEM_TEXT, sizeof(Line));
         cur = next;
     }
+    free(text->files);
+    MEM_FREE(MEM_TEXT, text->file_count * sizeof(char *));
 }
 
 void text_debug(const Text * text) {
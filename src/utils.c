@@ -1,5 +1,6 @@
 #include "utils.h"
 
+#include "preprocess.h"
 #include "symbol_table.h"
 #include "reloc_table.h"
 
@@ -7,6 +8,7 @@
 #include <ctype.h>
 #include <stddef.h>
 #include <string.h>
+#include <unistd.h>
 
 const char *REGISTERS[REGISTER_COUNT] = {
     "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3", "$t0", "$t1", "$t2", "$t3", "$t4", "$t5",
@@ -50,7 +52,7 @@ Immediate parse_imm(const char * str) {
     }
 
     // NUMBER
-    if (isnumber(str[0]) || str[0] == '-') {
+    if (isdigit(str[0]) || str[0] == '-') {
         imm.type = NUM;
         int base = 10; // assume 10
         if (str[0] == '0') {
@@ -139,10 +141,12 @@ uint32_t read_word(FILE *file) {
     return word;
 }
 
-ErrorHandler ERROR_HANDLER = {
+_Thread_local ErrorHandler ERROR_HANDLER = {
     NULL,
     NOERR,
     NULL,
+    NULL,
+    {0, 0},
     NULL
 };
 
@@ -177,15 +181,46 @@ void error(void) {
 
     // Assembler error
     if (ERROR_HANDLER.err_code > 2) {
-        if (ERROR_HANDLER.line == NULL) {
+        const Line *line = ERROR_HANDLER.line;
+        const SourceLoc loc = ERROR_HANDLER.loc;
+        if (line != NULL) {
+            assembler_error(ERROR_HANDLER.err_code, text_filename(ERROR_HANDLER.source, line->file), line->number, line->text, ERROR_HANDLER.err_obj);
+        } else if (loc.number != 0) {
+            assembler_error(ERROR_HANDLER.err_code, text_filename(ERROR_HANDLER.source, loc.file), loc.number, NULL, ERROR_HANDLER.err_obj);
+        } else {
             fprintf(stderr, "An error occured\n");
-            return;
         }
-        assembler_error(ERROR_HANDLER.err_code, ERROR_HANDLER.line, ERROR_HANDLER.err_obj);
-        return;
     }
 }
 
+// Reports further errors at loc, for instructions and data whose line has been freed
+void set_error_loc(const SourceLoc loc) {
+    ERROR_HANDLER.line = NULL;
+    ERROR_HANDLER.loc = loc;
+}
+
+// Prints line `number` of the source at path, without leading whitespace; returns 0 if it could not be read
+// The source is opened with open_source(), so inline sources are read from the text that was assembled
+int print_source_line(const char *path, const unsigned int number) {
+    FILE *f = open_source(path);
+    if (f == NULL) return 0;
+
+    unsigned int current = 1;
+    int c;
+    while (current < number && (c = fgetc(f)) != EOF) {
+        if (c == '\n') current++;
+    }
+    while ((c = fgetc(f)) == ' ' || c == '\t') {}
+
+    int printed = 0;
+    for (; c != EOF && c != '\n' && c != '\r'; c = fgetc(f)) {
+        fputc(c, stderr);
+        printed = 1;
+    }
+    fclose(f);
+    return printed;
+}
+
 // Provides more context to the error
 void error_context(const char * str) {
     fprintf(stderr, "-> (%s)\n", str);
@@ -208,8 +243,11 @@ void general_error(const errcode code, const char *file, const char * object) {
     }
 }
 
-void assembler_error(const errcode code, const Line *line, const char * object) {
-    fprintf(stderr, "Error in %s:%d\n    %s\n    ", line->filename, line->number, line->text);
+// `text` is the preprocessed line; if NULL, the line is read back from the source file
+void assembler_error(const errcode code, const char *filename, const unsigned int number, const char *text, const char * object) {
+    fprintf(stderr, "Error in %s:%u\n    ", filename, number);
+    if (text != NULL) fprintf(stderr, "%s\n    ", text);
+    else if (print_source_line(filename, number)) fprintf(stderr, "\n    ");
     switch (code) {
         case TOKEN_ERR:
             fprintf(stderr, "-> unrecognized token \"%s\"\n", object);
@@ -251,6 +289,28 @@ unsigned long hash_key(const char *key, const size_t table_size) {
     return hash % table_size;
 }
 
+// Generates a 64-bit hash of a block of memory, used to detect changed files
+// uses FNV-1a; pass HASH_BYTES_INIT as `hash`, or the result of a previous call to continue hashing
+uint64_t hash_bytes(const void *bytes, const size_t len, uint64_t hash) {
+    const uint8_t *b = bytes;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= b[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Returns the number of online processors, or 1 if it cannot be determined
+int cpu_count(void) {
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+int in_section(const char *name, const char *section) {
+    const size_t len = strlen(section);
+    return strncmp(name, section, len) == 0 && (name[len] == '\0' || name[len] == '.');
+}
+
 // Takes as input the pointer to the beginning of an escape sequence, writes the corresponding character to res
 // Returns the length of the escape sequence, or 0 on failure
 size_t read_escape_sequence(const char *inp, char *res) {
@@ -336,7 +396,7 @@ size_t read_escape_sequence(const char *inp, char *res) {
     return len;
 }
 
-char * TOKENIZE_START = NULL; // Used by tokenize(): saves the index of the first character of the next token
+_Thread_local char * TOKENIZE_START = NULL; // Used by tokenize(): saves the index of the first character of the next token
 
 // Tokenize the string given a single delimeter
 // Unlike strtok(), tokenize() does not skip consecutive delimeters, instead stopping at each one.
@@ -517,6 +577,8 @@ void debug_binary(const char *name) {
     printf("text size: %d\n", header.text_size);
     printf("data size: %d\n", header.data_size);
     printf("entry: %d\n", header.entry);
+    printf("small data size: %d\n", header.sdata_size);
+    printf("flags: 0x%x\n", header.flags);
 
     printf("\n");
     for (size_t i = 0; i < header.text_size/4; i++) {
@@ -530,16 +592,24 @@ void debug_binary(const char *name) {
         printf("byte: 0x%.2x (%c)\n", c, c);
     }
 
+    printf("\n");
+    for (size_t i = 0; i < header.sdata_size; i++) {
+        unsigned char c = read_byte(file);
+        printf("small data byte: 0x%.2x (%c)\n", c, c);
+    }
+
     printf("\n");
     uint32_t rlc_size = read_word(file);
     for (size_t i = 0; i < rlc_size; i++) {
         RelocationEntry entry;
         fread(&entry, sizeof(RelocationEntry), 1, file);
-        char s[6];
+        char s[7] = "";
         if (entry.segment == TEXT)
             strcpy(s, ".text");
         else if (entry.segment == DATA)
             strcpy(s, ".data");
+        else if (entry.segment == SDATA)
+            strcpy(s, ".sdata");
 
         printf("address at %s+%d needs relocation of type %d for symbol %s\n", s, entry.target_offset, entry.reloc_type, entry.dependency);
     }
@@ -555,11 +625,13 @@ void debug_binary(const char *name) {
         fread(&offset, sizeof(uint32_t), 1, file);
         fread(&segment, sizeof(enum Segment), 1, file);
         fread(&binding, sizeof(enum Binding), 1, file);
-        char s[6];
+        char s[7];
         if (segment == TEXT) {
             strcpy(s, ".text");
         } else if (segment == DATA) {
             strcpy(s, ".data");
+        } else if (segment == SDATA) {
+            strcpy(s, ".sdata");
         } else {
             strcpy(s, "UNDEF");
         }